@@ -0,0 +1,337 @@
+/*
+ * genstore.c - write a synthetic variable store for the benchmarks
+ *
+ * The store is a directory laid out like efivarfs, which efibootmgr can
+ * use with --store or EFIBOOTMGR_STORE: one Name-GUID file per variable,
+ * holding the 32-bit attributes and then the data.
+ *
+ * See "COPYING" for license terms.
+ */
+
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define GLOBAL_GUID	"8be4df61-93ca-11d2-aa0d-00e098032b8c"
+
+#define VAR_NV_BS_RT	0x00000007
+#define LOAD_OPTION_ACTIVE	0x00000001
+
+/* the label delete-by-label looks for */
+#define VICTIM_LABEL	"bench-victim"
+
+static const char * const vendor_guids[] = {
+	"05ad34ba-6f02-4214-952e-4da0398e2bb9",
+	"4c19049f-4137-4dd3-9c10-8b97a83ffdfa",
+	"605dab50-e046-4300-abb6-3dd810dd8b23",
+	"77fa9abd-0359-4d32-bd60-28f4e78f784b",
+	"a9b5f8d2-cb6d-42c2-bc01-b5ffaae4335e",
+	"d719b2cb-3d3a-4596-a3bc-dad00e67656f",
+};
+
+static const char * const labels[] = {
+	"Fedora", "ubuntu", "debian", "Red Hat Enterprise Linux",
+	"Windows Boot Manager", "UEFI OS", "UEFI: PXE IPv4 Intel(R) I350",
+	"UEFI: Built-in EFI Shell", "opensuse-secureboot", "SUSE Linux",
+};
+
+static const char * const loaders[] = {
+	"\\EFI\\fedora\\shimx64.efi", "\\EFI\\ubuntu\\shimx64.efi",
+	"\\EFI\\debian\\grubx64.efi", "\\EFI\\redhat\\shimx64.efi",
+	"\\EFI\\Microsoft\\Boot\\bootmgfw.efi", "\\EFI\\BOOT\\BOOTX64.EFI",
+	"\\EFI\\opensuse\\shim.efi",
+};
+
+static const char * const args[] = {
+	"root=UUID=4b0a1d66-5e21-4c0f-9a3e-0d5f1ad0c2b7 ro quiet rhgb",
+	"root=/dev/mapper/vg0-root ro crashkernel=auto console=ttyS0,115200",
+	"initrd=\\initramfs.img root=LABEL=root rw",
+};
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t
+rng(void)
+{
+	uint64_t x = rng_state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return rng_state = x;
+}
+
+typedef struct {
+	uint8_t	*data;
+	size_t	size;
+	size_t	alloc;
+} buf_t;
+
+static void
+put(buf_t *buf, const void *data, size_t size)
+{
+	if (buf->size + size > buf->alloc) {
+		buf->alloc = (buf->size + size) * 2;
+		buf->data = realloc(buf->data, buf->alloc);
+		if (!buf->data)
+			err(1, "realloc");
+	}
+	memcpy(buf->data + buf->size, data, size);
+	buf->size += size;
+}
+
+static void
+put_u8(buf_t *buf, uint8_t v)
+{
+	put(buf, &v, 1);
+}
+
+static void
+put_le16(buf_t *buf, uint16_t v)
+{
+	uint8_t b[2] = { v, v >> 8 };
+
+	put(buf, b, sizeof(b));
+}
+
+static void
+put_le32(buf_t *buf, uint32_t v)
+{
+	put_le16(buf, v);
+	put_le16(buf, v >> 16);
+}
+
+static void
+put_le64(buf_t *buf, uint64_t v)
+{
+	put_le32(buf, v);
+	put_le32(buf, v >> 32);
+}
+
+static void
+put_random(buf_t *buf, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+		put_u8(buf, rng());
+}
+
+/* ASCII only, which is all we generate */
+static void
+put_ucs2(buf_t *buf, const char *s)
+{
+	do {
+		put_le16(buf, (unsigned char)*s);
+	} while (*s++);
+}
+
+static void
+node_header(buf_t *buf, uint8_t type, uint8_t subtype, uint16_t length)
+{
+	put_u8(buf, type);
+	put_u8(buf, subtype);
+	put_le16(buf, length);
+}
+
+static void
+hd_node(buf_t *buf, uint32_t part)
+{
+	node_header(buf, 4, 1, 42);
+	put_le32(buf, part);
+	put_le64(buf, 2048);
+	put_le64(buf, 1228800);
+	put_random(buf, 16);
+	put_u8(buf, 2);			/* GPT */
+	put_u8(buf, 2);			/* GUID signature */
+}
+
+static void
+file_node(buf_t *buf, const char *path)
+{
+	node_header(buf, 4, 4, 4 + (strlen(path) + 1) * 2);
+	put_ucs2(buf, path);
+}
+
+static void
+end_node(buf_t *buf)
+{
+	node_header(buf, 0x7f, 0xff, 4);
+}
+
+/*
+ * A mix of what real machines have: short HD()/File() paths, full paths
+ * through a PCI NVMe controller, and PXE entries.
+ */
+static void
+device_path(buf_t *buf, const char *loader)
+{
+	unsigned int kind = rng() % 20;
+
+	if (kind < 12) {
+		hd_node(buf, 1 + rng() % 4);
+		file_node(buf, loader);
+	} else if (kind < 17) {
+		node_header(buf, 2, 1, 12);	/* PciRoot(0x0) */
+		put_le32(buf, 0x0a0341d0);
+		put_le32(buf, 0);
+		node_header(buf, 1, 1, 6);	/* Pci(0x1d,0x0) */
+		put_u8(buf, 0);
+		put_u8(buf, 0x1d);
+		node_header(buf, 3, 23, 16);	/* NVMe(0x1,...) */
+		put_le32(buf, 1);
+		put_random(buf, 8);
+		hd_node(buf, 1);
+		file_node(buf, loader);
+	} else {
+		node_header(buf, 3, 11, 37);	/* MAC(...,0x1) */
+		put_random(buf, 6);
+		put(buf, (uint8_t[26]){ 0 }, 26);
+		put_u8(buf, 1);
+		node_header(buf, 3, 12, 27);	/* IPv4(0.0.0.0) */
+		put(buf, (uint8_t[23]){ 0 }, 23);
+	}
+	end_node(buf);
+}
+
+static void
+write_var(const char *dir, const char *name, const char *guid,
+	  uint32_t attributes, const void *data, size_t size)
+{
+	char path[4096];
+	buf_t buf = { 0 };
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s-%s", dir, name, guid);
+	put_le32(&buf, attributes);
+	put(&buf, data, size);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		err(1, "could not create %s", path);
+	if (write(fd, buf.data, buf.size) != (ssize_t)buf.size)
+		err(1, "could not write %s", path);
+	close(fd);
+	free(buf.data);
+}
+
+static void
+write_entry(const char *dir, unsigned int num, const char *label)
+{
+	const char *loader = loaders[rng() % (sizeof(loaders) / sizeof(loaders[0]))];
+	buf_t lo = { 0 }, dp = { 0 };
+	unsigned int data_kind = rng() % 10;
+	char name[16];
+
+	device_path(&dp, loader);
+	put_le32(&lo, rng() % 8 ? LOAD_OPTION_ACTIVE : 0);
+	put_le16(&lo, dp.size);
+	put_ucs2(&lo, label);
+	put(&lo, dp.data, dp.size);
+	if (data_kind < 4) {
+		const char *a = args[rng() % (sizeof(args) / sizeof(args[0]))];
+
+		put(&lo, a, strlen(a));
+	} else if (data_kind < 6) {
+		put_ucs2(&lo, "\\grubx64.efi");
+	} else if (data_kind < 7) {
+		/* like Windows' BCD object reference */
+		put(&lo, "WINDOWS", 8);
+		put_random(&lo, 128);
+	}
+
+	snprintf(name, sizeof(name), "Boot%04X", num);
+	write_var(dir, name, GLOBAL_GUID, VAR_NV_BS_RT, lo.data, lo.size);
+	free(lo.data);
+	free(dp.data);
+}
+
+static void
+usage(FILE *out, int status)
+{
+	fprintf(out,
+		"usage: genstore [-n ENTRIES] [-s SEED] DIR\n"
+		"Write ENTRIES (default 100) Boot#### variables, a BootOrder with\n"
+		"some duplicates in it, Timeout, BootCurrent and vendor variables\n"
+		"into DIR, laid out like efivarfs.\n");
+	exit(status);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long n_entries = 100;
+	uint16_t *order;
+	size_t order_len = 0;
+	uint16_t u16;
+	const char *dir;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:s:h")) != -1) {
+		switch (c) {
+		case 'n':
+			n_entries = strtoul(optarg, NULL, 0);
+			if (n_entries == 0 || n_entries > 0xffff)
+				errx(1, "ENTRIES must be between 1 and 65535");
+			break;
+		case 's':
+			rng_state = strtoull(optarg, NULL, 0) | 1;
+			break;
+		case 'h':
+			usage(stdout, 0);
+			break;
+		default:
+			usage(stderr, 1);
+		}
+	}
+	if (optind != argc - 1)
+		usage(stderr, 1);
+	dir = argv[optind];
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+		err(1, "could not create %s", dir);
+
+	for (unsigned long i = 0; i < n_entries; i++)
+		write_entry(dir, i, i == n_entries / 2 ? VICTIM_LABEL :
+			    labels[rng() % (sizeof(labels) / sizeof(labels[0]))]);
+
+	/* every entry, shuffled, with one in twenty listed twice */
+	order = calloc(n_entries + n_entries / 20 + 1, sizeof(*order));
+	if (!order)
+		err(1, "calloc");
+	for (unsigned long i = 0; i < n_entries; i++)
+		order[order_len++] = i;
+	for (size_t i = order_len - 1; i > 0; i--) {
+		size_t j = rng() % (i + 1);
+		uint16_t tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	for (unsigned long i = 0; i < n_entries / 20; i++)
+		order[order_len++] = order[rng() % n_entries];
+	write_var(dir, "BootOrder", GLOBAL_GUID, VAR_NV_BS_RT, order,
+		  order_len * sizeof(*order));
+	free(order);
+
+	u16 = 5;
+	write_var(dir, "Timeout", GLOBAL_GUID, VAR_NV_BS_RT, &u16, sizeof(u16));
+	u16 = 0;
+	write_var(dir, "BootCurrent", GLOBAL_GUID, 0x6, &u16, sizeof(u16));
+
+	/* what vendors leave lying around, which listing has to skip */
+	for (unsigned long i = 0; i < n_entries / 2 + 16; i++) {
+		const char *guid = vendor_guids[rng() % (sizeof(vendor_guids) / sizeof(vendor_guids[0]))];
+		buf_t data = { 0 };
+		char name[32];
+
+		snprintf(name, sizeof(name), "VendorSetting%04lX", i);
+		put_random(&data, 8 + rng() % 1024);
+		write_var(dir, name, guid, VAR_NV_BS_RT, data.data, data.size);
+		free(data.data);
+	}
+	return 0;
+}
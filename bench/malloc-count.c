@@ -0,0 +1,79 @@
+/*
+ * malloc-count.c - count a program's allocations, for the benchmarks
+ *
+ * LD_PRELOAD this, and the number of malloc(), calloc(), realloc() and
+ * posix_memalign() calls is written to the file named by
+ * MALLOC_COUNT_OUT when the program exits.  Programs that want the count
+ * as they go, like efibootmgr --stats and the microbenchmark, look up
+ * malloc_count() with dlsym().  glibc only.
+ *
+ * See "COPYING" for license terms.
+ */
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static atomic_ulong n_allocs;
+
+void *
+malloc(size_t size)
+{
+	n_allocs++;
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	n_allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	n_allocs++;
+	return __libc_realloc(ptr, size);
+}
+
+int
+posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *p;
+
+	n_allocs++;
+	p = __libc_memalign(alignment, size);
+	if (!p)
+		return ENOMEM;
+	*memptr = p;
+	return 0;
+}
+
+unsigned long
+malloc_count(void)
+{
+	return n_allocs;
+}
+
+static void __attribute__((__destructor__))
+report(void)
+{
+	unsigned long n = n_allocs;	/* before fopen() adds its own */
+	const char *path = getenv("MALLOC_COUNT_OUT");
+	FILE *out;
+
+	if (!path)
+		return;
+	out = fopen(path, "w");
+	if (!out)
+		return;
+	fprintf(out, "%lu\n", n);
+	fclose(out);
+}
@@ -0,0 +1,154 @@
+#!/bin/bash
+#
+# run-bench.sh - time efibootmgr against synthetic variable stores
+#
+# usage: run-bench.sh EFIBOOTMGR
+#
+# For each store size, genstore writes a directory laid out like efivarfs
+# and efibootmgr is pointed at it through EFIBOOTMGR_STORE.  Each operation
+# runs BENCH_RUNS times; the ones that change the store get a fresh copy
+# every time, made with hard links (the store replaces files rather than
+# writing into them, so the original is never touched).  One more run of
+# each is made under strace -c and with malloc-count.so preloaded to count
+# system calls and allocations.
+#
+# Environment:
+#   BENCH_SIZES		entry counts (default "10 100 1000 10000")
+#   BENCH_RUNS		timed runs per operation (default 20)
+#   BENCH_DIR		where the stores go (default ./stores)
+#   BENCH_DISK		the disk -c creates an entry on, which the device
+#			path is probed from; without it, create is skipped
+#   BENCH_PART		its partition number (default 1)
+#
+# See "COPYING" for license terms.
+
+set -u
+
+if [[ $# -ne 1 ]]; then
+	echo "usage: $0 EFIBOOTMGR" 1>&2
+	exit 1
+fi
+
+EFIBOOTMGR=$(realpath "$1")
+BENCHDIR=$(dirname "$(realpath "$0")")
+GENSTORE=${GENSTORE:-$BENCHDIR/genstore}
+MALLOC_COUNT=${MALLOC_COUNT:-$BENCHDIR/malloc-count.so}
+SIZES=${BENCH_SIZES:-10 100 1000 10000}
+RUNS=${BENCH_RUNS:-20}
+WORKDIR=${BENCH_DIR:-$BENCHDIR/stores}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+if [[ -z "${EPOCHREALTIME:-}" ]]; then
+	echo "$0: needs bash 5 or newer for EPOCHREALTIME" 1>&2
+	exit 1
+fi
+
+HAVE_STRACE=
+command -v strace >/dev/null 2>&1 && HAVE_STRACE=1
+
+# microseconds since the epoch
+now_us() {
+	local t=${EPOCHREALTIME/[.,]/}
+	echo $((10#$t))
+}
+
+# the store to run against: the base one, or a fresh copy of it
+store_for() {
+	local base=$1 mutates=$2
+
+	if [[ -z "$mutates" ]]; then
+		echo "$base"
+		return
+	fi
+	rm -rf "$TMP/store"
+	cp -al "$base" "$TMP/store"
+	echo "$TMP/store"
+}
+
+# percentile P (0-100) of the numbers in file F
+percentile() {
+	local p=$1 f=$2 n k
+
+	n=$(wc -l < "$f")
+	k=$(( (n * p + 99) / 100 ))
+	[[ $k -lt 1 ]] && k=1
+	sort -n "$f" | sed -n "${k}p"
+}
+
+# bench NAME MUTATES BASE ARGS...
+bench() {
+	local name=$1 mutates=$2 base=$3 store t0 t1 rc syscalls allocs
+	shift 3
+
+	: > "$TMP/samples"
+	for ((i = 0; i < RUNS; i++)); do
+		store=$(store_for "$base" "$mutates")
+		t0=$(now_us)
+		EFIBOOTMGR_STORE=$store "$EFIBOOTMGR" "$@" >/dev/null 2>"$TMP/err"
+		rc=$?
+		t1=$(now_us)
+		if [[ $rc -ne 0 ]]; then
+			printf "%-7s %-16s failed: %s\n" "$size" "$name" \
+				"$(head -n1 "$TMP/err")"
+			return
+		fi
+		echo $((t1 - t0)) >> "$TMP/samples"
+	done
+
+	syscalls=-
+	if [[ -n "$HAVE_STRACE" ]]; then
+		store=$(store_for "$base" "$mutates")
+		EFIBOOTMGR_STORE=$store strace -f -c -o "$TMP/strace" \
+			"$EFIBOOTMGR" "$@" >/dev/null 2>&1
+		syscalls=$(awk '$NF == "total" { print $4 }' "$TMP/strace")
+	fi
+
+	allocs=-
+	if [[ -e "$MALLOC_COUNT" ]]; then
+		store=$(store_for "$base" "$mutates")
+		rm -f "$TMP/allocs"
+		EFIBOOTMGR_STORE=$store LD_PRELOAD=$MALLOC_COUNT \
+			MALLOC_COUNT_OUT=$TMP/allocs \
+			"$EFIBOOTMGR" "$@" >/dev/null 2>&1
+		[[ -s "$TMP/allocs" ]] && allocs=$(cat "$TMP/allocs")
+	fi
+
+	printf "%-7s %-16s %10s %10s %10s %10s\n" "$size" "$name" \
+		"$(percentile 50 "$TMP/samples")" \
+		"$(percentile 99 "$TMP/samples")" "$syscalls" "$allocs"
+}
+
+mkdir -p "$WORKDIR"
+printf "%-7s %-16s %10s %10s %10s %10s\n" entries operation \
+	"p50(us)" "p99(us)" syscalls allocs
+
+for size in $SIZES; do
+	base=$WORKDIR/store-$size
+	if [[ ! -d "$base" ]]; then
+		"$GENSTORE" -n "$size" "$base.tmp" || exit 1
+		mv "$base.tmp" "$base"
+	fi
+
+	# the first half of the order, reversed, so --keep has the rest
+	# to carry over
+	order=$(for ((n = size / 2 - 1; n >= 0; n--)); do
+			printf "%04X," $n
+		done)
+	order=${order%,}
+	[[ -z "$order" ]] && order=0000
+
+	bench list "" "$base"
+	bench list-verbose "" "$base" -v
+	if [[ -n "${BENCH_DISK:-}" ]]; then
+		bench create yes "$base" -c --no-loader-check \
+			-d "$BENCH_DISK" -p "${BENCH_PART:-1}" \
+			-l '\EFI\bench\grubx64.efi' -L bench-new
+	else
+		printf "%-7s %-16s skipped: set BENCH_DISK\n" "$size" create
+	fi
+	bench delete-by-label yes "$base" -B -L bench-victim
+	bench order-keep yes "$base" -o "$order" --keep
+	bench dedupe yes "$base" -D
+	bench bootnext yes "$base" -n 0001
+done
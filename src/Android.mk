@@ -26,8 +26,19 @@ LOCAL_CFLAGS := \
 	-DDEFAULT_LOADER=\"\\\\elilo.efi\"
 
 LOCAL_SRC_FILES := \
+	dp_render.c \
 	efi.c \
 	efibootmgr.c \
-	parse_loader_data.c
+	esp_cache.c \
+	fabric.c \
+	fv_image.c \
+	loader_check.c \
+	nvram_bench.c \
+	parse_loader_data.c \
+	sha256.c \
+	snapshot.c \
+	stats.c \
+	store.c \
+	sysfs.c
 
 include $(BUILD_EXECUTABLE)
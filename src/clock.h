@@ -0,0 +1,28 @@
+/*
+ * clock.h - nanosecond clock readings for timing things
+ *
+ * See "COPYING" for license terms.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+static inline uint64_t
+__attribute__((__unused__))
+clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* For intervals: CLOCK_MONOTONIC never goes backwards. */
+static inline uint64_t
+__attribute__((__unused__))
+now_ns(void)
+{
+	return clock_ns(CLOCK_MONOTONIC);
+}
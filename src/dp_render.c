@@ -0,0 +1,272 @@
+/*
+ * dp_render.c - render device paths to text through a reusable buffer
+ *
+ * See "COPYING" for license terms.
+ */
+
+#include "fix_coverity.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <efivar.h>
+
+#include "dp_render.h"
+#include "hash.h"
+
+#define DP_SCRATCH_MIN		1024
+#define DP_CACHE_MIN_SLOTS	64
+
+struct dp_text_slot {
+	uint64_t	hash;
+	uint8_t		*raw;
+	size_t		raw_size;
+	char		*text;
+};
+
+static int
+grow_scratch(dp_text_cache_t *cache, size_t needed)
+{
+	size_t size = cache->scratch_size ? cache->scratch_size
+					  : DP_SCRATCH_MIN;
+	unsigned char *scratch;
+
+	while (size < needed)
+		size *= 2;
+	if (size == cache->scratch_size)
+		return 0;
+
+	scratch = realloc(cache->scratch, size);
+	if (!scratch)
+		return -1;
+	cache->scratch = scratch;
+	cache->scratch_size = size;
+	return 0;
+}
+
+/*
+ * Format dp into the scratch buffer.  efidp_format_device_path() reports
+ * the size it needs even when the buffer is short, so we only go around
+ * a second time when the path didn't fit.
+ */
+static ssize_t
+format_into_scratch(dp_text_cache_t *cache, const_efidp dp, ssize_t limit)
+{
+	ssize_t rc;
+
+	if (grow_scratch(cache, DP_SCRATCH_MIN) < 0)
+		return -1;
+
+	rc = efidp_format_device_path(cache->scratch, cache->scratch_size,
+				      dp, limit);
+	if (rc < 0 || (size_t)rc < cache->scratch_size)
+		return rc;
+
+	if (grow_scratch(cache, rc + 1) < 0)
+		return -1;
+
+	rc = efidp_format_device_path(cache->scratch, cache->scratch_size,
+				      dp, limit);
+	if (rc >= 0 && (size_t)rc >= cache->scratch_size) {
+		errno = ENOSPC;
+		return -1;
+	}
+	return rc;
+}
+
+static dp_text_slot_t *
+find_slot(dp_text_slot_t *slots, size_t nslots, uint64_t hash,
+	  const uint8_t *raw, size_t raw_size)
+{
+	size_t mask = nslots - 1;
+	size_t i = hash & mask;
+
+	while (slots[i].text) {
+		if (slots[i].hash == hash && slots[i].raw_size == raw_size &&
+		    !memcmp(slots[i].raw, raw, raw_size))
+			break;
+		i = (i + 1) & mask;
+	}
+	return &slots[i];
+}
+
+static int
+grow_slots(dp_text_cache_t *cache)
+{
+	size_t nslots = cache->nslots ? cache->nslots * 2 : DP_CACHE_MIN_SLOTS;
+	dp_text_slot_t *slots;
+
+	slots = calloc(nslots, sizeof(*slots));
+	if (!slots)
+		return -1;
+
+	for (size_t i = 0; i < cache->nslots; i++) {
+		dp_text_slot_t *old = &cache->slots[i];
+		if (!old->text)
+			continue;
+		*find_slot(slots, nslots, old->hash, old->raw,
+			   old->raw_size) = *old;
+	}
+	free(cache->slots);
+	cache->slots = slots;
+	cache->nslots = nslots;
+	return 0;
+}
+
+const char *
+dp_render(dp_text_cache_t *cache, const_efidp dp, ssize_t limit)
+{
+	const uint8_t *raw = (const uint8_t *)dp;
+	size_t raw_size;
+	dp_text_slot_t *slot;
+	uint64_t hash;
+	ssize_t rc;
+
+	if (!dp || limit < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	raw_size = limit;
+
+	/* keep the load factor under 3/4 so probing stays short */
+	if ((cache->nused + 1) * 4 > cache->nslots * 3 &&
+	    grow_slots(cache) < 0)
+		return NULL;
+
+	hash = fnv1a64(raw, raw_size, FNV1A64_INIT);
+	slot = find_slot(cache->slots, cache->nslots, hash, raw, raw_size);
+	if (slot->text)
+		return slot->text;
+
+	rc = format_into_scratch(cache, dp, limit);
+	if (rc < 0)
+		return NULL;
+
+	slot->raw = malloc(raw_size ? raw_size : 1);
+	slot->text = strdup((char *)cache->scratch);
+	if (!slot->raw || !slot->text) {
+		free(slot->raw);
+		free(slot->text);
+		slot->raw = NULL;
+		slot->text = NULL;
+		return NULL;
+	}
+	memcpy(slot->raw, raw, raw_size);
+	slot->raw_size = raw_size;
+	slot->hash = hash;
+	cache->nused++;
+
+	return slot->text;
+}
+
+/*
+ * Forget everything we've rendered, but keep the scratch buffer and slot
+ * table for reuse.
+ */
+void
+dp_text_cache_clear(dp_text_cache_t *cache)
+{
+	for (size_t i = 0; i < cache->nslots; i++) {
+		free(cache->slots[i].raw);
+		free(cache->slots[i].text);
+	}
+	if (cache->slots)
+		memset(cache->slots, 0, cache->nslots * sizeof(*cache->slots));
+	cache->nused = 0;
+}
+
+void
+dp_text_cache_free(dp_text_cache_t *cache)
+{
+	dp_text_cache_clear(cache);
+	free(cache->slots);
+	free(cache->scratch);
+	memset(cache, 0, sizeof(*cache));
+}
+
+/* File() names aren't necessarily aligned, so don't index them directly */
+static inline uint16_t
+ucs2_at(const uint8_t *s, size_t i)
+{
+	uint16_t c;
+
+	memcpy(&c, s + i * sizeof(c), sizeof(c));
+	return c;
+}
+
+static bool
+ucs2_has_prefix(const uint8_t *s, size_t len, const char *prefix)
+{
+	size_t plen = strlen(prefix);
+
+	if (len < plen)
+		return false;
+	for (size_t i = 0; i < plen; i++)
+		if (ucs2_at(s, i) != (unsigned char)prefix[i])
+			return false;
+	return true;
+}
+
+bool
+dp_is_shim(const_efidp dp, ssize_t limit)
+{
+	const char * const efi_dir = "\\EFI\\";
+	const char * const shim = "\\shim";
+	const char * const suffix = ".efi";
+	const uint8_t *p = (const uint8_t *)dp;
+	const uint8_t *file = NULL;
+	size_t len = 0;
+	ssize_t off = 0;
+
+	if (!dp)
+		return false;
+
+	/*
+	 * Find the last node before the end of the path and remember it
+	 * if it's a File() node.
+	 */
+	while (limit - off >= (ssize_t)sizeof(efidp_header)) {
+		efidp_header hdr;
+
+		memcpy(&hdr, p + off, sizeof(hdr));
+		if (hdr.length < sizeof(hdr) || hdr.length > limit - off)
+			return false;
+		if (hdr.type == EFIDP_END_TYPE)
+			break;
+
+		if (hdr.type == EFIDP_MEDIA_TYPE &&
+		    hdr.subtype == EFIDP_MEDIA_FILE) {
+			file = p + off + sizeof(hdr);
+			len = (hdr.length - sizeof(hdr)) / sizeof(uint16_t);
+		} else {
+			file = NULL;
+		}
+		off += hdr.length;
+	}
+	if (!file)
+		return false;
+
+	for (size_t i = 0; i < len; i++) {
+		if (ucs2_at(file, i) == 0) {
+			len = i;
+			break;
+		}
+	}
+
+	/* \EFI\<vendor>\...\shim*.efi */
+	if (!ucs2_has_prefix(file, len, efi_dir))
+		return false;
+	for (size_t i = strlen(efi_dir); i < len; i++) {
+		if (!ucs2_has_prefix(file + i * sizeof(uint16_t), len - i, shim))
+			continue;
+		i += strlen(shim);
+		return len - i >= strlen(suffix) &&
+		       ucs2_has_prefix(file + (len - strlen(suffix)) *
+					      sizeof(uint16_t),
+				       strlen(suffix), suffix);
+	}
+	return false;
+}
@@ -0,0 +1,47 @@
+/*
+ * dp_render.h - render device paths to text through a reusable buffer
+ *
+ * See "COPYING" for license terms.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <efivar.h>
+
+typedef struct dp_text_slot dp_text_slot_t;
+
+/*
+ * Rendered device path text, keyed by a hash of the raw device path
+ * bytes.  The scratch buffer is reused for every path we format and only
+ * grows when efidp_format_device_path() tells us it was too small.
+ *
+ * A cache is not thread safe; use one per thread.
+ */
+typedef struct {
+	unsigned char	*scratch;
+	size_t		scratch_size;
+	dp_text_slot_t	*slots;
+	size_t		nslots;
+	size_t		nused;
+} dp_text_cache_t;
+
+#define DP_TEXT_CACHE_INIT { NULL, 0, NULL, 0, 0 }
+
+/*
+ * Returns the text form of dp, or NULL on error.  The string belongs to
+ * the cache and stays valid until dp_text_cache_free().
+ */
+extern const char *dp_render(dp_text_cache_t *cache, const_efidp dp,
+			     ssize_t limit);
+extern void dp_text_cache_clear(dp_text_cache_t *cache);
+extern void dp_text_cache_free(dp_text_cache_t *cache);
+
+/*
+ * Returns true if the last node of dp is a File() node naming a shim
+ * binary, i.e. \EFI\<vendor>\shim*.efi.
+ */
+extern bool dp_is_shim(const_efidp dp, ssize_t limit);
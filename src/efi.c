@@ -22,6 +22,7 @@
 
 #include <ctype.h>
 #include <err.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -40,11 +41,16 @@
 #include <linux/sockios.h>
 #include <linux/types.h>
 #include <net/if.h>
+#include <arpa/inet.h>
 #include <asm/types.h>
 #include <linux/ethtool.h>
+#include <linux/magic.h>
 #include "efi.h"
 #include "efibootmgr.h"
+#include "esp_cache.h"
+#include "fabric.h"
 #include "list.h"
+#include "store.h"
 
 static int
 select_var_names_by_prefix(const efi_guid_t *guid, const char *prefix,
@@ -80,11 +86,11 @@ read_prefixed_var_names(filter_t filter, const char *prefix, char ***namelist)
 	int nentries = 0;
 	int i;
 
-	rc = efi_variables_supported();
+	rc = store_variables_supported();
 	if (!rc)
 		return -1;
 
-	while ((rc = efi_get_next_variable_name(&guid, &name)) > 0) {
+	while ((rc = store_get_next_variable_name(&guid, &name)) > 0) {
 		if (!filter(guid, prefix, name))
 			continue;
 
@@ -132,6 +138,109 @@ read_boot_var_names(char ***namelist)
 	return read_var_names("Boot", namelist);
 }
 
+static bool
+is_canonical_var_name(const char *prefix, const char *name)
+{
+	size_t plen = strlen(prefix);
+	const char *num = name + plen;
+
+	if (strlen(name) != plen + 4)
+		return false;
+	for (int i = 0; i < 4; i++)
+		if (!isdigit(num[i]) && !(num[i] >= 'A' && num[i] <= 'F'))
+			return false;
+	return true;
+}
+
+/*
+ * Like read_var_names(), but without keeping every name around: names of
+ * the usual <prefix>XXXX form only take up a bit in a fixed size bitmap,
+ * and only the rare odd ones (lower case hex, trailing junk) are kept as
+ * strings.  var_name_set_next() hands them back in the same order
+ * read_var_names() sorts them into.
+ */
+int
+read_var_name_set(const char *prefix, var_name_set_t *set)
+{
+	efi_guid_t *guid = NULL;
+	char *name = NULL;
+	int rc;
+
+	memset(set, 0, sizeof(*set));
+	set->prefix = prefix;
+
+	rc = store_variables_supported();
+	if (!rc)
+		return -1;
+
+	while ((rc = store_get_next_variable_name(&guid, &name)) > 0) {
+		if (!select_var_names_by_prefix(guid, prefix, name))
+			continue;
+
+		if (is_canonical_var_name(prefix, name)) {
+			unsigned int num = strtoul(name + strlen(prefix),
+						   NULL, 16);
+			set->present[num / 8] |= 1 << (num % 8);
+			continue;
+		}
+
+		char *aname = strdup(name);
+		char **tmp = realloc(set->odd,
+				     (set->n_odd + 1) * sizeof(*set->odd));
+		if (!aname || !tmp) {
+			free(aname);
+			if (tmp)
+				set->odd = tmp;
+			rc = -1;
+			break;
+		}
+		set->odd = tmp;
+		set->odd[set->n_odd++] = aname;
+	}
+	if (rc < 0) {
+		free_var_name_set(set);
+		return rc;
+	}
+	if (set->n_odd)
+		qsort(set->odd, set->n_odd, sizeof(char *), cmpstringp);
+	return 0;
+}
+
+const char *
+var_name_set_next(var_name_set_t *set)
+{
+	while (set->next_num <= UINT16_MAX) {
+		unsigned int num = set->next_num;
+
+		if (!(set->present[num / 8] & (1 << (num % 8)))) {
+			set->next_num++;
+			continue;
+		}
+
+		snprintf(set->name, sizeof(set->name), "%s%04X",
+			 set->prefix, num);
+		if (set->next_odd < set->n_odd &&
+		    strcoll(set->odd[set->next_odd], set->name) < 0)
+			return set->odd[set->next_odd++];
+
+		set->next_num++;
+		return set->name;
+	}
+	if (set->next_odd < set->n_odd)
+		return set->odd[set->next_odd++];
+	return NULL;
+}
+
+void
+free_var_name_set(var_name_set_t *set)
+{
+	for (size_t i = 0; i < set->n_odd; i++)
+		free(set->odd[i]);
+	free(set->odd);
+	set->odd = NULL;
+	set->n_odd = 0;
+}
+
 static int
 get_path_options(void)
 {
@@ -156,222 +265,801 @@ get_path_options(void)
 	}
 }
 
-/**
- * make_linux_load_option()
- * @data - load option returned
- * *data_size - load option size returned
- *
- * Returns 0 on error, length of load option created on success.
+/*
+ * Device paths we generate are a few hundred bytes at most, so try once
+ * into a buffer this size instead of asking for the size first.  Each
+ * call re-probes sysfs, the partition table or the NIC.
  */
-ssize_t
-make_linux_load_option(uint8_t **data, size_t *data_size,
-		       uint8_t *optional_data, size_t optional_data_size)
+#define DEVICE_PATH_GUESS	4096
+
+/* IPv4() device path node, UEFI Spec 2.10 section 10.3.5.8 */
+typedef struct {
+	efidp_header	header;
+	uint8_t		local_ip_addr[4];
+	uint8_t		remote_ip_addr[4];
+	uint16_t	local_port;
+	uint16_t	remote_port;
+	uint16_t	protocol;
+	uint8_t		static_ip_addr;
+	uint8_t		gateway_ip_addr[4];
+	uint8_t		subnet_mask[4];
+} __attribute__((packed)) ipv4_node_t;
+
+/* IPv6() device path node, UEFI Spec 2.10 section 10.3.5.9 */
+typedef struct {
+	efidp_header	header;
+	uint8_t		local_ip_addr[16];
+	uint8_t		remote_ip_addr[16];
+	uint16_t	local_port;
+	uint16_t	remote_port;
+	uint16_t	protocol;
+	uint8_t		ip_addr_origin;
+	uint8_t		prefix_length;
+	uint8_t		gateway_ip_addr[16];
+} __attribute__((packed)) ipv6_node_t;
+
+/*
+ * Returns the offset of the first node in dp of the given type and
+ * subtype, or of its End node if there isn't one.
+ */
+static ssize_t
+find_dp_node(const uint8_t *dp, ssize_t size, uint8_t type, uint8_t subtype)
 {
-	ssize_t needed;
-	uint32_t attributes = opts.active ? LOAD_OPTION_ACTIVE : 0
-			    | (opts.reconnect > 0 ? LOAD_OPTION_FORCE_RECONNECT : 0);
-	int saved_errno;
-	efidp dp = NULL;
+	ssize_t off = 0;
 
-	if (opts.iface && opts.ip_version == EFIBOOTMGR_IPV4) {
-		needed = efi_generate_ipv4_device_path(NULL, 0, opts.iface,
-						       opts.local_ip_addr,
-						       opts.remote_ip_addr,
-						       opts.gateway_ip_addr,
-						       opts.ip_netmask,
-						       opts.ip_local_port,
-						       opts.ip_remote_port,
-						       opts.ip_protocol,
-						       opts.ip_addr_origin);
-		if (needed < 0) {
-			efi_error("efi_generate_ipv4_device_path() = %zd (failed)",
-					needed);
+	while (size - off >= (ssize_t)sizeof(efidp_header)) {
+		efidp_header hdr;
+
+		memcpy(&hdr, dp + off, sizeof(hdr));
+		if (hdr.length < sizeof(hdr) || hdr.length > size - off)
+			break;
+		if (hdr.type == EFIDP_END_TYPE ||
+		    (hdr.type == type && hdr.subtype == subtype))
+			return off;
+		off += hdr.length;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+#define IP_PROTOCOL_TCP		6
+
+/*
+ * The IPv4() node for a fabric target, with the addresses the kernel's
+ * session uses.  The firmware still gets its own address from DHCP.
+ */
+static int
+make_fabric_ipv4_node(ipv4_node_t *node, const fabric_portal_t *portal)
+{
+	memset(node, 0, sizeof(*node));
+	efidp_make_generic((uint8_t *)node, sizeof(*node), EFIDP_MESSAGE_TYPE,
+			   EFIDP_MSG_IPv4, sizeof(*node));
+	node->protocol = IP_PROTOCOL_TCP;
+	node->remote_port = portal->remote_port;
+	if (portal->local_addr[0])
+		inet_pton(AF_INET, portal->local_addr, node->local_ip_addr);
+	if (!portal->remote_addr[0]) {
+		efi_error("could not find the target's address in sysfs");
+		errno = ENODEV;
+		return -1;
+	}
+	if (inet_pton(AF_INET, portal->remote_addr,
+		      node->remote_ip_addr) != 1) {
+		efi_error("target address \"%s\" is not an IPv4 address",
+			  portal->remote_addr);
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * The IPv6() node from the --ipv6 options.  For a fabric target, what
+ * they leave out comes from the kernel's session.
+ */
+static int
+make_ipv6_node(ipv6_node_t *node, const fabric_portal_t *portal)
+{
+	memset(node, 0, sizeof(*node));
+	efidp_make_generic((uint8_t *)node, sizeof(*node), EFIDP_MESSAGE_TYPE,
+			   EFIDP_MSG_IPv6, sizeof(*node));
+	node->local_port = opts.ip_local_port;
+	node->remote_port = opts.ip_remote_port;
+	node->protocol = opts.ip_protocol;
+	node->ip_addr_origin = opts.ip_addr_origin;
+
+	if (opts.local_ip_addr) {
+		char addr[INET6_ADDRSTRLEN];
+		const char *slash = strchr(opts.local_ip_addr, '/');
+		size_t len = slash ? (size_t)(slash - opts.local_ip_addr)
+				   : strlen(opts.local_ip_addr);
+		char *end;
+		long prefix = 64;
+
+		if (len >= sizeof(addr))
+			goto err;
+		memcpy(addr, opts.local_ip_addr, len);
+		addr[len] = '\0';
+		if (inet_pton(AF_INET6, addr, node->local_ip_addr) != 1)
+			goto err;
+		if (slash) {
+			prefix = strtol(slash + 1, &end, 10);
+			if (*end || prefix < 0 || prefix > 128)
+				goto err;
+		}
+		node->prefix_length = prefix;
+	}
+	if (opts.remote_ip_addr &&
+	    inet_pton(AF_INET6, opts.remote_ip_addr,
+		      node->remote_ip_addr) != 1)
+		goto err;
+	if (opts.gateway_ip_addr &&
+	    inet_pton(AF_INET6, opts.gateway_ip_addr,
+		      node->gateway_ip_addr) != 1)
+		goto err;
+
+	if (portal) {
+		node->protocol = IP_PROTOCOL_TCP;
+		if (!node->remote_port)
+			node->remote_port = portal->remote_port;
+		if (!opts.remote_ip_addr && !portal->remote_addr[0]) {
+			efi_error("could not find the target's address in sysfs");
+			errno = ENODEV;
 			return -1;
 		}
-		if (data_size && *data_size) {
-			dp = malloc(needed);
-
-			needed = efi_generate_ipv4_device_path(
-							(uint8_t *)dp, needed,
-							opts.iface,
-							opts.local_ip_addr,
-							opts.remote_ip_addr,
-							opts.gateway_ip_addr,
-							opts.ip_netmask,
-							opts.ip_local_port,
-							opts.ip_remote_port,
-							opts.ip_protocol,
-							opts.ip_addr_origin);
-			if (needed < 0) {
-				free(dp);
-				efi_error("efi_generate_ipv4_device_path() = %zd (failed)",
-						needed);
-				return -1;
-			}
+		if (!opts.remote_ip_addr &&
+		    inet_pton(AF_INET6, portal->remote_addr,
+			      node->remote_ip_addr) != 1) {
+			efi_error("target address \"%s\" is not an IPv6 address",
+				  portal->remote_addr);
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	return 0;
+err:
+	efi_error("invalid IPv6 address");
+	errno = EINVAL;
+	return -1;
+}
+
+/*
+ * Build MAC()/IPv4() or MAC()/IPv6(), followed by tail, which must end in
+ * End.  The MAC() part, and the interface probing behind it, comes from
+ * efi_generate_ipv4_device_path(); so does IPv4(), unless ip_node is
+ * given to go in its place.  Like the libefiboot generators, this returns
+ * the size needed without writing anything if buf is too small.
+ */
+static ssize_t
+generate_net_device_path(uint8_t *buf, ssize_t size,
+			 const void *ip_node, ssize_t ip_node_size,
+			 const uint8_t *tail, ssize_t tail_size)
+{
+	uint8_t *base;
+	ssize_t base_size, prefix_size, needed;
+
+	base = malloc(DEVICE_PATH_GUESS);
+	if (!base)
+		return -1;
+	/* the addresses are in ip_node if we're replacing IPv4() */
+	if (ip_node)
+		base_size = efi_generate_ipv4_device_path(base,
+						DEVICE_PATH_GUESS, opts.iface,
+						NULL, NULL, NULL, NULL, 0, 0, 0,
+						EFIBOOTMGR_IPV4_ORIGIN_DHCP);
+	else
+		base_size = efi_generate_ipv4_device_path(base,
+						DEVICE_PATH_GUESS, opts.iface,
+						opts.local_ip_addr,
+						opts.remote_ip_addr,
+						opts.gateway_ip_addr,
+						opts.ip_netmask,
+						opts.ip_local_port,
+						opts.ip_remote_port,
+						opts.ip_protocol,
+						opts.ip_addr_origin);
+	if (base_size < 0 || base_size > DEVICE_PATH_GUESS) {
+		efi_error("efi_generate_ipv4_device_path() = %zd (failed)",
+			  base_size);
+		free(base);
+		return -1;
+	}
+
+	/* keep IPv4() unless we're replacing it, but never End */
+	if (ip_node)
+		prefix_size = find_dp_node(base, base_size, EFIDP_MESSAGE_TYPE,
+					   EFIDP_MSG_IPv4);
+	else
+		prefix_size = find_dp_node(base, base_size, EFIDP_END_TYPE,
+					   EFIDP_END_ENTIRE);
+	if (prefix_size < 0) {
+		free(base);
+		return -1;
+	}
+
+	needed = prefix_size + (ip_node ? ip_node_size : 0) + tail_size;
+	if (!buf || size < needed) {
+		free(base);
+		return needed;
+	}
+
+	memcpy(buf, base, prefix_size);
+	buf += prefix_size;
+	free(base);
+	if (ip_node) {
+		memcpy(buf, ip_node, ip_node_size);
+		buf += ip_node_size;
+	}
+	memcpy(buf, tail, tail_size);
+	return needed;
+}
+
+/* Uri()/End for HTTP boot, or just End */
+static ssize_t
+generate_uri_device_path(uint8_t *buf, ssize_t size)
+{
+	uint8_t *tail;
+	ssize_t uri_size = 0, rc;
+	ipv6_node_t ipv6;
+	bool is_ipv6 = opts.ip_version == EFIBOOTMGR_IPV6;
+
+	if (is_ipv6 && make_ipv6_node(&ipv6, NULL) < 0)
+		return -1;
+
+	if (opts.uri) {
+		uri_size = sizeof(efidp_header) + strlen(opts.uri);
+		if (uri_size > UINT16_MAX) {
+			errno = EINVAL;
+			return -1;
 		}
-	} else if (opts.iface && opts.ip_version == EFIBOOTMGR_IPV6) {
-		errno = ENOSYS;
+	}
+	tail = malloc(uri_size + sizeof(efidp_header));
+	if (!tail)
+		return -1;
+	if (opts.uri) {
+		efidp_make_generic(tail, uri_size, EFIDP_MESSAGE_TYPE,
+				   EFIDP_MSG_URI, uri_size);
+		memcpy(tail + sizeof(efidp_header), opts.uri,
+		       uri_size - sizeof(efidp_header));
+	}
+	efidp_make_end_entire(tail + uri_size, sizeof(efidp_header));
+	rc = generate_net_device_path(buf, size, is_ipv6 ? &ipv6 : NULL,
+				      sizeof(ipv6), tail,
+				      uri_size + sizeof(efidp_header));
+	free(tail);
+	return rc;
+}
+
+/*
+ * The network path to an iSCSI or NVMe-oF target, the target node from
+ * the kernel's session, then HD()/File() on the remote disk.
+ */
+static ssize_t
+generate_fabric_device_path(const char *disk, int part, const char *loader,
+			    uint8_t *buf, ssize_t size)
+{
+	uint8_t *node = NULL, *tail = NULL;
+	ssize_t node_size, hd_size, rc = -1;
+	fabric_portal_t portal;
+	union {
+		ipv4_node_t v4;
+		ipv6_node_t v6;
+	} ip;
+	ssize_t ip_size;
+
+	node_size = make_fabric_node(opts.fabric, disk, &node, &portal);
+	if (node_size < 0)
 		return -1;
+
+	if (opts.ip_version == EFIBOOTMGR_IPV6) {
+		if (make_ipv6_node(&ip.v6, &portal) < 0)
+			goto out;
+		ip_size = sizeof(ip.v6);
 	} else {
-		uint32_t options;
+		if (make_fabric_ipv4_node(&ip.v4, &portal) < 0)
+			goto out;
+		ip_size = sizeof(ip.v4);
+	}
+
+	tail = malloc(node_size + DEVICE_PATH_GUESS);
+	if (!tail)
+		goto out;
+	memcpy(tail, node, node_size);
+	hd_size = efi_generate_file_device_path_from_esp(tail + node_size,
+						DEVICE_PATH_GUESS, disk, part,
+						loader, EFIBOOT_ABBREV_HD);
+	if (hd_size < 0 || hd_size > DEVICE_PATH_GUESS) {
+		efi_error("efi_generate_file_device_path_from_esp() = %zd (failed)",
+			  hd_size);
+		goto out;
+	}
+	rc = generate_net_device_path(buf, size, &ip, ip_size, tail,
+				      node_size + hd_size);
+out:
+	free(tail);
+	free(node);
+	return rc;
+}
 
-		options = get_path_options();
+static ssize_t
+generate_device_path(const char *disk, int part, const char *loader,
+		     uint32_t options, uint8_t *buf, ssize_t size)
+{
+	ssize_t rc;
 
-		needed = efi_generate_file_device_path_from_esp(NULL, 0,
-						opts.disk, opts.part,
-						opts.loader, options,
+	if (opts.iface && opts.fabric) {
+		rc = generate_fabric_device_path(disk, part, loader, buf, size);
+	} else if (opts.iface &&
+		   (opts.uri || opts.ip_version == EFIBOOTMGR_IPV6)) {
+		rc = generate_uri_device_path(buf, size);
+	} else if (opts.iface && opts.ip_version == EFIBOOTMGR_IPV4) {
+		rc = efi_generate_ipv4_device_path(buf, size, opts.iface,
+						   opts.local_ip_addr,
+						   opts.remote_ip_addr,
+						   opts.gateway_ip_addr,
+						   opts.ip_netmask,
+						   opts.ip_local_port,
+						   opts.ip_remote_port,
+						   opts.ip_protocol,
+						   opts.ip_addr_origin);
+		if (rc < 0)
+			efi_error("efi_generate_ipv4_device_path() = %zd (failed)",
+				  rc);
+	} else {
+		rc = efi_generate_file_device_path_from_esp(buf, size,
+						disk, part, loader, options,
 						opts.edd10_devicenum);
-		if (needed < 0) {
+		if (rc < 0)
 			efi_error("efi_generate_file_device_path_from_esp() = %zd (failed)",
-                                  needed);
+				  rc);
+	}
+	return rc;
+}
+
+static ssize_t
+alloc_device_path(const char *disk, int part, const char *loader,
+		  uint32_t options, uint8_t **dp_out)
+{
+	uint8_t *dp, *new_dp;
+	ssize_t needed;
+
+	dp = malloc(DEVICE_PATH_GUESS);
+	if (!dp)
+		return -1;
+
+	needed = generate_device_path(disk, part, loader, options, dp,
+				      DEVICE_PATH_GUESS);
+	if (needed < 0 && errno == ENOSPC)
+		needed = generate_device_path(disk, part, loader, options,
+					      NULL, 0);
+	if (needed < 0) {
+		free(dp);
+		return -1;
+	}
+	if (needed > DEVICE_PATH_GUESS) {
+		/* only happens if the guess was too small */
+		new_dp = realloc(dp, needed);
+		if (!new_dp) {
+			free(dp);
 			return -1;
 		}
+		dp = new_dp;
+		needed = generate_device_path(disk, part, loader, options,
+					      dp, needed);
+		if (needed < 0) {
+			free(dp);
+			return -1;
+		}
+	}
+	*dp_out = dp;
+	return needed;
+}
 
-		if (data_size && *data_size) {
-			dp = malloc(needed);
-			if (dp == NULL)
-				return -1;
-			needed = efi_generate_file_device_path_from_esp(
-						(uint8_t *)dp, needed,
-						opts.disk, opts.part,
-						opts.loader, options,
-						opts.edd10_devicenum);
-			if (needed < 0) {
-			        efi_error("efi_generate_file_device_path_from_esp() = %zd (failed)",
-                                          needed);
-				free(dp);
-				return -1;
-			}
+/*
+ * --abbrev auto: build the full path and each abbreviation of it, and
+ * keep the smallest one this firmware can resolve.  Every firmware has to
+ * resolve HD() short-form paths, but File() ones are optional, so we only
+ * use them when some active entry already does.
+ */
+static ssize_t
+make_shortest_device_path(const char *disk, int part, const char *loader,
+			  efidp *dp_out)
+{
+	static const struct {
+		uint32_t options;
+		const char *name;
+	} candidates[] = {
+		{ EFIBOOT_ABBREV_NONE, "full" },
+		{ EFIBOOT_ABBREV_HD, "HD()" },
+		{ EFIBOOT_ABBREV_FILE, "File()" },
+	};
+	uint8_t *best = NULL, *dp;
+	ssize_t best_size = -1, full_size = -1, size;
+	const char *best_name = NULL;
+
+	for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+		if (candidates[i].options == EFIBOOT_ABBREV_FILE &&
+		    !opts.file_paths_resolve)
+			continue;
+
+		size = alloc_device_path(disk, part, loader,
+					 candidates[i].options, &dp);
+		if (size < 0) {
+			/* the full path needs EDD or sysfs info we may lack */
+			if (candidates[i].options == EFIBOOT_ABBREV_NONE)
+				continue;
+			free(best);
+			return -1;
 		}
+		if (candidates[i].options == EFIBOOT_ABBREV_NONE)
+			full_size = size;
+		if (best && size >= best_size) {
+			free(dp);
+			continue;
+		}
+		free(best);
+		best = dp;
+		best_size = size;
+		best_name = candidates[i].name;
 	}
 
-	size_t data_size_tmp = 0;
-	if (data_size)
-		data_size_tmp = *data_size;
-	needed = efi_loadopt_create(*data, data_size_tmp,
-				      attributes, dp, needed, opts.label,
-				      optional_data, optional_data_size);
-	if (dp) {
-		saved_errno = errno;
-		free(dp);
-		dp = NULL;
-		errno = saved_errno;
+	if (opts.verbose >= 1) {
+		if (full_size > best_size)
+			printf("Using a %s device path, %zd bytes smaller than the full path.\n",
+			       best_name, full_size - best_size);
+		else
+			printf("Using a %s device path.\n", best_name);
+	}
+	*dp_out = (efidp)best;
+	return best_size;
+}
+
+/*
+ * Like make_device_path(), but for a loader on the given disk and
+ * partition rather than the ones from -d, -p and -l.
+ */
+ssize_t
+make_device_path_for(const char *disk, int part, const char *loader,
+		     efidp *dp_out)
+{
+	uint32_t options = get_path_options();
+	uint8_t *dp;
+	ssize_t needed;
+
+	bool from_esp = !opts.iface;
+
+	if (from_esp && opts.abbreviate_path == EFIBOOTMGR_PATH_ABBREV_AUTO)
+		return make_shortest_device_path(disk, part, loader, dp_out);
+
+	if (from_esp && !opts.no_cache) {
+		needed = esp_cache_lookup(disk, part, loader, options,
+					  opts.edd10_devicenum, dp_out);
+		if (needed >= 0)
+			return needed;
 	}
+
+	needed = alloc_device_path(disk, part, loader, options, &dp);
+	if (needed < 0)
+		return -1;
+	if (from_esp && !opts.no_cache)
+		esp_cache_store(disk, part, options, opts.edd10_devicenum,
+				(efidp)dp, needed);
+	*dp_out = (efidp)dp;
+	return needed;
+}
+
+ssize_t
+make_device_path(efidp *dp_out)
+{
+	return make_device_path_for(opts.disk, opts.part, opts.loader, dp_out);
+}
+
+/**
+ * make_load_option()
+ * @data - load option returned, allocated to exactly the right size
+ * *data_size - load option size returned
+ *
+ * Returns -1 on error, length of load option created on success.
+ */
+ssize_t
+make_load_option(uint8_t **data, size_t *data_size, unsigned char *label,
+		 efidp dp, ssize_t dp_size,
+		 uint8_t *optional_data, size_t optional_data_size)
+{
+	ssize_t needed;
+	uint32_t attributes = opts.active ? LOAD_OPTION_ACTIVE : 0
+			    | (opts.reconnect > 0 ? LOAD_OPTION_FORCE_RECONNECT : 0);
+
+	*data = NULL;
+	/* this doesn't look at anything but its arguments */
+	needed = efi_loadopt_create(NULL, 0, attributes, dp, dp_size,
+				    label, optional_data, optional_data_size);
+	if (needed >= 0) {
+		*data = malloc(needed);
+		if (*data)
+			needed = efi_loadopt_create(*data, needed,
+						    attributes, dp, dp_size,
+						    label, optional_data,
+						    optional_data_size);
+		else
+			needed = -1;
+	}
+
 	if (needed < 0) {
 		efi_error("efi_loadopt_create() = %zd (failed)", needed);
+		free(*data);
+		*data = NULL;
 		return -1;
-        }
+	}
 
+	*data_size = needed;
 	return needed;
 }
 
+/**
+ * make_linux_load_option()
+ * @data - load option returned, allocated to exactly the right size
+ * *data_size - load option size returned
+ *
+ * The device path is only generated once.
+ *
+ * Returns -1 on error, length of load option created on success.
+ */
+ssize_t
+make_linux_load_option(uint8_t **data, size_t *data_size,
+		       uint8_t *optional_data, size_t optional_data_size)
+{
+	ssize_t needed, dp_size;
+	int saved_errno;
+	efidp dp = NULL;
+
+	dp_size = make_device_path(&dp);
+	if (dp_size < 0)
+		return -1;
+
+	needed = make_load_option(data, data_size, opts.label, dp, dp_size,
+				  optional_data, optional_data_size);
+	saved_errno = errno;
+	free(dp);
+	errno = saved_errno;
+	return needed;
+}
+
+/*
+ * Optional data can't be bigger than what's left in the variable store,
+ * if the store can tell us; if it can't, guess that there's really no way
+ * a variable is going to be 64k and work.
+ */
+#define ARGS_SIZE_FALLBACK	(4096 * 16)
+
+static size_t
+max_args_size(void)
+{
+	size_t avail;
+
+	if (store_space(&avail) < 0 || avail == 0 || avail > SSIZE_MAX)
+		return ARGS_SIZE_FALLBACK;
+	return avail;
+}
+
+/*
+ * Read the rest of fd, from wherever it is now, into a buffer we
+ * allocate.  For a regular file the buffer starts out the size of what's
+ * left, so it's normally read in one go; for anything else (a pipe,
+ * usually) it grows by doubling.  The input is only too big if there's
+ * still more to read once the buffer holds the limit.
+ */
 static ssize_t
-read_stdin(uint8_t *data_out, ssize_t data_size_out)
+read_args_file(int fd, uint8_t **data_out)
 {
-	static uint8_t *data = NULL;
-	static ssize_t data_size = 0;
-	off_t pos = 0;
-	ssize_t allocated;
+	size_t limit = max_args_size();
+	uint8_t *data = NULL, *data_new;
+	size_t pos = 0, allocated = 4096;
+	struct stat sb;
+	off_t offset;
+	ssize_t ret;
+	uint8_t more;
 
-	if (data_out && data_size_out) {
-		if (!data || data_size != data_size_out) {
-			errno = EINVAL;
-			return -1;
-		}
-		memcpy(data_out, data, data_size);
-		return data_size;
+	if (fstat(fd, &sb) < 0)
+		return -1;
+
+	if (S_ISREG(sb.st_mode)) {
+		offset = lseek(fd, 0, SEEK_CUR);
+		if (offset >= 0 && sb.st_size > offset)
+			allocated = sb.st_size - offset;
 	}
-	allocated = 4096;
+	if (allocated > limit)
+		allocated = limit;
 	data = malloc(allocated);
 	if (!data)
 		return -1;
-	memset(data, 0, allocated);
 
 	while (1) {
-		ssize_t ret;
-		if (allocated - pos == 0) {
-			allocated += 4096;
-			/*
-			 * there's really no way a variable is going to be
-			 * 64k and work, so bail before we suck up all of
-			 * memory.
-			 */
-			if (allocated > 4096 * 16) {
+		if (pos == allocated) {
+			ret = read(fd, &more, 1);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret < 0)
+				goto err;
+			if (ret == 0)
+				break;
+			if (allocated >= limit) {
 				errno = ENOSPC;
-err:
-				free(data);
-				data = 0;
-				data_size = 0;
-				return -1;
+				goto err;
 			}
+			allocated = allocated > limit / 2 ? limit : allocated * 2;
 
-			uint8_t *data_new;
 			data_new = realloc(data, allocated);
 			if (!data_new)
 				goto err;
 			data = data_new;
+			data[pos++] = more;
+			continue;
 		}
-		ret = fread(data+pos, 1, allocated-pos, stdin);
-		if (ret == 0) {
-			if (ferror(stdin)) {
-				errno = EIO;
-				goto err;
-			}
-			if (feof(stdin))
-				break;
-		}
-		data_size += ret;
+		ret = read(fd, data + pos, allocated - pos);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			goto err;
+		if (ret == 0)
+			break;
 		pos += ret;
 	}
-	return data_size;
+	*data_out = data;
+	return pos;
+err:
+	free(data);
+	return -1;
 }
 
+/*
+ * Join args with NULs, the way optional data from the command line is
+ * built, into a buffer we allocate.
+ */
 ssize_t
-get_extra_args(uint8_t *data, ssize_t data_size)
+make_args(char **argv, int argc, uint8_t **data_out)
 {
 	int i;
 	ssize_t needed = 0, sz;
 	off_t off = 0;
+	size_t space_size = opts.unicode ? sizeof (uint16_t) : 1;
+	uint8_t *data;
 
-	if (opts.extra_opts_file) {
-		if (!strcmp(opts.extra_opts_file, "-"))
-			needed = read_stdin(data, data_size);
+	*data_out = NULL;
+	/* sizing the arguments doesn't look at anything but the strings */
+	for (i = 0; i < argc; i++) {
+		if (opts.unicode)
+			sz = efi_loadopt_args_as_ucs2(NULL, 0,
+						(uint8_t *)argv[i]);
 		else
-			needed = efi_loadopt_args_from_file(data, data_size,
-						     opts.extra_opts_file);
-		if (needed < 0)
-			fprintf(stderr, "efibootmgr: get_extra_args: %m\n");
-		return needed;
+			sz = efi_loadopt_args_as_utf8(NULL, 0,
+						(uint8_t *)argv[i]);
+		if (sz < 0)
+			return -1;
+		needed += sz;
+		if (i < argc - 1)
+			needed += space_size;
 	}
-	for (i = opts.optind; i < opts.argc; i++) {
-		int space = (i < opts.argc - 1) ? 1 : 0;
+	if (!needed)
+		return 0;
 
-		if (opts.unicode) {
+	data = calloc(1, needed);
+	if (!data)
+		return -1;
+
+	for (i = 0; i < argc; i++) {
+		if (opts.unicode)
 			sz = efi_loadopt_args_as_ucs2(
 						(uint16_t *)(data+off),
-						data_size?data_size+off:0,
-						(uint8_t *)opts.argv[i]);
-			if (sz < 0)
-				return -1;
-			off += sz;
-			if (data && off < data_size-2 && space) {
-				data[off] = '\0';
-				data[off+1] = '\0';
-			}
-			off += space * sizeof (uint16_t);
-		} else {
-			sz = efi_loadopt_args_as_utf8(data+off,
-						data_size?data_size+off:0,
-						(uint8_t *)opts.argv[i]);
-			if (sz < 0)
+						needed-off,
+						(uint8_t *)argv[i]);
+		else
+			sz = efi_loadopt_args_as_utf8(data+off, needed-off,
+						(uint8_t *)argv[i]);
+		if (sz < 0) {
+			free(data);
+			return -1;
+		}
+		off += sz;
+		/* calloc() already put the NUL separators in */
+		if (i < argc - 1)
+			off += space_size;
+	}
+	*data_out = data;
+	return needed;
+}
+
+/*
+ * Build the optional data for a new entry in a buffer we allocate,
+ * reading the file or stdin only once.
+ */
+ssize_t
+get_extra_args(uint8_t **data_out)
+{
+	ssize_t needed;
+
+	*data_out = NULL;
+	if (opts.extra_opts_file) {
+		int fd = STDIN_FILENO;
+
+		if (strcmp(opts.extra_opts_file, "-")) {
+			fd = open(opts.extra_opts_file, O_RDONLY|O_CLOEXEC);
+			if (fd < 0) {
+				fprintf(stderr, "efibootmgr: get_extra_args: %m\n");
 				return -1;
-			off += sz;
-			if (data && off < data_size-1 && space) {
-				data[off] = '\0';
 			}
-			off += space;
 		}
-		needed += off;
+		needed = read_args_file(fd, data_out);
+		if (needed < 0)
+			fprintf(stderr, "efibootmgr: get_extra_args: %m\n");
+		if (fd != STDIN_FILENO)
+			close(fd);
+		return needed;
 	}
-	return needed;
+
+	return make_args(opts.argv + opts.optind, opts.argc - opts.optind,
+			 data_out);
+}
+
+/*
+ * Parse a comma separated list of hexadecimal entry numbers, the way -o
+ * takes them, into an array we allocate.  If exists isn't NULL, every
+ * number has to be one it knows about.  Returns the number of entries, or
+ * -1 with errno set, or one of the ORDER_* errors with *error_offset set
+ * to where in buffer the problem is.
+ */
+int
+parse_order_text(const char *buffer, int (*exists)(int num),
+		 uint16_t **order, size_t *error_offset)
+{
+	const char *end = buffer + strlen(buffer) + 1;
+	const char *buf;
+	uint16_t *data;
+	int num = 0, i = 0;
+
+	*order = NULL;
+	for (buf = buffer; buf < end; buf++) {
+		size_t comma = strcspn(buf, ",");
+
+		if (comma == 0) {
+			*error_offset = buf - buffer;
+			return ORDER_MALFORMED;
+		}
+		num++;
+		buf += comma;
+	}
+
+	data = calloc(num, sizeof (*data));
+	if (!data)
+		return -1;
+
+	for (buf = buffer; buf < end; buf++) {
+		size_t comma = strcspn(buf, ",");
+		unsigned long result;
+		char *endptr = NULL;
+		int rc = 0;
+
+		errno = 0;
+		result = strtoul(buf, &endptr, 16);
+		if ((result == ULONG_MAX && errno == ERANGE) ||
+		    endptr != buf + comma) {
+			*error_offset = endptr - buffer;
+			rc = ORDER_INVALID;
+		} else if (result > 0xffff) {
+			*error_offset = buf - buffer;
+			rc = ORDER_RANGE;
+		} else if (exists && !exists(result)) {
+			*error_offset = buf - buffer;
+			rc = ORDER_NOENT;
+		}
+		if (rc < 0) {
+			free(data);
+			return rc;
+		}
+		data[i++] = result;
+		buf += comma;
+	}
+
+	*order = data;
+	return num;
 }
@@ -49,13 +49,44 @@ EFI_GUID( 0x47c7b225, 0xc42a, 0x11d2, 0x8e57, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b
 #define ADDRESS_RANGE_MIRROR_VARIABLE_GUID \
 EFI_GUID( 0x7b9be2e0, 0xe28a, 0x4197, 0xad3e, 0x32, 0xf0, 0x62, 0xf9, 0x46, 0x2c)
 
+/* The names of every <prefix>XXXX variable, see read_var_name_set() */
+typedef struct {
+	const char	*prefix;
+	uint8_t		present[(UINT16_MAX + 1) / 8];
+	char		**odd;
+	size_t		n_odd;
+	unsigned int	next_num;
+	size_t		next_odd;
+	char		name[32];
+} var_name_set_t;
+
 /* Exported functions */
 
 extern int read_boot_var_names(char ***namelist);
 extern int read_var_names(const char *prefix, char ***namelist);
+extern int read_var_name_set(const char *prefix, var_name_set_t *set);
+extern const char *var_name_set_next(var_name_set_t *set);
+extern void free_var_name_set(var_name_set_t *set);
+extern ssize_t make_device_path(efidp *dp);
+extern ssize_t make_device_path_for(const char *disk, int part,
+				    const char *loader, efidp *dp);
+extern ssize_t make_load_option(uint8_t **data, size_t *data_size,
+				unsigned char *label, efidp dp, ssize_t dp_size,
+				uint8_t *optional_data,
+				size_t optional_data_size);
 extern ssize_t make_linux_load_option(uint8_t **data, size_t *data_size,
 		       uint8_t *optional_data, size_t optional_data_size);
-extern ssize_t get_extra_args(uint8_t *data, ssize_t data_size);
+extern ssize_t make_args(char **argv, int argc, uint8_t **data);
+extern ssize_t get_extra_args(uint8_t **data);
+
+/* parse_order_text() errors besides -1 */
+#define ORDER_MALFORMED	-2	/* an empty entry */
+#define ORDER_INVALID	-3	/* not a hexadecimal number */
+#define ORDER_RANGE	-4	/* more than 0xFFFF */
+#define ORDER_NOENT	-5	/* exists() doesn't know it */
+
+extern int parse_order_text(const char *buffer, int (*exists)(int num),
+			    uint16_t **order, size_t *error_offset);
 
 typedef struct {
 	uint8_t		mirror_version;
@@ -21,10 +21,13 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include "dp_render.h"
 #include "error.h"
 #include "parse_loader_data.h"
+#include "store.h"
 
 int verbose;
 
@@ -32,11 +35,12 @@ int verbose;
 #define Q_(String) dgettext (NULL, String)
 #define C_(Context,String) dgettext (Context,String)
 
+static dp_text_cache_t dp_cache = DP_TEXT_CACHE_INIT;
+
 static void
 print_boot_entry(efi_load_option *loadopt, size_t data_size)
 {
-	char *text_path = NULL;
-	size_t text_path_len = 0;
+	const char *text_path = NULL;
 	uint8_t *optional_data = NULL;
 	size_t optional_data_len = 0;
 	uint16_t pathlen;
@@ -59,23 +63,12 @@ print_boot_entry(efi_load_option *loadopt, size_t data_size)
 	dp = efi_loadopt_path(loadopt, data_size);
 	pathlen = efi_loadopt_pathlen(loadopt, data_size);
 
-	rc = efidp_format_device_path(NULL, 0, dp, pathlen);
-	if (rc < 0) {
-		printf("<bad device path>");
-		return;
-	}
-	text_path_len = rc + 1;
-	text_path = alloca(text_path_len);
-	if (!text_path)
-		error(100, "Couldn't allocate memory");
-	rc = efidp_format_device_path((unsigned char *)text_path,
-				      text_path_len, dp, pathlen);
-	if (rc < 0) {
+	text_path = dp_render(&dp_cache, dp, pathlen);
+	if (!text_path) {
 		printf("<bad device path>");
 		return;
 	}
-	if (text_path && text_path_len >= 1)
-		printf("%s", text_path);
+	printf("%s", text_path);
 
 	rc = efi_loadopt_optional_data(loadopt, data_size,
 				       &optional_data, &optional_data_len);
@@ -108,12 +101,54 @@ print_boot_entry(efi_load_option *loadopt, size_t data_size)
 	printf("\n");
 }
 
+static int
+cmpstringp(const void *p1, const void *p2)
+{
+	const char * const *s1 = p1;
+	const char * const *s2 = p2;
+
+	return strcmp(*s1, *s2);
+}
+
+/* every Boot#### variable in the image or snapshot, in order */
+static const char **
+stored_boot_entries(void)
+{
+	const char **names = NULL;
+	size_t n = 0;
+	efi_guid_t *guid;
+	char *name;
+	int rc;
+
+	while ((rc = store_get_next_variable_name(&guid, &name)) > 0) {
+		const char **tmp;
+
+		if (efi_guid_cmp(guid, &efi_guid_global) ||
+		    strlen(name) != 8 || strncmp(name, "Boot", 4) ||
+		    strspn(name + 4, "0123456789ABCDEF") != 4)
+			continue;
+		tmp = realloc(names, (n + 2) * sizeof(*names));
+		if (!tmp || !(tmp[n] = strdup(name)))
+			error(8, "Could not allocate memory");
+		tmp[++n] = NULL;
+		names = tmp;
+	}
+	if (rc < 0)
+		error(12, "Could not read the variables");
+	if (!names)
+		errorx(12, "There are no boot entries");
+	qsort(names, n, sizeof(*names), cmpstringp);
+	return names;
+}
+
 int
 main(int argc, char *argv[])
 {
 	const char **names = NULL;
 	const char **files = NULL;
 	char *guidstr = NULL;
+	char *image = NULL;
+	char *snapshot = NULL;
 	efi_guid_t guid = efi_guid_global;
 
 	setlocale(LC_ALL, "");
@@ -139,6 +174,18 @@ main(int argc, char *argv[])
 		 .arg = &files,
 		 .descrip = _("File to read variable data from"),
 		 .argDescrip = "<file>"},
+		{.longName = "image",
+		 .argInfo = POPT_ARG_STRING |
+			    POPT_ARGFLAG_STRIP,
+		 .arg = &image,
+		 .descrip = _("Read variables from an edk2 image such as OVMF_VARS.fd"),
+		 .argDescrip = "<file.fd>"},
+		{.longName = "snapshot",
+		 .argInfo = POPT_ARG_STRING |
+			    POPT_ARGFLAG_STRIP,
+		 .arg = &snapshot,
+		 .descrip = _("Read variables from an archive written by efibootmgr --export"),
+		 .argDescrip = "<file>"},
 		{.longName = "verbose",
 		 .shortName = 'v',
 		 .argInfo = POPT_ARG_VAL |
@@ -177,7 +224,7 @@ main(int argc, char *argv[])
 
 	/* argc = */ poptStrippedArgv(optcon, argc, argv);
 	names = poptGetArgs(optcon);
-	if (!names && !files) {
+	if (!names && !files && !image && !snapshot) {
 		poptPrintUsage(optcon, stderr, 0);
 		exit(4);
 	}
@@ -192,6 +239,21 @@ main(int argc, char *argv[])
 		exit(4);
 	}
 
+	if (image && snapshot)
+		errorx(12, "--image and --snapshot may not be used together");
+
+	if (image) {
+		rc = store_open_image(image, false);
+		if (rc < 0)
+			error(12, "Could not open image \"%s\"", image);
+	} else if (snapshot) {
+		rc = store_open_snapshot(snapshot);
+		if (rc < 0)
+			error(12, "Could not open snapshot \"%s\"", snapshot);
+	}
+	if ((image || snapshot) && !names && !files)
+		names = stored_boot_entries();
+
 	if (names) {
 		if (guidstr) {
 			rc = efi_id_guid_to_guid(guidstr, &guid);
@@ -256,8 +318,8 @@ main(int argc, char *argv[])
 	     i++) {
 		uint32_t attrs = 0;
 
-		rc = efi_get_variable(guid, names[i], &data, &data_size,
-				      &attrs);
+		rc = store_get_variable(guid, names[i], &data, &data_size,
+					&attrs);
 		if (rc < 0) {
 			warning("couldn't read variable %s-%s",
 				names[i], guidstr);
@@ -286,6 +348,7 @@ main(int argc, char *argv[])
 	if (guidstr)
 		free(guidstr);
 
+	dp_text_cache_free(&dp_cache);
 	poptFreeContext(optcon);
 	return 0;
 }
@@ -43,17 +43,31 @@
 #include <string.h>
 #include <stdint.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <endian.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <glob.h>
 #include <efivar.h>
 #include <efiboot.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 #include "list.h"
+#include "dp_render.h"
 #include "efi.h"
+#include "esp_cache.h"
+#include "fv_image.h"
+#include "loader_check.h"
+#include "hash.h"
+#include "nvram_bench.h"
 #include "parse_loader_data.h"
+#include "sha256.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "store.h"
 #include "efibootmgr.h"
 #include "error.h"
 
@@ -76,6 +90,10 @@ typedef struct _var_entry {
 /* global variables */
 static	LIST_HEAD(entry_list);
 static	LIST_HEAD(blk_list);
+static	dp_text_cache_t dp_cache = DP_TEXT_CACHE_INIT;
+
+/* how many rendered paths stream_vars() keeps around */
+#define STREAM_DP_CACHE_MAX 256
 efibootmgr_opt_t opts;
 
 static void
@@ -95,6 +113,31 @@ free_vars(list_t *head)
 	}
 }
 
+/*
+ * Read one variable into entry.  Returns -1 and warns if it can't be read.
+ */
+static int
+read_var(const char *name, var_entry_t *entry)
+{
+	int rc;
+
+	rc = store_get_variable(EFI_GLOBAL_GUID, name,
+			      &entry->data, &entry->data_size,
+			      &entry->attributes);
+	if (rc < 0) {
+		warning("Skipping unreadable variable \"%s\"", name);
+		return rc;
+	}
+
+	/* latest apple firmware sets high bit which appears
+	 * invalid to the linux kernel if we write it back so
+	 * lets zero it out if it is set since it would be
+	 * invalid to set it anyway */
+	entry->attributes = entry->attributes & ~(1 << 31);
+	entry->guid = EFI_GLOBAL_GUID;
+	return 0;
+}
+
 static void
 read_vars(char **namelist,
 	  list_t *head)
@@ -114,28 +157,17 @@ read_vars(char **namelist,
 				goto err;
 			}
 
-			rc = efi_get_variable(EFI_GLOBAL_GUID, namelist[i],
-					       &entry->data, &entry->data_size,
-					       &entry->attributes);
+			rc = read_var(namelist[i], entry);
 			if (rc < 0) {
-				warning("Skipping unreadable variable \"%s\"",
-					namelist[i]);
 				free(entry);
 				continue;
 			}
 
-			/* latest apple firmware sets high bit which appears
-			 * invalid to the linux kernel if we write it back so
-			 * lets zero it out if it is set since it would be
-			 * invalid to set it anyway */
-			entry->attributes = entry->attributes & ~(1 << 31);
-
 			entry->name = strdup(namelist[i]);
 			if (!entry->name) {
 				efi_error("strdup(\"%s\") failed", namelist[i]);
 				goto err;
 			}
-			entry->guid = EFI_GLOBAL_GUID;
 			list_add_tail(&entry->list, head);
 		}
 	}
@@ -224,6 +256,38 @@ find_free_var(list_t *var_list)
 }
 
 
+/*
+ * For --abbrev auto: if an active entry's path starts with File(), the
+ * firmware can resolve File() short-form paths.
+ */
+static void
+check_file_paths(list_t *var_list)
+{
+	list_t *pos;
+	var_entry_t *entry;
+	efi_load_option *load_option;
+	efidp_header hdr;
+	uint16_t pathlen;
+
+	list_for_each(pos, var_list) {
+		entry = list_entry(pos, var_entry_t, list);
+		load_option = (efi_load_option *)entry->data;
+		if (!efi_loadopt_is_valid(load_option, entry->data_size) ||
+		    !(efi_loadopt_attrs(load_option) & LOAD_OPTION_ACTIVE))
+			continue;
+		pathlen = efi_loadopt_pathlen(load_option, entry->data_size);
+		if (pathlen < sizeof(hdr))
+			continue;
+		memcpy(&hdr, efi_loadopt_path(load_option, entry->data_size),
+		       sizeof(hdr));
+		if (hdr.type == EFIDP_MEDIA_TYPE &&
+		    hdr.subtype == EFIDP_MEDIA_FILE) {
+			opts.file_paths_resolve = 1;
+			return;
+		}
+	}
+}
+
 static void
 warn_duplicate_name(list_t *var_list)
 {
@@ -242,6 +306,115 @@ warn_duplicate_name(list_t *var_list)
 	}
 }
 
+typedef struct {
+	efi_guid_t	signature_type;
+	uint32_t	list_size;
+	uint32_t	header_size;
+	uint32_t	signature_size;
+} efi_signature_list_t;
+
+#define SIG_DB	0
+#define SIG_DBX	1
+
+static struct {
+	const char	*name;
+	uint8_t		*data;
+	size_t		data_size;
+	bool		read;
+} sig_dbs[] = {
+	[SIG_DB] = { .name = "db" },
+	[SIG_DBX] = { .name = "dbx" },
+};
+
+/*
+ * Is digest one of the SHA-256 hashes in db or dbx?  Each is only read
+ * once.  Returns 1 if it is, 0 if not, and -1 if we couldn't read it.
+ */
+static int
+sig_db_has_sha256(int which, const uint8_t *digest)
+{
+	const uint8_t *p, *end;
+	uint32_t attributes;
+
+	if (!sig_dbs[which].read) {
+		if (store_get_variable(efi_guid_image_security_database,
+				     sig_dbs[which].name,
+				     &sig_dbs[which].data,
+				     &sig_dbs[which].data_size,
+				     &attributes) < 0) {
+			if (errno != ENOENT)
+				return -1;
+			sig_dbs[which].data = NULL;
+			sig_dbs[which].data_size = 0;
+		}
+		sig_dbs[which].read = true;
+	}
+
+	p = sig_dbs[which].data;
+	end = p + sig_dbs[which].data_size;
+	while (p && end - p >= (ssize_t)sizeof(efi_signature_list_t)) {
+		efi_signature_list_t esl;
+		const uint8_t *sig, *sigs_end;
+
+		memcpy(&esl, p, sizeof(esl));
+		if (esl.list_size < sizeof(esl) ||
+		    esl.list_size > (size_t)(end - p) ||
+		    esl.header_size > esl.list_size - sizeof(esl))
+			break;
+		sigs_end = p + esl.list_size;
+		if (!efi_guid_cmp(&esl.signature_type, &efi_guid_sha256) &&
+		    esl.signature_size == sizeof(efi_guid_t) +
+					  SHA256_DIGEST_SIZE) {
+			for (sig = p + sizeof(esl) + esl.header_size;
+			     sigs_end - sig >= esl.signature_size;
+			     sig += esl.signature_size) {
+				if (!memcmp(sig + sizeof(efi_guid_t), digest,
+					    SHA256_DIGEST_SIZE))
+					return 1;
+			}
+		}
+		p = sigs_end;
+	}
+	return 0;
+}
+
+/*
+ * Refuse to point an entry at a loader that isn't on the ESP, isn't
+ * something the firmware can run, or whose hash dbx revokes.  If the ESP
+ * isn't mounted we can't tell, so just say so.
+ */
+static void
+preflight_loader(const char *disk, int part, const char *loader)
+{
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	int rc;
+
+	if (opts.no_loader_check || opts.iface || opts.image)
+		return;
+
+	rc = check_loader(disk, part, loader, opts.driver, digest);
+	if (rc < 0) {
+		warning("Could not check for %s on %s", loader, disk);
+		return;
+	} else if (rc == LOADER_NOT_MOUNTED) {
+		warningx("Could not check for %s on %s: %s", loader, disk,
+			 loader_check_str(rc));
+		return;
+	} else if (rc != LOADER_OK) {
+		errorx(50, "%s on %s: %s (use --no-loader-check to create the entry anyway)",
+		       loader, disk, loader_check_str(rc));
+	}
+
+	rc = sig_db_has_sha256(SIG_DBX, digest);
+	if (rc < 0)
+		warning("Could not read dbx");
+	else if (rc > 0)
+		errorx(51, "%s on %s is revoked by dbx (use --no-loader-check to create the entry anyway)",
+		       loader, disk);
+	if (opts.verbose >= 1 && sig_db_has_sha256(SIG_DB, digest) > 0)
+		printf("%s is allowed by its hash in db\n", loader);
+}
+
 static var_entry_t *
 make_var(const char *prefix, list_t *var_list)
 {
@@ -251,7 +424,7 @@ make_var(const char *prefix, list_t *var_list)
 	int rc;
 	uint8_t *extra_args = NULL;
 	ssize_t extra_args_size = 0;
-	ssize_t needed=0, sz;
+	ssize_t sz;
 
 	if (opts.num == -1) {
 		free_number = find_free_var(var_list);
@@ -280,7 +453,9 @@ make_var(const char *prefix, list_t *var_list)
 		return NULL;
 	}
 
-	sz = get_extra_args(NULL, 0);
+	preflight_loader(opts.disk, opts.part, opts.loader);
+
+	sz = get_extra_args(&extra_args);
 	if (sz < 0) {
 		efi_error("get_extra_args() failed");
 		goto err;
@@ -289,27 +464,9 @@ make_var(const char *prefix, list_t *var_list)
 
 	entry->data = NULL;
 	entry->data_size = 0;
-	needed = make_linux_load_option(&entry->data, &entry->data_size,
-					NULL, sz);
-	if (needed < 0) {
-		efi_error("make_linux_load_option() failed");
-		goto err;
-	}
-	entry->data_size = needed;
-	entry->data = malloc(needed);
-	if (!entry->data) {
-		efi_error("malloc(%zd) failed", needed);
-		goto err;
-	}
-
-	extra_args = entry->data + needed - extra_args_size;
-	sz = get_extra_args(extra_args, extra_args_size);
-	if (sz < 0) {
-		efi_error("get_extra_args() failed");
-		goto err;
-	}
 	sz = make_linux_load_option(&entry->data, &entry->data_size,
 				    extra_args, extra_args_size);
+	free(extra_args);
 	if (sz < 0) {
 		efi_error("make_linux_load_option failed");
 		goto err;
@@ -325,7 +482,7 @@ make_var(const char *prefix, list_t *var_list)
 	entry->attributes = EFI_VARIABLE_NON_VOLATILE |
 			    EFI_VARIABLE_BOOTSERVICE_ACCESS |
 			    EFI_VARIABLE_RUNTIME_ACCESS;
-	rc = efi_set_variable(entry->guid, entry->name, entry->data,
+	rc = store_set_variable(entry->guid, entry->name, entry->data,
 				entry->data_size, entry->attributes, 0644);
 	if (rc < 0) {
 		efi_error("efi_set_variable failed");
@@ -366,7 +523,7 @@ read_order(const char *name, var_entry_t **order)
 		bo = *order;
 	}
 
-	rc = efi_get_variable(EFI_GLOBAL_GUID, name,
+	rc = store_get_variable(EFI_GLOBAL_GUID, name,
 				&bo->data, &bo->data_size, &bo->attributes);
 	if (rc < 0 && new != NULL) {
 		efi_error("efi_get_variable failed");
@@ -387,7 +544,7 @@ read_order(const char *name, var_entry_t **order)
 static int
 set_u16(const char *name, uint16_t num)
 {
-	return efi_set_variable(EFI_GLOBAL_GUID, name, (uint8_t *)&num,
+	return store_set_variable(EFI_GLOBAL_GUID, name, (uint8_t *)&num,
 				sizeof (num), EFI_VARIABLE_NON_VOLATILE |
 					      EFI_VARIABLE_BOOTSERVICE_ACCESS |
 					      EFI_VARIABLE_RUNTIME_ACCESS,
@@ -435,13 +592,564 @@ add_to_order(const char *name, uint16_t num, uint16_t insert_at)
 	order->data = (uint8_t *)new_data;
 	order->data_size = new_data_size;
 
-	rc = efi_set_variable(EFI_GLOBAL_GUID, name, order->data,
+	rc = store_set_variable(EFI_GLOBAL_GUID, name, order->data,
 			order->data_size, order->attributes, 0644);
 	free(order->data);
 	free(order);
 	return rc;
 }
 
+typedef struct {
+	char		*label;
+	char		*loader;
+	char		*args;
+	char		*disk;
+	int		part;
+	long		position;
+	int		line;
+	uint16_t	num;
+	uint8_t		*data;
+	size_t		data_size;
+} manifest_entry_t;
+
+/*
+ * The part of an ESP device path before File(), probed once for each
+ * disk and partition in a manifest.
+ */
+typedef struct {
+	char		*disk;
+	int		part;
+	efidp		dp;
+	ssize_t		prefix_size;
+} dp_template_t;
+
+static void
+free_manifest(manifest_entry_t *entries, size_t n_entries)
+{
+	for (size_t i = 0; i < n_entries; i++) {
+		free(entries[i].label);
+		free(entries[i].data);
+	}
+	free(entries);
+}
+
+/*
+ * Read a manifest: one entry per line, with tab separated fields
+ *
+ *   label  loader  args  disk  part  position
+ *
+ * Trailing fields may be left off, and empty ones get the usual
+ * defaults.  An entry with no position goes right after the one before
+ * it, starting at the front of the order.  Blank lines and lines starting
+ * with '#' are ignored.
+ *
+ * All of an entry's strings point into its label's allocation.
+ */
+static size_t
+read_manifest(const char *path, manifest_entry_t **entries_out)
+{
+	FILE *f;
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	manifest_entry_t *entries = NULL;
+	size_t n_entries = 0;
+	int lineno = 0;
+	long position = -1;
+
+	f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!f)
+		error(46, "Could not open manifest \"%s\"", path);
+
+	while ((len = getline(&line, &line_size, f)) >= 0) {
+		manifest_entry_t *entry, *new_entries;
+		char *fields[6] = { NULL, };
+		char *cur, *field, *end;
+		int n_fields = 0;
+
+		lineno++;
+		while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+			line[--len] = '\0';
+		if (len == 0 || line[0] == '#')
+			continue;
+
+		new_entries = realloc(entries,
+				      (n_entries + 1) * sizeof(*entries));
+		if (!new_entries)
+			error(46, "Could not read manifest \"%s\"", path);
+		entries = new_entries;
+		entry = &entries[n_entries++];
+		memset(entry, 0, sizeof(*entry));
+		entry->line = lineno;
+
+		cur = strdup(line);
+		if (!cur)
+			error(46, "Could not read manifest \"%s\"", path);
+		entry->label = cur;
+		while ((field = strsep(&cur, "\t")) != NULL) {
+			if (n_fields == 6)
+				errorx(46, "%s:%d: too many fields",
+				       path, lineno);
+			fields[n_fields++] = field;
+		}
+
+		if (!fields[0][0])
+			errorx(46, "%s:%d: missing label", path, lineno);
+		entry->loader = fields[1] && fields[1][0] ? fields[1]
+							  : opts.loader;
+		entry->args = fields[2] && fields[2][0] ? fields[2] : NULL;
+		entry->disk = fields[3] && fields[3][0] ? fields[3]
+							: opts.disk;
+
+		entry->part = opts.part;
+		if (fields[4] && fields[4][0]) {
+			errno = 0;
+			entry->part = strtol(fields[4], &end, 0);
+			if (errno || *end || entry->part < 1)
+				errorx(46, "%s:%d: invalid partition \"%s\"",
+				       path, lineno, fields[4]);
+		}
+
+		position += 1;
+		if (fields[5] && fields[5][0]) {
+			errno = 0;
+			position = strtol(fields[5], &end, 0);
+			if (errno || *end || position < 0 ||
+			    position > UINT16_MAX)
+				errorx(46, "%s:%d: invalid position \"%s\"",
+				       path, lineno, fields[5]);
+		}
+		entry->position = position;
+	}
+	if (ferror(f))
+		error(46, "Could not read manifest \"%s\"", path);
+	free(line);
+	if (f != stdin)
+		fclose(f);
+
+	*entries_out = entries;
+	return n_entries;
+}
+
+static dp_template_t *
+get_dp_template(dp_template_t **templates, size_t *n_templates,
+		const manifest_entry_t *entry)
+{
+	dp_template_t *template, *new_templates;
+	ssize_t size;
+
+	for (size_t i = 0; i < *n_templates; i++) {
+		template = &(*templates)[i];
+		if (template->part == entry->part &&
+		    !strcmp(template->disk, entry->disk))
+			return template;
+	}
+
+	new_templates = realloc(*templates,
+				(*n_templates + 1) * sizeof(**templates));
+	if (!new_templates)
+		return NULL;
+	*templates = new_templates;
+	template = &new_templates[*n_templates];
+	memset(template, 0, sizeof(*template));
+
+	/* any loader will do; only what comes before File() is kept */
+	size = make_device_path_for(entry->disk, entry->part, entry->loader,
+				    &template->dp);
+	if (size < 0)
+		return NULL;
+
+	template->prefix_size = esp_dp_prefix_size(template->dp, size);
+	if (template->prefix_size < 0) {
+		free(template->dp);
+		errno = EINVAL;
+		return NULL;
+	}
+	template->disk = entry->disk;
+	template->part = entry->part;
+	(*n_templates)++;
+	return template;
+}
+
+static int
+alloc_var_num(uint8_t *used)
+{
+	for (unsigned int num = 0; num <= UINT16_MAX; num++) {
+		if (!(used[num / 8] & (1 << (num % 8)))) {
+			used[num / 8] |= 1 << (num % 8);
+			return num;
+		}
+	}
+	return -1;
+}
+
+static int
+write_order(const char *name, var_entry_t *order, uint16_t *data,
+	    size_t n)
+{
+	uint32_t attributes = EFI_VARIABLE_NON_VOLATILE |
+			      EFI_VARIABLE_BOOTSERVICE_ACCESS |
+			      EFI_VARIABLE_RUNTIME_ACCESS;
+
+	if (order)
+		attributes = order->attributes;
+	return store_set_variable(EFI_GLOBAL_GUID, name, (uint8_t *)data,
+				n * sizeof(uint16_t), attributes, 0644);
+}
+
+/*
+ * Write out entries whose load options have already been built.  Numbers
+ * come from the entries we've already read, and the order variable is
+ * written once at the end, with whatever we managed to create.
+ */
+static int
+create_entries(const char *prefix, const char *order_name,
+	       manifest_entry_t *entries, size_t n_entries)
+{
+	uint8_t *used;
+	var_entry_t *order = NULL;
+	uint16_t *order_data = NULL;
+	size_t order_len = 0, n_created = 0;
+	list_t *pos;
+	var_entry_t *entry;
+	int rc = 0;
+
+	used = calloc(1, (UINT16_MAX + 1) / 8);
+	if (!used)
+		return -1;
+	list_for_each(pos, &entry_list) {
+		entry = list_entry(pos, var_entry_t, list);
+		used[entry->num / 8] |= 1 << (entry->num % 8);
+	}
+
+	for (size_t i = 0; i < n_entries; i++) {
+		manifest_entry_t *me = &entries[i];
+		int num;
+
+		num = alloc_var_num(used);
+		if (num < 0) {
+			efi_error("no available %s variables", prefix);
+			rc = -1;
+			break;
+		}
+		me->num = num;
+
+		entry = calloc(1, sizeof(*entry));
+		if (!entry ||
+		    asprintf(&entry->name, "%s%04X", prefix, me->num) < 0) {
+			free(entry);
+			rc = -1;
+			break;
+		}
+		entry->num = me->num;
+		entry->guid = EFI_GLOBAL_GUID;
+		entry->attributes = EFI_VARIABLE_NON_VOLATILE |
+				    EFI_VARIABLE_BOOTSERVICE_ACCESS |
+				    EFI_VARIABLE_RUNTIME_ACCESS;
+		entry->data = me->data;
+		entry->data_size = me->data_size;
+		rc = store_set_variable(entry->guid, entry->name, entry->data,
+				      entry->data_size, entry->attributes,
+				      0644);
+		if (rc < 0) {
+			efi_error("Could not set variable %s", entry->name);
+			free(entry->name);
+			free(entry);
+			break;
+		}
+		me->data = NULL;
+		list_add_tail(&entry->list, &entry_list);
+		n_created++;
+	}
+	free(used);
+
+	/* whatever we did create still goes in the order */
+	if (n_created && !opts.no_order) {
+		int order_rc = read_order(order_name, &order);
+
+		if (order_rc < 0 && errno != ENOENT)
+			error(6, "Could not add entries to %s", order_name);
+		if (order_rc >= 0)
+			order_len = order->data_size / sizeof(uint16_t);
+
+		order_data = calloc(order_len + n_created, sizeof(uint16_t));
+		if (!order_data)
+			error(6, "Could not add entries to %s", order_name);
+		if (order_len)
+			memcpy(order_data, order->data,
+			       order_len * sizeof(uint16_t));
+
+		for (size_t i = 0; i < n_created; i++) {
+			size_t at = entries[i].position;
+
+			if (at > order_len)
+				at = order_len;
+			memmove(order_data + at + 1, order_data + at,
+				(order_len - at) * sizeof(uint16_t));
+			order_data[at] = entries[i].num;
+			order_len++;
+		}
+		if (write_order(order_name, order, order_data, order_len) < 0)
+			error(6, "Could not add entries to %s", order_name);
+		free(order_data);
+		if (order) {
+			free(order->data);
+			free(order);
+		}
+	}
+	return rc;
+}
+
+/*
+ * Create every entry in a manifest.  Each disk and partition is only
+ * probed once, and nothing is written until every load option has been
+ * built.
+ */
+static int
+create_from_manifest(const char *prefix, const char *order_name,
+		     const char *path)
+{
+	manifest_entry_t *entries = NULL;
+	size_t n_entries;
+	dp_template_t *templates = NULL;
+	size_t n_templates = 0;
+	unsigned char *saved_label = opts.label;
+	int rc;
+
+	n_entries = read_manifest(path, &entries);
+
+	for (size_t i = 0; i < n_entries; i++) {
+		manifest_entry_t *me = &entries[i];
+		dp_template_t *template;
+		uint8_t *args = NULL;
+		ssize_t args_size = 0, dp_size;
+		efidp dp = NULL;
+
+		opts.label = (unsigned char *)me->label;
+		warn_duplicate_name(&entry_list);
+		preflight_loader(me->disk, me->part, me->loader);
+
+		template = get_dp_template(&templates, &n_templates, me);
+		if (!template)
+			error(5, "%s:%d: Could not make a device path for %s partition %d",
+			      path, me->line, me->disk, me->part);
+		dp_size = esp_dp_add_file((uint8_t *)template->dp,
+					  template->prefix_size, me->loader,
+					  &dp);
+		if (dp_size < 0)
+			error(5, "%s:%d: Could not make a device path for %s",
+			      path, me->line, me->loader);
+
+		if (me->args) {
+			args_size = make_args(&me->args, 1, &args);
+			if (args_size < 0)
+				error(5, "%s:%d: Could not build optional data",
+				      path, me->line);
+		}
+
+		if (make_load_option(&me->data, &me->data_size,
+				     (unsigned char *)me->label, dp, dp_size,
+				     args, args_size) < 0)
+			error(5, "%s:%d: Could not prepare %s variable",
+			      path, me->line, prefix);
+		free(args);
+		free(dp);
+	}
+	opts.label = saved_label;
+
+	rc = create_entries(prefix, order_name, entries, n_entries);
+
+	for (size_t i = 0; i < n_templates; i++)
+		free(templates[i].dp);
+	free(templates);
+	free_manifest(entries, n_entries);
+	return rc;
+}
+
+static int
+probe_mirror_member(manifest_entry_t *me, uint8_t *args, ssize_t args_size)
+{
+	ssize_t dp_size;
+	efidp dp = NULL;
+	int rc = -1;
+
+	dp_size = make_device_path_for(me->disk, me->part, me->loader, &dp);
+	if (dp_size < 0)
+		return -1;
+	if (make_load_option(&me->data, &me->data_size, opts.label, dp,
+			     dp_size, args, args_size) >= 0)
+		rc = 0;
+	free(dp);
+	return rc;
+}
+
+static int
+cmp_manifest_disk(const void *p1, const void *p2)
+{
+	const manifest_entry_t *e1 = p1, *e2 = p2;
+
+	return strcmp(e1->disk, e2->disk);
+}
+
+/*
+ * The filesystem that's mounted somewhere we'd expect an ESP, if it's on
+ * a mirror.
+ */
+static int
+find_esp_mirror(dev_t *dev)
+{
+	static const char * const mounts[] = { "/efi", "/boot/efi", "/boot" };
+	char slaves[64];
+	struct stat sb;
+	DIR *dir;
+
+	for (size_t i = 0; i < sizeof(mounts) / sizeof(mounts[0]); i++) {
+		struct dirent *de;
+		bool found = false;
+
+		if (stat(mounts[i], &sb) < 0)
+			continue;
+		snprintf(slaves, sizeof(slaves), "/sys/dev/block/%u:%u/slaves",
+			 major(sb.st_dev), minor(sb.st_dev));
+		dir = opendir(slaves);
+		if (!dir)
+			continue;
+		while (!found && (de = readdir(dir)) != NULL)
+			found = de->d_name[0] != '.';
+		closedir(dir);
+		if (found) {
+			*dev = sb.st_dev;
+			return 0;
+		}
+	}
+	errno = ENOENT;
+	return -1;
+}
+
+/*
+ * Find the partitions a RAID1 ESP is built from.  mirror is the md
+ * device, a directory on the mounted filesystem, or "auto".
+ */
+static size_t
+get_mirror_members(const char *mirror, manifest_entry_t **entries_out)
+{
+	manifest_entry_t *entries = NULL;
+	size_t n_entries = 0;
+	char slaves[64];
+	struct stat sb;
+	struct dirent *de;
+	DIR *dir;
+	dev_t dev;
+
+	if (!strcmp(mirror, "auto")) {
+		if (find_esp_mirror(&dev) < 0)
+			errorx(47, "Could not find a mounted ESP on a mirror");
+	} else {
+		if (stat(mirror, &sb) < 0)
+			error(47, "Could not stat \"%s\"", mirror);
+		dev = S_ISBLK(sb.st_mode) ? sb.st_rdev : sb.st_dev;
+	}
+
+	snprintf(slaves, sizeof(slaves), "/sys/dev/block/%u:%u/slaves",
+		 major(dev), minor(dev));
+	dir = opendir(slaves);
+	if (!dir)
+		error(47, "Could not find the members of \"%s\"", mirror);
+	while ((de = readdir(dir)) != NULL) {
+		manifest_entry_t *entry, *new_entries;
+		char path[PATH_MAX], disk[PATH_MAX];
+		char buf[32];
+		char *slash;
+		FILE *f;
+		int part = 0;
+
+		if (de->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s/partition", slaves,
+			 de->d_name);
+		f = fopen(path, "r");
+		if (!f || !fgets(buf, sizeof(buf), f) ||
+		    (part = atoi(buf)) < 1)
+			errorx(47, "%s is not a partition", de->d_name);
+		fclose(f);
+
+		/* the member's sysfs directory lives in its disk's */
+		snprintf(path, sizeof(path), "%s/%s", slaves, de->d_name);
+		if (!realpath(path, disk) || !(slash = strrchr(disk, '/')))
+			error(47, "Could not find the disk %s is on",
+			      de->d_name);
+		*slash = '\0';
+		slash = strrchr(disk, '/');
+		if (!slash)
+			errorx(47, "Could not find the disk %s is on",
+			       de->d_name);
+
+		new_entries = realloc(entries,
+				      (n_entries + 1) * sizeof(*entries));
+		if (!new_entries)
+			error(47, "Could not find the members of \"%s\"",
+			      mirror);
+		entries = new_entries;
+		entry = &entries[n_entries++];
+		memset(entry, 0, sizeof(*entry));
+		if (asprintf(&entry->label, "/dev/%s", slash + 1) < 0)
+			error(47, "Could not find the members of \"%s\"",
+			      mirror);
+		entry->disk = entry->label;
+		entry->part = part;
+		entry->loader = opts.loader;
+	}
+	closedir(dir);
+	if (!n_entries)
+		errorx(47, "\"%s\" has no members", mirror);
+
+	qsort(entries, n_entries, sizeof(*entries), cmp_manifest_disk);
+	*entries_out = entries;
+	return n_entries;
+}
+
+/*
+ * Create one entry for each member of a mirrored ESP, with the same label
+ * and optional data, next to each other in the order.  The members are
+ * probed one at a time: libefiboot's probing and libefivar's error trace
+ * aren't safe to use from more than one thread.
+ */
+static int
+create_esp_mirror(const char *prefix, const char *order_name,
+		  const char *mirror)
+{
+	manifest_entry_t *entries = NULL;
+	uint8_t *args = NULL;
+	ssize_t args_size;
+	size_t n_entries;
+	int rc;
+
+	n_entries = get_mirror_members(mirror, &entries);
+	for (size_t i = 0; i < n_entries; i++)
+		preflight_loader(entries[i].disk, entries[i].part,
+				 entries[i].loader);
+
+	args_size = get_extra_args(&args);
+	if (args_size < 0)
+		error(5, "Could not build optional data");
+
+	warn_duplicate_name(&entry_list);
+
+	for (size_t i = 0; i < n_entries; i++) {
+		entries[i].position = opts.index + i;
+		if (probe_mirror_member(&entries[i], args, args_size) < 0)
+			error(5, "Could not make a device path for %s partition %d",
+			      entries[i].disk, entries[i].part);
+	}
+
+	rc = create_entries(prefix, order_name, entries, n_entries);
+
+	free(args);
+	free_manifest(entries, n_entries);
+	return rc;
+}
+
 static int
 remove_dupes_from_order(char *name)
 {
@@ -488,8 +1196,8 @@ remove_dupes_from_order(char *name)
 	free(order->data);
 	order->data = (uint8_t *)new_data;
 	order->data_size = new_data_size;
-	efi_del_variable(EFI_GLOBAL_GUID, name);
-	rc = efi_set_variable(EFI_GLOBAL_GUID, name, order->data,
+	store_del_variable(EFI_GLOBAL_GUID, name);
+	rc = store_set_variable(EFI_GLOBAL_GUID, name, order->data,
 				order->data_size, order->attributes,
 				0644);
 	free(order->data);
@@ -534,12 +1242,12 @@ remove_from_order(const char *name, uint16_t num)
 
 	/* *Order should have nothing when new_i == 0 */
 	if (new_i == 0) {
-		efi_del_variable(EFI_GLOBAL_GUID, name);
+		store_del_variable(EFI_GLOBAL_GUID, name);
 		goto all_done;
 	}
 
 	order->data_size = sizeof(data[0]) * new_i;
-	rc = efi_set_variable(EFI_GLOBAL_GUID, name, order->data,
+	rc = store_set_variable(EFI_GLOBAL_GUID, name, order->data,
 				order->data_size, order->attributes,
 				0644);
 all_done:
@@ -557,7 +1265,7 @@ read_u16(const char *name)
 	uint32_t attributes = 0;
 	int rc;
 
-	rc = efi_get_variable(guid, name, (uint8_t **)&data, &data_size,
+	rc = store_get_variable(guid, name, (uint8_t **)&data, &data_size,
 				&attributes);
 	if (rc < 0)
 		return rc;
@@ -591,14 +1299,14 @@ delete_var(const char *prefix, uint16_t num)
 	var_entry_t *entry;
 
 	snprintf(name, sizeof(name), "%s%04X", prefix, num);
-	rc = efi_del_variable(EFI_GLOBAL_GUID, name);
+	rc = store_del_variable(EFI_GLOBAL_GUID, name);
 	if (rc < 0)
 		efi_error("Could not delete %s%04X", prefix, num);
 
 	/* For backwards compatibility, try to delete abcdef entries as well */
 	if (rc < 0 && errno == ENOENT && hex_could_be_lower_case(num)) {
 		snprintf(name, sizeof(name), "%s%04x", prefix, num);
-		rc = efi_del_variable(EFI_GLOBAL_GUID, name);
+		rc = store_del_variable(EFI_GLOBAL_GUID, name);
 		if (rc < 0 && errno != ENOENT)
 			efi_error("Could not delete %s%04x", prefix, num);
 	}
@@ -664,49 +1372,72 @@ delete_label(const char *prefix, const unsigned char *label)
 	return 0;
 }
 
-static void
-set_var_nums(const char *prefix, list_t *list)
+/*
+ * Parse the number out of a <prefix>XXXX name.
+ */
+static int
+parse_var_num(const char *prefix, const char *name, int *num)
 {
-	list_t *pos;
-	var_entry_t *var;
-	int num=0, rc;
-	char *name;
-	int warn=0;
-	size_t plen = strlen(prefix);
 	char fmt[30];
 
 	fmt[0] = '\0';
 	strcat(fmt, prefix);
 	strcat(fmt, "%04X-%*s");
 
-	list_for_each(pos, list) {
-		var = list_entry(pos, var_entry_t, list);
-		rc = sscanf(var->name, fmt, &num);
-		if (rc == 1) {
-			char *snum;
-			var->num = num;
-			name = var->name; /* shorter name */
-			snum = name + plen;
-			if ((isalpha(snum[0]) && islower(snum[0])) ||
-			    (isalpha(snum[1]) && islower(snum[1])) ||
-			    (isalpha(snum[2]) && islower(snum[2])) ||
-			    (isalpha(snum[3]) && islower(snum[3]))) {
-				fprintf(stderr,
-					"** Warning ** : %.8s is not UEFI Spec compliant (lowercase hex in name)\n",
-					name);
-				warn++;
-			}
+	return sscanf(name, fmt, num);
+}
+
+/*
+ * Fill in var->num from its name.  Returns 1 if the name had a number in
+ * it that isn't UEFI Spec compliant (lowercase hex) and we warned about
+ * it, 0 otherwise.
+ */
+static int
+set_var_num(const char *prefix, var_entry_t *var)
+{
+	int num=0, rc;
+	char *name;
+	size_t plen = strlen(prefix);
+
+	rc = parse_var_num(prefix, var->name, &num);
+	if (rc == 1) {
+		char *snum;
+		var->num = num;
+		name = var->name; /* shorter name */
+		snum = name + plen;
+		if ((isalpha(snum[0]) && islower(snum[0])) ||
+		    (isalpha(snum[1]) && islower(snum[1])) ||
+		    (isalpha(snum[2]) && islower(snum[2])) ||
+		    (isalpha(snum[3]) && islower(snum[3]))) {
+			fprintf(stderr,
+				"** Warning ** : %.8s is not UEFI Spec compliant (lowercase hex in name)\n",
+				name);
+			return 1;
 		}
 	}
-	if (warn)
-		warningx("** Warning ** : please recreate these using efibootmgr to remove this warning.");
+	return 0;
 }
 
 static void
-print_order(const char *name, uint16_t *order, int length)
+set_var_nums(const char *prefix, list_t *list)
 {
-	int i;
-	printf("%s: ", name);
+	list_t *pos;
+	var_entry_t *var;
+	int warn=0;
+
+	list_for_each(pos, list) {
+		var = list_entry(pos, var_entry_t, list);
+		warn += set_var_num(prefix, var);
+	}
+	if (warn)
+		warningx("** Warning ** : please recreate these using efibootmgr to remove this warning.");
+}
+
+static void
+print_order(const char *name, uint16_t *order, int length)
+{
+	int i;
+	printf("%s: ", name);
 	for (i=0; i<length; i++) {
 		printf("%04X", order[i]);
 		if (i < (length-1))
@@ -751,82 +1482,33 @@ print_error_arrow(char *buffer, off_t offset, char *fmt, ...)
 static int
 parse_order(const char *prefix, char *buffer, uint16_t **order, size_t *length)
 {
-	uint16_t *data;
-	size_t data_size;
-	size_t len = strlen(buffer);
-	intptr_t end = (intptr_t)buffer + len + 1;
-
-	int num = 0;
-	char *buf = buffer;
-	while ((intptr_t)buf < end) {
-		size_t comma = strcspn(buf, ",");
-		if (comma == 0) {
-			off_t offset = (intptr_t)buf - (intptr_t)buffer;
-			print_error_arrow(buffer, offset, "Malformed %s order",
-					  prefix);
-			exit(8);
-		} else {
-			num++;
-		}
-		buf += comma + 1;
-	}
-
-	if (num == 0) {
-		*order = NULL;
-		*length = 0;
-		return 0;
-	}
-
-	data = calloc(num, sizeof (*data));
-	if (!data)
-		return -1;
-	data_size = num * sizeof (*data);
-
-	int i = 0;
-	buf = buffer;
-	while ((intptr_t)buf < end) {
-		unsigned long result = 0;
-		size_t comma = strcspn(buf, ",");
-
-		buf[comma] = '\0';
-		char *endptr = NULL;
-		result = strtoul(buf, &endptr, 16);
-		if ((result == ULONG_MAX && errno == ERANGE) ||
-				(endptr && *endptr != '\0')) {
-			off_t offset = (intptr_t)endptr - (intptr_t)buffer;
-			print_error_arrow(buffer, offset, "Invalid %s order",
-					  prefix);
-			free(data);
-			exit(8);
-		}
-		if (result > 0xffff) {
-			off_t offset = (intptr_t)buf - (intptr_t)buffer;
-			warnx("Invalid %s order entry value: %lX", prefix,
-				result);
-			print_error_arrow(buffer, offset, "Invalid %s order",
-					  prefix);
-			free(data);
-			exit(8);
-		}
-
-		/* make sure this is an existing entry */
-		if (!is_current_entry(result)) {
-			off_t offset = (intptr_t)buf - (intptr_t)buffer;
-			print_error_arrow(buffer, offset,
-					  "Invalid %s order entry value",
-					  prefix);
-			warnx("entry %04lX does not exist", result);
-			free(data);
-			exit(8);
-		}
+	size_t offset = 0;
+	int num;
 
-		data[i++] = result;
-		buf[comma] = ',';
-		buf += comma + 1;
+	num = parse_order_text(buffer, is_current_entry, order, &offset);
+	switch (num) {
+	case ORDER_MALFORMED:
+		print_error_arrow(buffer, offset, "Malformed %s order", prefix);
+		exit(8);
+	case ORDER_INVALID:
+		print_error_arrow(buffer, offset, "Invalid %s order", prefix);
+		exit(8);
+	case ORDER_RANGE:
+		warnx("Invalid %s order entry value: %lX", prefix,
+		      strtoul(buffer + offset, NULL, 16));
+		print_error_arrow(buffer, offset, "Invalid %s order", prefix);
+		exit(8);
+	case ORDER_NOENT:
+		print_error_arrow(buffer, offset,
+				  "Invalid %s order entry value", prefix);
+		warnx("entry %04lX does not exist",
+		      strtoul(buffer + offset, NULL, 16));
+		exit(8);
 	}
+	if (num < 0)
+		return num;
 
-	*order = data;
-	*length = data_size;
+	*length = num * sizeof (**order);
 	return num;
 }
 
@@ -852,7 +1534,7 @@ construct_order(const char *name, char *order, int keep,
 		return 0;
 	}
 
-	rc = efi_get_variable(EFI_GLOBAL_GUID, name,
+	rc = store_get_variable(EFI_GLOBAL_GUID, name,
 				&bo.data, &bo.data_size, &bo.attributes);
 	if (rc < 0) {
 		*ret_data = data;
@@ -887,8 +1569,8 @@ construct_order(const char *name, char *order, int keep,
 		int j;
 		for (j = new_data_start; j < new_data_end; j++) {
 			if (new_data[i] == new_data[j]) {
-				memcpy(new_data + j, new_data + j + 1,
-					sizeof (uint16_t) * (new_data_end-j+1));
+				memmove(new_data + j, new_data + j + 1,
+					sizeof (uint16_t) * (new_data_end-j-1));
 				new_data_end -= 1;
 				break;
 			}
@@ -899,251 +1581,1513 @@ construct_order(const char *name, char *order, int keep,
 	return 0;
 }
 
-static int
-set_order(const char *order_name, const char *prefix, int keep_old_entries)
+static int
+set_order(const char *order_name, const char *prefix, int keep_old_entries)
+{
+	uint8_t *data = NULL;
+	size_t data_size = 0;
+	char *name;
+	int rc;
+
+	if (!opts.order)
+		return 0;
+
+	rc = construct_order(order_name, opts.order, keep_old_entries,
+				(uint16_t **)&data, &data_size);
+	if (rc < 0 || data_size == 0) {
+		if (data) /* this can't happen, but clang analyzer believes */
+			free(data);
+		return rc;
+	}
+
+	rc = asprintf(&name, "%sOrder", prefix);
+	if (rc < 0)
+		goto err;
+
+	rc = store_set_variable(EFI_GLOBAL_GUID, name, data, data_size,
+			      EFI_VARIABLE_NON_VOLATILE |
+			      EFI_VARIABLE_BOOTSERVICE_ACCESS |
+			      EFI_VARIABLE_RUNTIME_ACCESS,
+			      0644);
+	free(name);
+err:
+	free(data);
+	return rc;
+}
+
+/*
+ * Returns the printable form of a load option's optional data in a newly
+ * allocated string, or NULL if it can't be parsed.
+ */
+static char *
+optional_data_text(unsigned char *optional_data, size_t optional_data_len,
+		   bool is_shim)
+{
+	char *text = NULL;
+	size_t text_len = 0;
+	ssize_t rc;
+
+	typedef ssize_t (*parser_t)(char *buffer, size_t buffer_size,
+				    uint8_t *p, uint64_t length);
+	parser_t parser = NULL;
+	if (is_shim && optional_data_len) {
+		char *a = ucs2_to_utf8((uint16_t*)optional_data,
+				       optional_data_len/2);
+		if (!a)
+			return NULL;
+		text = calloc(1, sizeof(" File(.")
+				 + strlen(a)
+				 + strlen(")"));
+		if (!text) {
+			free(a);
+			return NULL;
+		}
+		char *b;
+
+		b = stpcpy(text, " File(.");
+		b = stpcpy(b, a);
+		stpcpy(b, ")");
+		free(a);
+	} else if (opts.unicode) {
+		text = ucs2_to_utf8((uint16_t*)optional_data,
+				    optional_data_len/2);
+	} else if (optional_data_len == sizeof(efi_guid_t)) {
+		parser = parse_efi_guid;
+	} else {
+		parser = parse_raw_text;
+	}
+
+	if (parser) {
+		rc = parser(NULL, 0, optional_data, optional_data_len);
+		if (rc < 0)
+			return NULL;
+		rc += 1;
+		text_len = rc;
+		text = calloc(1, rc);
+		if (!text)
+			return NULL;
+		rc = parser(text, text_len, optional_data, optional_data_len);
+		if (rc < 0) {
+			free(text);
+			return NULL;
+		}
+	}
+	return text;
+}
+
+static void
+show_var_path(FILE *out, dp_text_cache_t *cache,
+	      efi_load_option *load_option, size_t boot_data_size)
+{
+	char *text_path = NULL;
+	const char *dp_text;
+	uint16_t pathlen;
+	ssize_t rc;
+	efidp dp = NULL;
+	unsigned char *optional_data = NULL;
+	size_t optional_data_len=0;
+	bool is_shim = false;
+
+	pathlen = efi_loadopt_pathlen(load_option,
+				      boot_data_size);
+	dp = efi_loadopt_path(load_option, boot_data_size);
+	dp_text = dp_render(cache, dp, pathlen);
+	if (!dp_text) {
+		fwarning(out, "Could not parse device path");
+		return;
+	}
+	fprintf(out, "\t%s", dp_text);
+	is_shim = dp_is_shim(dp, pathlen);
+
+	/* Print optional data */
+	rc = efi_loadopt_optional_data(load_option, boot_data_size,
+				       &optional_data, &optional_data_len);
+	if (rc < 0) {
+		fwarning(out, "Could not parse optional data");
+		return;
+	}
+
+	text_path = optional_data_text(optional_data, optional_data_len,
+				       is_shim);
+	if (!text_path) {
+		fwarning(out, "Could not parse optional data");
+		return;
+	}
+	fprintf(out, "%s", text_path);
+	free(text_path);
+	fprintf(out, "\n");
+
+	const_efidp node = dp;
+	if (opts.verbose >= 1)
+		fprintf(out, "      dp: ");
+	for (rc = 1; opts.verbose >= 1 && rc > 0; ) {
+		ssize_t sz;
+		const_efidp next = NULL;
+		const uint8_t * const data = (const uint8_t * const)node;
+
+		rc = efidp_next_node(node, &next);
+		if (rc < 0) {
+			fwarning(out, "Could not iterate device path");
+			return;
+		}
+
+		sz = efidp_node_size(node);
+		if (sz <= 0) {
+			fwarning(out, "Could not iterate device path");
+			return;
+		}
+
+		for (ssize_t j = 0; j < sz; j++)
+			fprintf(out, "%02hhx%s", data[j], j == sz - 1 ? "" : " ");
+		fprintf(out, "%s", rc == 0 ? "\n" : " / ");
+
+		node = next;
+	}
+	if (opts.verbose >= 1 && optional_data_len)
+		fprintf(out, "    data: ");
+	for (unsigned int j = 0; opts.verbose >= 1 && j < optional_data_len; j++)
+		fprintf(out, "%02hhx%s", optional_data[j], j == optional_data_len - 1 ? "\n" : " ");
+}
+
+static int
+order_position(uint16_t *order, size_t order_len, uint16_t num)
+{
+	for (size_t i = 0; i < order_len; i++)
+		if (order[i] == num)
+			return i;
+	return -1;
+}
+
+/*
+ * Print only the fields asked for with --fields, tab separated, in the
+ * order they were given.  Nothing is decoded unless a field needs it.
+ */
+static void
+show_var_fields(FILE *out, dp_text_cache_t *cache, const var_entry_t *boot,
+		const unsigned char *description, const char *prefix,
+		uint16_t *order, size_t order_len)
+{
+	efi_load_option *load_option = (efi_load_option *)boot->data;
+	uint16_t pathlen;
+	efidp dp;
+	ssize_t rc;
+
+	for (int i = 0; i < opts.n_fields; i++) {
+		if (i > 0)
+			fprintf(out, "\t");
+
+		switch (opts.fields[i]) {
+		case EFIBOOTMGR_FIELD_NUM:
+			if (boot->name)
+				fprintf(out, "%s", boot->name);
+			else
+				fprintf(out, "%s%04X", prefix, boot->num);
+			break;
+		case EFIBOOTMGR_FIELD_ACTIVE:
+			fprintf(out, "%s", (efi_loadopt_attrs(load_option)
+				      & LOAD_OPTION_ACTIVE) ? "active"
+							    : "inactive");
+			break;
+		case EFIBOOTMGR_FIELD_LABEL:
+			fprintf(out, "%s", description);
+			break;
+		case EFIBOOTMGR_FIELD_PATH: {
+			const char *dp_text;
+
+			pathlen = efi_loadopt_pathlen(load_option,
+						      boot->data_size);
+			dp = efi_loadopt_path(load_option, boot->data_size);
+			dp_text = dp_render(cache, dp, pathlen);
+			fprintf(out, "%s", dp_text ? dp_text : "<bad device path>");
+			break;
+		}
+		case EFIBOOTMGR_FIELD_ARGS: {
+			unsigned char *optional_data = NULL;
+			size_t optional_data_len = 0;
+			char *text = NULL;
+
+			pathlen = efi_loadopt_pathlen(load_option,
+						      boot->data_size);
+			dp = efi_loadopt_path(load_option, boot->data_size);
+			rc = efi_loadopt_optional_data(load_option,
+						       boot->data_size,
+						       &optional_data,
+						       &optional_data_len);
+			if (rc >= 0)
+				text = optional_data_text(optional_data,
+						optional_data_len,
+						dp_is_shim(dp, pathlen));
+			if (text) {
+				fprintf(out, "%s", text[0] == ' ' ? text + 1 : text);
+				free(text);
+			} else {
+				fprintf(out, "<bad optional data>");
+			}
+			break;
+		}
+		case EFIBOOTMGR_FIELD_ORDER_POS:
+			rc = order_position(order, order_len, boot->num);
+			if (rc < 0)
+				fprintf(out, "-");
+			else
+				fprintf(out, "%zd", rc);
+			break;
+		}
+	}
+	fprintf(out, "\n");
+}
+
+/*
+ * Read the order variable if --fields needs entries' positions in it.
+ */
+static var_entry_t *
+read_fields_order(const char *prefix, uint16_t **order_data,
+		  size_t *order_len)
+{
+	var_entry_t *order = NULL;
+	char *order_name = NULL;
+
+	*order_data = NULL;
+	*order_len = 0;
+	if (!opts.n_fields || !(opts.field_mask & EFIBOOTMGR_FIELD_ORDER_POS))
+		return NULL;
+
+	if (asprintf(&order_name, "%sOrder", prefix) >= 0 &&
+	    read_order(order_name, &order) >= 0) {
+		*order_data = (uint16_t *)order->data;
+		*order_len = order->data_size / sizeof(uint16_t);
+	}
+	free(order_name);
+	return order;
+}
+
+static bool
+need_description(void)
+{
+	return !opts.n_fields || (opts.field_mask & EFIBOOTMGR_FIELD_LABEL);
+}
+
+/*
+ * Render one entry.  The description is passed in separately because
+ * efi_loadopt_desc() hands back a buffer it reuses on every call, so it
+ * can't be called from more than one thread.
+ */
+static void
+show_var(FILE *out, dp_text_cache_t *cache, const var_entry_t *boot,
+	 const unsigned char *description, const char *prefix,
+	 uint16_t *order, size_t order_len)
+{
+	efi_load_option *load_option = (efi_load_option *)boot->data;
+
+	if (opts.n_fields) {
+		show_var_fields(out, cache, boot, description, prefix,
+				order, order_len);
+		return;
+	}
+
+	if (boot->name)
+		fprintf(out, "%s", boot->name);
+	else
+		fprintf(out, "%s%04X", prefix, boot->num);
+
+	fprintf(out, "%c ", (efi_loadopt_attrs(load_option)
+			     & LOAD_OPTION_ACTIVE) ? '*' : ' ');
+	fprintf(out, "%s", description);
+
+	show_var_path(out, cache, load_option, boot->data_size);
+}
+
+/*
+ * libefivar keeps its error trace in one global array, grown without a
+ * lock, and its load option and device path code can add to it.  -j
+ * workers take turns at anything that might, and drop the trace before
+ * letting go; the errors they report go in their own output instead.
+ */
+static pthread_mutex_t efivar_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+efivar_enter(void)
+{
+	pthread_mutex_lock(&efivar_lock);
+}
+
+static void
+efivar_leave(void)
+{
+	int saved_errno = errno;
+
+	efi_error_clear();
+	pthread_mutex_unlock(&efivar_lock);
+	errno = saved_errno;
+}
+
+typedef struct {
+	const var_entry_t *entry;
+	unsigned char *description;
+} show_job_t;
+
+typedef struct {
+	pthread_t thread;
+	show_job_t *jobs;
+	size_t n_jobs;
+	const char *prefix;
+	uint16_t *order;
+	size_t order_len;
+	char *buf;
+	size_t buf_size;
+	int rc;
+} show_worker_t;
+
+static void *
+show_worker(void *arg)
+{
+	show_worker_t *worker = arg;
+	dp_text_cache_t cache = DP_TEXT_CACHE_INIT;
+	FILE *out;
+
+	out = open_memstream(&worker->buf, &worker->buf_size);
+	if (!out) {
+		worker->rc = -1;
+		return NULL;
+	}
+	for (size_t i = 0; i < worker->n_jobs; i++) {
+		efivar_enter();
+		show_var(out, &cache, worker->jobs[i].entry,
+			 worker->jobs[i].description, worker->prefix,
+			 worker->order, worker->order_len);
+		efivar_leave();
+	}
+	worker->rc = fclose(out) == 0 ? 0 : -1;
+	dp_text_cache_free(&cache);
+	return NULL;
+}
+
+/*
+ * Split the entries into one contiguous run per worker, let each worker
+ * render its run into its own buffer, and then write the buffers out in
+ * order, so the output is the same as rendering them one at a time.
+ */
+static int
+show_vars_parallel(const char *prefix, uint16_t *order, size_t order_len,
+		   size_t n_entries)
+{
+	show_job_t *jobs;
+	show_worker_t *workers;
+	size_t n_workers = opts.jobs;
+	size_t i = 0, n_started;
+	list_t *pos;
+	int rc = 0;
+
+	if (n_workers > n_entries)
+		n_workers = n_entries;
+
+	jobs = calloc(n_entries, sizeof(*jobs));
+	workers = calloc(n_workers, sizeof(*workers));
+	if (!jobs || !workers) {
+		free(jobs);
+		free(workers);
+		return -1;
+	}
+
+	list_for_each(pos, &entry_list) {
+		var_entry_t *boot = list_entry(pos, var_entry_t, list);
+		const unsigned char *desc;
+
+		jobs[i].entry = boot;
+		if (need_description()) {
+			desc = efi_loadopt_desc((efi_load_option *)boot->data,
+						boot->data_size);
+			jobs[i].description = (unsigned char *)strdup(
+					desc ? (const char *)desc : "");
+			if (!jobs[i].description) {
+				rc = -1;
+				goto out;
+			}
+		}
+		i++;
+	}
+
+	for (n_started = 0; n_started < n_workers; n_started++) {
+		show_worker_t *worker = &workers[n_started];
+		size_t first = n_entries * n_started / n_workers;
+		size_t last = n_entries * (n_started + 1) / n_workers;
+
+		worker->jobs = &jobs[first];
+		worker->n_jobs = last - first;
+		worker->prefix = prefix;
+		worker->order = order;
+		worker->order_len = order_len;
+		if (pthread_create(&worker->thread, NULL, show_worker,
+				   worker) != 0) {
+			rc = -1;
+			break;
+		}
+	}
+
+	for (i = 0; i < n_started; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].rc < 0)
+			rc = -1;
+	}
+	for (i = 0; rc == 0 && i < n_started; i++)
+		fwrite(workers[i].buf, 1, workers[i].buf_size, stdout);
+	for (i = 0; i < n_started; i++)
+		free(workers[i].buf);
+out:
+	for (i = 0; i < n_entries; i++)
+		free(jobs[i].description);
+	free(jobs);
+	free(workers);
+	return rc;
+}
+
+static void
+show_vars(const char *prefix)
+{
+	list_t *pos;
+	var_entry_t *boot;
+	const unsigned char *description;
+	var_entry_t *order = NULL;
+	uint16_t *order_data = NULL;
+	size_t order_len = 0;
+	size_t n_entries = 0;
+
+	order = read_fields_order(prefix, &order_data, &order_len);
+
+	list_for_each(pos, &entry_list)
+		n_entries++;
+
+	if (opts.jobs > 1 && n_entries > 1) {
+		fflush(stdout);
+		if (show_vars_parallel(prefix, order_data, order_len,
+				       n_entries) < 0)
+			error(43, "Could not render %s variables", prefix);
+		goto out;
+	}
+
+	list_for_each(pos, &entry_list) {
+		boot = list_entry(pos, var_entry_t, list);
+		description = NULL;
+		if (need_description())
+			description = efi_loadopt_desc(
+					(efi_load_option *)boot->data,
+					boot->data_size);
+		show_var(stdout, &dp_cache, boot, description, prefix,
+			 order_data, order_len);
+
+		fflush(stdout);
+	}
+out:
+	if (order) {
+		free(order->data);
+		free(order);
+	}
+	fflush(stdout);
+}
+
+/*
+ * Fold a variable into a fingerprint.  The size goes in first so that
+ * moving bytes from one variable to the next changes the result, and a
+ * missing variable hashes differently from an empty one.  Numbers are
+ * hashed little endian, so every machine gets the same fingerprint for
+ * the same variables.
+ */
+static uint64_t
+fingerprint_add(uint64_t hash, const char *name, const uint8_t *data,
+		size_t data_size, bool present)
+{
+	uint32_t size = htole32(present ? (uint32_t)data_size : UINT32_MAX);
+
+	hash = fnv1a64(name, strlen(name) + 1, hash);
+	hash = fnv1a64(&size, sizeof(size), hash);
+	if (present)
+		hash = fnv1a64(data, data_size, hash);
+	return hash;
+}
+
+/* Fold an entry, by the hash of its load option, into a fingerprint. */
+static uint64_t
+fingerprint_add_entry(uint64_t hash, const char *name, uint64_t entry_hash)
+{
+	uint64_t le_hash = htole64(entry_hash);
+
+	return fingerprint_add(hash, name, (uint8_t *)&le_hash,
+			       sizeof(le_hash), true);
+}
+
+static uint64_t
+fingerprint_var(uint64_t hash, const char *name)
+{
+	uint8_t *data = NULL;
+	size_t data_size = 0;
+	uint32_t attributes;
+	int rc;
+
+	rc = store_get_variable(EFI_GLOBAL_GUID, name, &data, &data_size,
+			      &attributes);
+	hash = fingerprint_add(hash, name, data, data_size, rc >= 0);
+	if (rc >= 0)
+		free(data);
+	return hash;
+}
+
+/*
+ * Print one line identifying this machine's boot configuration: a hash
+ * over the order variable, Timeout and every entry's load option.  With
+ * -v, each entry's own hash is printed first.
+ */
+static void
+show_fingerprint(const char *prefix, const char *order_name)
+{
+	uint64_t hash = FNV1A64_INIT;
+	list_t *pos;
+	var_entry_t *entry;
+
+	hash = fingerprint_var(hash, order_name);
+	hash = fingerprint_var(hash, "Timeout");
+
+	list_for_each(pos, &entry_list) {
+		uint64_t entry_hash;
+
+		entry = list_entry(pos, var_entry_t, list);
+		entry_hash = fnv1a64(entry->data, entry->data_size,
+				     FNV1A64_INIT);
+		if (opts.verbose > 0)
+			printf("%s%04X %016"PRIx64"\n", prefix, entry->num,
+			       entry_hash);
+		hash = fingerprint_add_entry(hash, entry->name, entry_hash);
+	}
+	printf("Fingerprint: %016"PRIx64"\n", hash);
+	fflush(stdout);
+}
+
+static void
+json_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for (; *s; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(out, "\\u%04x", c);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+typedef struct {
+	const char *name;
+	unsigned int num;
+} image_entry_t;
+
+static int
+cmp_image_entries(const void *p1, const void *p2)
+{
+	const image_entry_t *e1 = p1;
+	const image_entry_t *e2 = p2;
+
+	return strcoll(e1->name, e2->name);
+}
+
+/* what each worker keeps from one image to the next */
+typedef struct {
+	dp_text_cache_t cache;
+	image_entry_t *entries;
+	size_t entries_size;
+	uint8_t *data;
+	size_t data_size;
+} image_scratch_t;
+
+/*
+ * Copy a variable out of the image, so load option parsing gets an
+ * aligned, writable buffer.  Returns the size, or -1 if it isn't there.
+ */
+static ssize_t
+image_var(fv_image_t *img, image_scratch_t *scratch, const char *name)
+{
+	efi_guid_t guid = EFI_GLOBAL_GUID;
+	const uint8_t *data;
+	size_t size;
+
+	if (fv_image_get(img, &guid, name, &data, &size, NULL) < 0)
+		return -1;
+	if (size > scratch->data_size) {
+		uint8_t *tmp = realloc(scratch->data, size);
+
+		if (!tmp)
+			return -1;
+		scratch->data = tmp;
+		scratch->data_size = size;
+	}
+	memcpy(scratch->data, data, size);
+	return size;
+}
+
+static void
+show_image_entry(FILE *out, image_scratch_t *scratch, const char *prefix,
+		 const image_entry_t *entry, size_t size,
+		 uint16_t *order, size_t order_len)
+{
+	static const int all_fields[] = {
+		EFIBOOTMGR_FIELD_NUM, EFIBOOTMGR_FIELD_ACTIVE,
+		EFIBOOTMGR_FIELD_LABEL, EFIBOOTMGR_FIELD_PATH,
+		EFIBOOTMGR_FIELD_ARGS,
+	};
+	efi_load_option *load_option = (efi_load_option *)scratch->data;
+	const int *fields = opts.n_fields ? opts.fields : all_fields;
+	int n_fields = opts.n_fields ? opts.n_fields
+				     : (int)(sizeof(all_fields) /
+					     sizeof(all_fields[0]));
+	uint16_t pathlen;
+	efidp dp;
+	char num[5];
+
+	snprintf(num, sizeof(num), "%04X", entry->num);
+	if (!efi_loadopt_is_valid(load_option, size)) {
+		fprintf(out, "{\"num\":\"%s%s\",\"error\":\"invalid load option\"}",
+			prefix, num);
+		return;
+	}
+
+	pathlen = efi_loadopt_pathlen(load_option, size);
+	dp = efi_loadopt_path(load_option, size);
+	fputc('{', out);
+	for (int i = 0; i < n_fields; i++) {
+		unsigned char *optional_data = NULL;
+		size_t optional_data_len = 0;
+		const char *dp_text;
+		char *text = NULL;
+		int pos;
+
+		if (i > 0)
+			fputc(',', out);
+		switch (fields[i]) {
+		case EFIBOOTMGR_FIELD_NUM:
+			fprintf(out, "\"num\":\"%s%s\"", prefix, num);
+			break;
+		case EFIBOOTMGR_FIELD_ACTIVE:
+			fprintf(out, "\"active\":%s",
+				(efi_loadopt_attrs(load_option) &
+				 LOAD_OPTION_ACTIVE) ? "true" : "false");
+			break;
+		case EFIBOOTMGR_FIELD_LABEL:
+			/*
+			 * efi_loadopt_desc() reuses one buffer for
+			 * everybody, so decode it ourselves.
+			 */
+			text = ucs2_to_utf8((uint16_t *)(scratch->data +
+						sizeof(uint32_t) +
+						sizeof(uint16_t)),
+					    (size - sizeof(uint32_t) -
+					     sizeof(uint16_t)) / 2);
+			fprintf(out, "\"label\":");
+			json_string(out, text ? text : "");
+			break;
+		case EFIBOOTMGR_FIELD_PATH:
+			dp_text = dp_render(&scratch->cache, dp, pathlen);
+			fprintf(out, "\"path\":");
+			if (dp_text)
+				json_string(out, dp_text);
+			else
+				fprintf(out, "null");
+			break;
+		case EFIBOOTMGR_FIELD_ARGS:
+			if (efi_loadopt_optional_data(load_option, size,
+						      &optional_data,
+						      &optional_data_len) >= 0)
+				text = optional_data_text(optional_data,
+						optional_data_len,
+						dp_is_shim(dp, pathlen));
+			fprintf(out, "\"args\":");
+			if (text)
+				json_string(out, text[0] == ' ' ? text + 1 : text);
+			else
+				fprintf(out, "null");
+			break;
+		case EFIBOOTMGR_FIELD_ORDER_POS:
+			pos = order_position(order, order_len, entry->num);
+			if (pos < 0)
+				fprintf(out, "\"order-pos\":null");
+			else
+				fprintf(out, "\"order-pos\":%d", pos);
+			break;
+		}
+		free(text);
+	}
+	fputc('}', out);
+}
+
+/*
+ * Write one line of JSON describing the entries in the image at path,
+ * using nothing but the image and the worker's own scratch space.
+ */
+static int
+show_image(FILE *out, image_scratch_t *scratch, const char *path,
+	   const char *prefix, const char *order_name)
+{
+	uint64_t hash = FNV1A64_INIT;
+	uint16_t *order = NULL;
+	size_t order_len = 0;
+	size_t n_entries = 0;
+	size_t plen = strlen(prefix);
+	efi_guid_t global = EFI_GLOBAL_GUID;
+	bool in_entries = false;
+	fv_image_t *img;
+	efi_guid_t *guid;
+	char *name;
+	size_t iter = 0;
+	ssize_t size;
+	int rc;
+
+	fprintf(out, "{\"image\":");
+	json_string(out, path);
+
+	efivar_enter();
+	rc = fv_image_open(path, false, &img);
+	efivar_leave();
+	if (rc < 0) {
+		fprintf(out, ",\"error\":");
+		json_string(out, strerror(errno));
+		fprintf(out, "}\n");
+		return -1;
+	}
+
+	while (fv_image_next(img, &iter, &guid, &name) > 0) {
+		if (efi_guid_cmp(guid, &global) || strncmp(name, prefix, plen) ||
+		    strspn(name + plen, "0123456789ABCDEFabcdef") < 4)
+			continue;
+		if (n_entries == scratch->entries_size) {
+			size_t n = n_entries ? n_entries * 2 : 64;
+			image_entry_t *tmp;
+
+			tmp = realloc(scratch->entries, n * sizeof(*tmp));
+			if (!tmp)
+				goto err;
+			scratch->entries = tmp;
+			scratch->entries_size = n;
+		}
+		scratch->entries[n_entries].name = name;
+		scratch->entries[n_entries].num = strtoul(name + plen, NULL,
+							  16) & 0xffff;
+		n_entries++;
+	}
+	qsort(scratch->entries, n_entries, sizeof(*scratch->entries),
+	      cmp_image_entries);
+
+	/* the same things in the same order as show_fingerprint() */
+	size = image_var(img, scratch, order_name);
+	if (opts.fingerprint)
+		hash = fingerprint_add(hash, order_name, scratch->data, size,
+				       size >= 0);
+	if (size >= 0) {
+		order_len = size / sizeof(uint16_t);
+		order = malloc(order_len * sizeof(*order) + 1);
+		if (!order)
+			goto err;
+		memcpy(order, scratch->data, order_len * sizeof(*order));
+	}
+
+	size = image_var(img, scratch, "Timeout");
+	if (size == sizeof(uint16_t))
+		fprintf(out, ",\"Timeout\":%u", *(uint16_t *)scratch->data);
+	if (opts.fingerprint)
+		hash = fingerprint_add(hash, "Timeout", scratch->data, size,
+				       size >= 0);
+
+	size = image_var(img, scratch, "BootNext");
+	if (!strcmp(prefix, "Boot") && size == sizeof(uint16_t))
+		fprintf(out, ",\"BootNext\":\"%04X\"",
+			*(uint16_t *)scratch->data);
+
+	if (order) {
+		fprintf(out, ",\"%s\":[", order_name);
+		for (size_t i = 0; i < order_len; i++)
+			fprintf(out, "%s\"%04X\"", i ? "," : "", order[i]);
+		fprintf(out, "]");
+	}
+
+	fprintf(out, ",\"entries\":[");
+	in_entries = true;
+	for (size_t i = 0; i < n_entries; i++) {
+		image_entry_t *entry = &scratch->entries[i];
+
+		size = image_var(img, scratch, entry->name);
+		if (size < 0)
+			goto err;
+		if (i > 0)
+			fputc(',', out);
+		efivar_enter();
+		show_image_entry(out, scratch, prefix, entry, size, order,
+				 order_len);
+		efivar_leave();
+		if (opts.fingerprint) {
+			uint64_t entry_hash = fnv1a64(scratch->data, size,
+						      FNV1A64_INIT);
+
+			hash = fingerprint_add_entry(hash, entry->name,
+						     entry_hash);
+		}
+	}
+	fprintf(out, "]");
+
+	if (opts.fingerprint)
+		fprintf(out, ",\"fingerprint\":\"%016"PRIx64"\"", hash);
+	fprintf(out, "}\n");
+
+	if (scratch->cache.nused >= STREAM_DP_CACHE_MAX)
+		dp_text_cache_clear(&scratch->cache);
+	free(order);
+	fv_image_close(img);
+	return 0;
+err:
+	fprintf(out, "%s,\"error\":", in_entries ? "]" : "");
+	json_string(out, strerror(errno));
+	fprintf(out, "}\n");
+	free(order);
+	fv_image_close(img);
+	return -1;
+}
+
+typedef struct {
+	char *buf;
+	size_t size;
+	bool done;
+	bool failed;
+} image_result_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char **paths;
+	size_t n_paths;
+	size_t next;
+	image_result_t *results;
+	const char *prefix;
+	const char *order_name;
+} image_batch_t;
+
+static void *
+image_worker(void *arg)
+{
+	image_batch_t *batch = arg;
+	image_scratch_t scratch = { .cache = DP_TEXT_CACHE_INIT };
+
+	for (;;) {
+		image_result_t *result;
+		size_t i;
+		FILE *out;
+		int rc = -1;
+
+		pthread_mutex_lock(&batch->lock);
+		i = batch->next++;
+		pthread_mutex_unlock(&batch->lock);
+		if (i >= batch->n_paths)
+			break;
+
+		result = &batch->results[i];
+		out = open_memstream(&result->buf, &result->size);
+		if (out) {
+			rc = show_image(out, &scratch, batch->paths[i],
+					batch->prefix, batch->order_name);
+			if (fclose(out) != 0) {
+				free(result->buf);
+				result->buf = NULL;
+				result->size = 0;
+				rc = -1;
+			}
+		}
+
+		pthread_mutex_lock(&batch->lock);
+		result->done = true;
+		result->failed = rc < 0;
+		pthread_cond_broadcast(&batch->cond);
+		pthread_mutex_unlock(&batch->lock);
+	}
+
+	dp_text_cache_free(&scratch.cache);
+	free(scratch.entries);
+	free(scratch.data);
+	return NULL;
+}
+
+/*
+ * List the entries in every image matching pattern as NDJSON, one line
+ * per image.  -j workers take images as they become free, and each line
+ * is written as soon as it and every line before it are done, so the
+ * output is in the order glob() sorted the names into.
+ *
+ * Returns the number of images we couldn't read.
+ */
+static size_t
+show_images(const char *pattern, const char *prefix, const char *order_name)
+{
+	image_batch_t batch = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.prefix = prefix,
+		.order_name = order_name,
+	};
+	size_t n_workers = opts.jobs > 1 ? (size_t)opts.jobs : 1;
+	size_t n_started, n_failed = 0;
+	pthread_t *threads;
+	glob_t g;
+	int rc;
+
+	rc = glob(pattern, 0, NULL, &g);
+	if (rc == GLOB_NOMATCH)
+		errorx(53, "No images match \"%s\"", pattern);
+	else if (rc != 0)
+		errorx(53, "Could not expand \"%s\"", pattern);
+
+	batch.paths = g.gl_pathv;
+	batch.n_paths = g.gl_pathc;
+	if (n_workers > batch.n_paths)
+		n_workers = batch.n_paths;
+	batch.results = calloc(batch.n_paths, sizeof(*batch.results));
+	threads = calloc(n_workers, sizeof(*threads));
+	if (!batch.results || !threads)
+		error(53, "Could not allocate memory");
+
+	for (n_started = 0; n_started < n_workers; n_started++)
+		if (pthread_create(&threads[n_started], NULL, image_worker,
+				   &batch) != 0)
+			break;
+	if (n_started == 0)
+		error(53, "Could not start any workers");
+
+	for (size_t i = 0; i < batch.n_paths; i++) {
+		image_result_t *result = &batch.results[i];
+
+		pthread_mutex_lock(&batch.lock);
+		while (!result->done)
+			pthread_cond_wait(&batch.cond, &batch.lock);
+		pthread_mutex_unlock(&batch.lock);
+
+		if (result->failed)
+			n_failed++;
+		if (result->buf)
+			fwrite(result->buf, 1, result->size, stdout);
+		fflush(stdout);
+		free(result->buf);
+	}
+
+	for (size_t i = 0; i < n_started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	free(batch.results);
+	globfree(&g);
+	return n_failed;
+}
+
+/*
+ * One side of --diff: the entries, order, Timeout and BootNext of a
+ * store, read once so the two sides can be compared without going back
+ * to either store.
+ */
+typedef struct {
+	uint16_t	num;
+	uint8_t		*data;
+	size_t		data_size;
+	uint64_t	hash;
+	ssize_t		match;		/* the other side's entry, or -1 */
+} diff_entry_t;
+
+typedef struct {
+	const char	*spec;
+	diff_entry_t	*entries;	/* sorted by number */
+	size_t		n_entries;
+	uint16_t	*order;
+	size_t		order_len;
+	int		timeout;	/* -1 if it isn't set */
+	int		bootnext;
+} diff_side_t;
+
+static int
+cmp_diff_entries(const void *p1, const void *p2)
+{
+	const diff_entry_t *e1 = p1;
+	const diff_entry_t *e2 = p2;
+
+	return (int)e1->num - (int)e2->num;
+}
+
+static int
+cmp_diff_entry_hashes(const void *p1, const void *p2)
+{
+	const diff_entry_t * const *e1 = p1;
+	const diff_entry_t * const *e2 = p2;
+
+	if ((*e1)->hash != (*e2)->hash)
+		return (*e1)->hash < (*e2)->hash ? -1 : 1;
+	return (int)(*e1)->num - (int)(*e2)->num;
+}
+
+static ssize_t
+find_diff_entry(const diff_side_t *side, uint16_t num)
+{
+	diff_entry_t key = { .num = num };
+	diff_entry_t *entry;
+
+	entry = bsearch(&key, side->entries, side->n_entries,
+			sizeof(key), cmp_diff_entries);
+	return entry ? entry - side->entries : -1;
+}
+
+static bool
+same_diff_entry(const diff_entry_t *e1, const diff_entry_t *e2)
+{
+	return e1->hash == e2->hash && e1->data_size == e2->data_size &&
+	       !memcmp(e1->data, e2->data, e1->data_size);
+}
+
+static void
+link_diff_entries(diff_side_t *a, size_t i, diff_side_t *b, size_t j)
+{
+	a->entries[i].match = j;
+	b->entries[j].match = i;
+}
+
+/*
+ * Read one side.  "live" is the firmware; anything else is a --store
+ * spec, and images are opened read-only.
+ */
+static void
+read_diff_side(diff_side_t *side, const char *prefix, const char *order_name)
 {
+	size_t plen = strlen(prefix);
+	size_t size = 0;
 	uint8_t *data = NULL;
 	size_t data_size = 0;
+	uint32_t attributes;
+	efi_guid_t *guid;
 	char *name;
 	int rc;
 
-	if (!opts.order)
-		return 0;
+	if (!strcmp(side->spec, "live"))
+		rc = store_open(NULL);
+	else if (!strncmp(side->spec, "image:", 6))
+		rc = store_open_image(side->spec + 6, false);
+	else
+		rc = store_open(side->spec);
+	if (rc < 0)
+		error(55, "Could not open variable store \"%s\"", side->spec);
+	if (!store_variables_supported())
+		errorx(55, "\"%s\" has no EFI variables", side->spec);
 
-	rc = construct_order(order_name, opts.order, keep_old_entries,
-				(uint16_t **)&data, &data_size);
-	if (rc < 0 || data_size == 0) {
-		if (data) /* this can't happen, but clang analyzer believes */
-			free(data);
-		return rc;
-	}
+	while ((rc = store_get_next_variable_name(&guid, &name)) > 0) {
+		int num;
 
-	rc = asprintf(&name, "%sOrder", prefix);
+		if (efi_guid_cmp(guid, &efi_guid_global) ||
+		    strlen(name) != plen + 4 ||
+		    parse_var_num(prefix, name, &num) != 1)
+			continue;
+		if (side->n_entries == size) {
+			diff_entry_t *tmp;
+
+			size = size ? size * 2 : 64;
+			tmp = realloc(side->entries, size * sizeof(*tmp));
+			if (!tmp)
+				error(55, "Could not allocate memory");
+			side->entries = tmp;
+		}
+		side->entries[side->n_entries++] = (diff_entry_t) {
+			.num = num,
+			.match = -1,
+		};
+	}
 	if (rc < 0)
-		goto err;
+		error(55, "Could not read the variables in \"%s\"",
+		      side->spec);
+
+	for (size_t i = 0; i < side->n_entries; i++) {
+		diff_entry_t *entry = &side->entries[i];
+		char var_name[16];
+
+		snprintf(var_name, sizeof(var_name), "%s%04X", prefix,
+			 entry->num);
+		rc = store_get_variable(EFI_GLOBAL_GUID, var_name,
+					&entry->data, &entry->data_size,
+					&attributes);
+		if (rc < 0)
+			error(55, "Could not read %s in \"%s\"", var_name,
+			      side->spec);
+		entry->hash = fnv1a64(entry->data, entry->data_size,
+				      FNV1A64_INIT);
+	}
+	qsort(side->entries, side->n_entries, sizeof(*side->entries),
+	      cmp_diff_entries);
+
+	rc = store_get_variable(EFI_GLOBAL_GUID, order_name, &data,
+				&data_size, &attributes);
+	if (rc < 0 && errno != ENOENT)
+		error(55, "Could not read %s in \"%s\"", order_name,
+		      side->spec);
+	if (rc == 0) {
+		side->order = (uint16_t *)data;
+		side->order_len = data_size / sizeof(uint16_t);
+	}
 
-	rc = efi_set_variable(EFI_GLOBAL_GUID, name, data, data_size,
-			      EFI_VARIABLE_NON_VOLATILE |
-			      EFI_VARIABLE_BOOTSERVICE_ACCESS |
-			      EFI_VARIABLE_RUNTIME_ACCESS,
-			      0644);
-	free(name);
-err:
-	free(data);
-	return rc;
+	side->timeout = side->bootnext = -1;
+	if (!strcmp(prefix, "Boot")) {
+		side->timeout = read_u16("Timeout");
+		side->bootnext = read_u16("BootNext");
+	}
 }
 
-#define ev_bits(val, mask, shift) \
-	(((val) & ((mask) << (shift))) >> (shift))
-
-static inline char *
-ucs2_to_utf8(const uint16_t * const chars, ssize_t limit)
+static void
+free_diff_side(diff_side_t *side)
 {
-	ssize_t i, j;
-	char *ret;
-
-	ret = alloca(limit * 6 + 1);
-	if (!ret)
-		return NULL;
-	memset(ret, 0, limit * 6 +1);
-
-	for (i=0, j=0; i < (limit >= 0 ? limit : i+1) && chars[i]; i++,j++) {
-		if (chars[i] <= 0x7f) {
-			ret[j] = chars[i];
-		} else if (chars[i] > 0x7f && chars[i] <= 0x7ff) {
-			ret[j++] = 0xc0 | ev_bits(chars[i], 0x1f, 6);
-			ret[j]   = 0x80 | ev_bits(chars[i], 0x3f, 0);
-		} else if (chars[i] > 0x7ff) {
-			ret[j++] = 0xe0 | ev_bits(chars[i], 0xf, 12);
-			ret[j++] = 0x80 | ev_bits(chars[i], 0x3f, 6);
-			ret[j]   = 0x80| ev_bits(chars[i], 0x3f, 0);
-		}
-	}
-	ret[j] = '\0';
-	return strdup(ret);
+	for (size_t i = 0; i < side->n_entries; i++)
+		free(side->entries[i].data);
+	free(side->entries);
+	free(side->order);
 }
 
+/*
+ * Pair the entries up: identical ones with the same number, then
+ * identical ones wherever they are (they were renumbered), then what's
+ * left with the same number (they were changed).
+ */
 static void
-show_var_path(efi_load_option *load_option, size_t boot_data_size)
+match_diff_entries(diff_side_t *a, diff_side_t *b)
 {
-	char *text_path = NULL;
-	size_t text_path_len = 0;
-	uint16_t pathlen;
-	ssize_t rc;
-	efidp dp = NULL;
-	unsigned char *optional_data = NULL;
-	size_t optional_data_len=0;
-	bool is_shim = false;
-	const char * const shim_path_segments[] = {
-		"/File(\\EFI\\", "\\shim", ".efi)", NULL
-	};
+	diff_entry_t **by_hash;
+	size_t n = 0;
 
-	pathlen = efi_loadopt_pathlen(load_option,
-				      boot_data_size);
-	dp = efi_loadopt_path(load_option, boot_data_size);
-	rc = efidp_format_device_path((unsigned char *)text_path,
-				      text_path_len, dp, pathlen);
-	if (rc < 0) {
-		warning("Could not parse device path");
-		return;
-	}
-	rc += 1;
+	for (size_t i = 0; i < a->n_entries; i++) {
+		ssize_t j = find_diff_entry(b, a->entries[i].num);
 
-	text_path_len = rc;
-	text_path = calloc(1, rc);
-	if (!text_path) {
-		warning("Could not parse device path");
-		return;
+		if (j >= 0 && same_diff_entry(&a->entries[i], &b->entries[j]))
+			link_diff_entries(a, i, b, j);
 	}
 
-	rc = efidp_format_device_path((unsigned char *)text_path,
-				      text_path_len, dp, pathlen);
-	if (rc >= 0) {
-		printf("\t%s", text_path);
+	by_hash = calloc(b->n_entries ? b->n_entries : 1, sizeof(*by_hash));
+	if (!by_hash)
+		error(55, "Could not allocate memory");
+	for (size_t j = 0; j < b->n_entries; j++)
+		if (b->entries[j].match < 0)
+			by_hash[n++] = &b->entries[j];
+	qsort(by_hash, n, sizeof(*by_hash), cmp_diff_entry_hashes);
+
+	for (size_t i = 0; i < a->n_entries; i++) {
+		diff_entry_t *entry = &a->entries[i];
+		size_t lo = 0, hi = n;
+
+		if (entry->match >= 0)
+			continue;
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
 
-		char *a = text_path;
-		for (int i = 0; a && shim_path_segments[i] != NULL; i++) {
-			a = strstr(a, shim_path_segments[i]);
-			if (a)
-				a += strlen(shim_path_segments[i]);
+			if (by_hash[mid]->hash < entry->hash)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (; lo < n && by_hash[lo]->hash == entry->hash; lo++) {
+			if (by_hash[lo]->match < 0 &&
+			    same_diff_entry(entry, by_hash[lo])) {
+				link_diff_entries(a, i, b,
+						  by_hash[lo] - b->entries);
+				break;
+			}
 		}
-		if (a && a[0] == '\0')
-			is_shim = true;
 	}
+	free(by_hash);
 
-	free(text_path);
-	if (rc < 0) {
-		warning("Could not parse device path");
+	for (size_t i = 0; i < a->n_entries; i++) {
+		ssize_t j;
+
+		if (a->entries[i].match >= 0)
+			continue;
+		j = find_diff_entry(b, a->entries[i].num);
+		if (j >= 0 && b->entries[j].match < 0)
+			link_diff_entries(a, i, b, j);
+	}
+}
+
+static void
+show_diff_entry(char sign, const char *prefix, const diff_side_t *side,
+		const diff_entry_t *entry)
+{
+	efi_load_option *load_option = (efi_load_option *)entry->data;
+	var_entry_t var = {
+		.data = entry->data,
+		.data_size = entry->data_size,
+		.num = entry->num,
+	};
+	const unsigned char *description;
+
+	printf("%c ", sign);
+	if (!efi_loadopt_is_valid(load_option, entry->data_size)) {
+		printf("%s%04X: not a valid load option\n", prefix,
+		       entry->num);
 		return;
 	}
+	description = efi_loadopt_desc(load_option, entry->data_size);
+	show_var(stdout, &dp_cache, &var,
+		 description ? description : (const unsigned char *)"",
+		 prefix, side->order, side->order_len);
+}
 
-	/* Print optional data */
-	rc = efi_loadopt_optional_data(load_option, boot_data_size,
-				       &optional_data, &optional_data_len);
-	if (rc < 0) {
-		warning("Could not parse optional data");
+static char *
+diff_args_text(efi_load_option *load_option, size_t size, uint8_t *data,
+	       size_t data_len)
+{
+	uint16_t pathlen = efi_loadopt_pathlen(load_option, size);
+	efidp dp = efi_loadopt_path(load_option, size);
+	char *text;
+
+	text = optional_data_text(data, data_len, dp_is_shim(dp, pathlen));
+	if (text && text[0] == ' ')
+		memmove(text, text + 1, strlen(text));
+	return text;
+}
+
+/* Print the fields that differ between two entries with the same number. */
+static void
+show_diff_change(const char *prefix, const diff_entry_t *a,
+		 const diff_entry_t *b)
+{
+	efi_load_option *la = (efi_load_option *)a->data;
+	efi_load_option *lb = (efi_load_option *)b->data;
+	uint32_t attrs_a, attrs_b;
+	const unsigned char *desc;
+	char *desc_a, *desc_b;
+	uint16_t pathlen_a, pathlen_b;
+	efidp dp_a, dp_b;
+	uint8_t *data_a = NULL, *data_b = NULL;
+	size_t data_len_a = 0, data_len_b = 0;
+
+	printf("~ %s%04X\n", prefix, a->num);
+	if (!efi_loadopt_is_valid(la, a->data_size) ||
+	    !efi_loadopt_is_valid(lb, b->data_size)) {
+		printf("\tnot a valid load option\n");
 		return;
 	}
 
-	typedef ssize_t (*parser_t)(char *buffer, size_t buffer_size,
-				    uint8_t *p, uint64_t length);
-	parser_t parser = NULL;
-	if (is_shim && optional_data_len) {
-		char *a = ucs2_to_utf8((uint16_t*)optional_data,
-				       optional_data_len/2);
-		if (!a) {
-			warning("Could not parse optional data");
-			return;
-		}
-		text_path = calloc(1, sizeof(" File(.")
-				      + strlen(a)
-				      + strlen(")"));
-		if (!text_path) {
-			free(a);
-			warning("Could not parse optional data");
-			return;
-		}
-		char *b;
+	attrs_a = efi_loadopt_attrs(la);
+	attrs_b = efi_loadopt_attrs(lb);
+	if ((attrs_a ^ attrs_b) & LOAD_OPTION_ACTIVE)
+		printf("\tactive: %s -> %s\n",
+		       attrs_a & LOAD_OPTION_ACTIVE ? "yes" : "no",
+		       attrs_b & LOAD_OPTION_ACTIVE ? "yes" : "no");
+	if ((attrs_a ^ attrs_b) & ~LOAD_OPTION_ACTIVE)
+		printf("\tattributes: 0x%08x -> 0x%08x\n", attrs_a, attrs_b);
+
+	/* efi_loadopt_desc() reuses its buffer */
+	desc = efi_loadopt_desc(la, a->data_size);
+	desc_a = strdup(desc ? (const char *)desc : "");
+	desc = efi_loadopt_desc(lb, b->data_size);
+	desc_b = strdup(desc ? (const char *)desc : "");
+	if (!desc_a || !desc_b)
+		error(55, "Could not allocate memory");
+	if (strcmp(desc_a, desc_b))
+		printf("\tlabel: %s -> %s\n", desc_a, desc_b);
+	free(desc_a);
+	free(desc_b);
+
+	pathlen_a = efi_loadopt_pathlen(la, a->data_size);
+	pathlen_b = efi_loadopt_pathlen(lb, b->data_size);
+	dp_a = efi_loadopt_path(la, a->data_size);
+	dp_b = efi_loadopt_path(lb, b->data_size);
+	if (pathlen_a != pathlen_b || memcmp(dp_a, dp_b, pathlen_a)) {
+		const char *text_a = dp_render(&dp_cache, dp_a, pathlen_a);
+		const char *text_b = dp_render(&dp_cache, dp_b, pathlen_b);
+
+		printf("\tpath: %s -> %s\n",
+		       text_a ? text_a : "<bad device path>",
+		       text_b ? text_b : "<bad device path>");
+	}
 
-		b = stpcpy(text_path, " File(.");
-		b = stpcpy(b, a);
-		stpcpy(b, ")");
-		free(a);
-	} else if (opts.unicode) {
-		text_path = ucs2_to_utf8((uint16_t*)optional_data,
-					 optional_data_len/2);
-		if (!text_path) {
-			warning("Could not parse optional data");
-			return;
-		}
-	} else if (optional_data_len == sizeof(efi_guid_t)) {
-		parser = parse_efi_guid;
-	} else {
-		parser = parse_raw_text;
+	if (efi_loadopt_optional_data(la, a->data_size, &data_a,
+				      &data_len_a) < 0 ||
+	    efi_loadopt_optional_data(lb, b->data_size, &data_b,
+				      &data_len_b) < 0) {
+		printf("\targs: <bad optional data>\n");
+	} else if (data_len_a != data_len_b ||
+		   memcmp(data_a, data_b, data_len_a)) {
+		char *text_a = diff_args_text(la, a->data_size, data_a,
+					      data_len_a);
+		char *text_b = diff_args_text(lb, b->data_size, data_b,
+					      data_len_b);
+
+		printf("\targs: %s -> %s\n",
+		       text_a ? text_a : "<bad optional data>",
+		       text_b ? text_b : "<bad optional data>");
+		free(text_a);
+		free(text_b);
 	}
+}
 
-	if (parser) {
-		rc = parser(NULL, 0, optional_data, optional_data_len);
-		if (rc < 0) {
-			warning("Could not parse optional data");
-			return;
+/*
+ * Compare the entries and order of --diff's two stores.  Entries are
+ * paired up by content before number, so one that was only renumbered
+ * isn't shown as removed and added, and device paths are only rendered
+ * for what gets printed.  Returns 1 if anything differs, like diff(1).
+ */
+static int
+show_diff(const char *prefix, const char *order_name)
+{
+	diff_side_t a = { .spec = opts.diff_from };
+	diff_side_t b = { .spec = opts.diff_to };
+	uint16_t *mapped = NULL;
+	bool differ = false;
+
+	read_diff_side(&a, prefix, order_name);
+	read_diff_side(&b, prefix, order_name);
+	match_diff_entries(&a, &b);
+
+	for (size_t i = 0; i < a.n_entries; i++) {
+		diff_entry_t *entry = &a.entries[i];
+		diff_entry_t *other;
+
+		if (entry->match < 0) {
+			show_diff_entry('-', prefix, &a, entry);
+			differ = true;
+			continue;
 		}
-		rc += 1;
-		text_path_len = rc;
-		text_path = calloc(1, rc);
-		if (!text_path) {
-			warning("Could not parse optional data");
-			return;
+		other = &b.entries[entry->match];
+		if (other->num != entry->num) {
+			printf("> %s%04X is now %s%04X\n", prefix, entry->num,
+			       prefix, other->num);
+			differ = true;
+		} else if (!same_diff_entry(entry, other)) {
+			show_diff_change(prefix, entry, other);
+			differ = true;
 		}
-		rc = parser(text_path, text_path_len,
-			    optional_data, optional_data_len);
-		if (rc < 0) {
-			warning("Could not parse device path");
-			free(text_path);
-			return;
+	}
+	for (size_t j = 0; j < b.n_entries; j++) {
+		if (b.entries[j].match < 0) {
+			show_diff_entry('+', prefix, &b, &b.entries[j]);
+			differ = true;
 		}
 	}
-	printf("%s", text_path);
-	free(text_path);
-	printf("\n");
 
-	const_efidp node = dp;
-	if (opts.verbose >= 1)
-		printf("      dp: ");
-	for (rc = 1; opts.verbose >= 1 && rc > 0; ) {
-		ssize_t sz;
-		const_efidp next = NULL;
-		const uint8_t * const data = (const uint8_t * const)node;
+	/* an order that only differs by renumbered entries is the same */
+	if (a.order_len) {
+		mapped = calloc(a.order_len, sizeof(*mapped));
+		if (!mapped)
+			error(55, "Could not allocate memory");
+	}
+	for (size_t k = 0; k < a.order_len; k++) {
+		ssize_t i = find_diff_entry(&a, a.order[k]);
 
-		rc = efidp_next_node(node, &next);
-		if (rc < 0) {
-			warning("Could not iterate device path");
-			return;
+		mapped[k] = a.order[k];
+		if (i >= 0 && a.entries[i].match >= 0)
+			mapped[k] = b.entries[a.entries[i].match].num;
+	}
+	if ((!a.order) != (!b.order) || a.order_len != b.order_len ||
+	    (a.order_len && memcmp(mapped, b.order,
+				   a.order_len * sizeof(*mapped)))) {
+		if (a.order) {
+			printf("- ");
+			print_order(order_name, a.order, a.order_len);
 		}
-
-		sz = efidp_node_size(node);
-		if (sz <= 0) {
-			warning("Could not iterate device path");
-			return;
+		if (b.order) {
+			printf("+ ");
+			print_order(order_name, b.order, b.order_len);
 		}
+		differ = true;
+	}
+	free(mapped);
+
+	if (a.timeout != b.timeout) {
+		if (a.timeout >= 0)
+			printf("- Timeout: %u seconds\n", a.timeout);
+		if (b.timeout >= 0)
+			printf("+ Timeout: %u seconds\n", b.timeout);
+		differ = true;
+	}
+	if (a.bootnext != b.bootnext) {
+		if (a.bootnext >= 0)
+			printf("- BootNext: %04X\n", a.bootnext);
+		if (b.bootnext >= 0)
+			printf("+ BootNext: %04X\n", b.bootnext);
+		differ = true;
+	}
 
-		for (ssize_t j = 0; j < sz; j++)
-			printf("%02hhx%s", data[j], j == sz - 1 ? "" : " ");
-		printf("%s", rc == 0 ? "\n" : " / ");
+	free_diff_side(&a);
+	free_diff_side(&b);
+	return differ ? 1 : 0;
+}
 
-		node = next;
+/*
+ * Collect the names stream_vars() will list, giving the same warnings
+ * set_var_nums() would.  This happens before anything is printed, just
+ * like reading the whole table does.
+ */
+static var_name_set_t *
+open_var_name_set(const char *prefix)
+{
+	var_name_set_t *names;
+	int warn = 0;
+
+	names = calloc(1, sizeof(*names));
+	if (!names)
+		error(45, "Could not list %s variables", prefix);
+	if (read_var_name_set(prefix, names) < 0) {
+		free(names);
+		return NULL;
 	}
-	if (opts.verbose >= 1 && optional_data_len)
-		printf("    data: ");
-	for (unsigned int j = 0; opts.verbose >= 1 && j < optional_data_len; j++)
-		printf("%02hhx%s", optional_data[j], j == optional_data_len - 1 ? "\n" : " ");
+
+	for (size_t i = 0; i < names->n_odd; i++) {
+		var_entry_t entry = { .name = names->odd[i] };
+		warn += set_var_num(prefix, &entry);
+	}
+	if (warn)
+		warningx("** Warning ** : please recreate these using efibootmgr to remove this warning.");
+	return names;
 }
 
+/*
+ * List the entries without building entry_list: each variable is read,
+ * rendered and freed before we look at the next one, so memory use
+ * doesn't depend on how many entries there are.  Only used when nothing
+ * is being changed, since everything else needs the whole table.
+ */
 static void
-show_vars(const char *prefix)
+stream_vars(const char *prefix, var_name_set_t *names)
 {
-	list_t *pos;
-	var_entry_t *boot;
-	const unsigned char *description;
-	efi_load_option *load_option;
+	const char *name;
+	var_entry_t *order = NULL;
+	uint16_t *order_data = NULL;
+	size_t order_len = 0;
 
-	list_for_each(pos, &entry_list) {
-		boot = list_entry(pos, var_entry_t, list);
-		load_option = (efi_load_option *)boot->data;
-		description = efi_loadopt_desc(load_option, boot->data_size);
-		if (boot->name)
-			printf("%s", boot->name);
-		else
-			printf("%s%04X", prefix, boot->num);
+	if (!names)
+		return;
 
-		printf("%c ", (efi_loadopt_attrs(load_option)
-			       & LOAD_OPTION_ACTIVE) ? '*' : ' ');
-		printf("%s", description);
+	order = read_fields_order(prefix, &order_data, &order_len);
 
-		show_var_path(load_option, boot->data_size);
+	while ((name = var_name_set_next(names)) != NULL) {
+		var_entry_t entry = { .name = (char *)name };
+		const unsigned char *description = NULL;
+		int num = 0;
 
+		if (read_var(name, &entry) < 0)
+			continue;
+		if (parse_var_num(prefix, name, &num) == 1)
+			entry.num = num;
+
+		if (need_description())
+			description = efi_loadopt_desc(
+					(efi_load_option *)entry.data,
+					entry.data_size);
+		show_var(stdout, &dp_cache, &entry, description, prefix,
+			 order_data, order_len);
+		free(entry.data);
+
+		if (dp_cache.nused >= STREAM_DP_CACHE_MAX)
+			dp_text_cache_clear(&dp_cache);
 		fflush(stdout);
 	}
+
+	if (order) {
+		free(order->data);
+		free(order);
+	}
 }
 
 static void
@@ -1208,15 +3152,17 @@ update_entry_attr(var_entry_t *entry, uint64_t attr, bool set)
 	load_option = (efi_load_option *)entry->data;
 	attrs = efi_loadopt_attrs(load_option);
 
-	if ((set && (attrs & attr)) || (!set && !(attrs & attr)))
+	if ((set && (attrs & attr)) || (!set && !(attrs & attr))) {
+		store_skipped_write();
 		return 0;
+	}
 
 	if (set)
 		efi_loadopt_attr_set(load_option, attr);
 	else
 		efi_loadopt_attr_clear(load_option, attr);
 
-	rc = efi_set_variable(entry->guid, entry->name,
+	rc = store_set_variable(entry->guid, entry->name,
 			      entry->data, entry->data_size,
 			      entry->attributes, 0644);
 	if (rc < 0) {
@@ -1225,7 +3171,7 @@ update_entry_attr(var_entry_t *entry, uint64_t attr, bool set)
 
 		efi_guid_to_str(&entry->guid, &guid);
 		errno = err;
-		efi_error("efi_set_variable(%s,%s,...)",
+		efi_error("store_set_variable(%s,%s,...)",
 			  guid, entry->name);
 	}
 
@@ -1280,7 +3226,7 @@ get_mirror(int which, int *below4g, int *above4g, int *mirrorstatus)
 	else
 		name = ADDRESS_RANGE_MIRROR_VARIABLE_CURRENT;
 
-	rc = efi_get_variable(ADDRESS_RANGE_MIRROR_VARIABLE_GUID, name,
+	rc = store_get_variable(ADDRESS_RANGE_MIRROR_VARIABLE_GUID, name,
 				&data, &data_size, &attributes);
 	if (rc == 0) {
 		abm = (ADDRESS_RANGE_MIRROR_VARIABLE_DATA *)data;
@@ -1332,11 +3278,11 @@ set_mirror(int below4g, int above4g)
 	abm.mirror_amount_above_4gb = above4g;
 	abm.mirror_memory_below_4gb = below4g;
 	abm.mirror_status = 0;
-	rc = efi_set_variable(ADDRESS_RANGE_MIRROR_VARIABLE_GUID,
+	rc = store_set_variable(ADDRESS_RANGE_MIRROR_VARIABLE_GUID,
 			      ADDRESS_RANGE_MIRROR_VARIABLE_REQUEST, data,
 			      data_size, attributes, 0644);
 	if (rc < 0)
-		efi_error("efi_set_variable() failed");
+		efi_error("store_set_variable() failed");
 	return rc;
 }
 
@@ -1398,7 +3344,7 @@ list_supported_signature_types(void)
 	size_t n_entries;
 	unsigned int i;
 
-	rc = efi_get_variable(EFI_GLOBAL_GUID, "SignatureSupport",
+	rc = store_get_variable(EFI_GLOBAL_GUID, "SignatureSupport",
 			      &entry.data, &entry.data_size, &entry.attributes);
 	if (rc == ENOENT) {
 		warning("Firmware does not support any signature types");
@@ -1445,42 +3391,151 @@ list_supported_signature_types(void)
 	return 0;
 }
 
+static void
+parse_fields(char *arg)
+{
+	const struct {
+		const char *name;
+		int field;
+	} field_names[] = {
+		{"num", EFIBOOTMGR_FIELD_NUM},
+		{"active", EFIBOOTMGR_FIELD_ACTIVE},
+		{"label", EFIBOOTMGR_FIELD_LABEL},
+		{"path", EFIBOOTMGR_FIELD_PATH},
+		{"args", EFIBOOTMGR_FIELD_ARGS},
+		{"order-pos", EFIBOOTMGR_FIELD_ORDER_POS},
+		{NULL, 0}
+	};
+	char *saveptr = NULL;
+	char *name;
+
+	opts.n_fields = 0;
+	opts.field_mask = 0;
+	for (name = strtok_r(arg, ",", &saveptr); name != NULL;
+	     name = strtok_r(NULL, ",", &saveptr)) {
+		int i;
+
+		for (i = 0; field_names[i].name != NULL; i++)
+			if (!strcmp(name, field_names[i].name))
+				break;
+		if (field_names[i].name == NULL)
+			errorx(42, "invalid field \"%s\"", name);
+		if (opts.n_fields == EFIBOOTMGR_MAX_FIELDS)
+			errorx(42, "too many fields");
+
+		opts.fields[opts.n_fields++] = field_names[i].field;
+		opts.field_mask |= field_names[i].field;
+	}
+	if (opts.n_fields == 0)
+		errorx(42, "--fields requires at least one field");
+}
+
+static void
+parse_bench_sizes(char *arg)
+{
+	nvram_bench_t *bench = &opts.bench_nvram;
+	char *saveptr = NULL;
+	char *size;
+
+	bench->n_sizes = 0;
+	for (size = strtok_r(arg, ",", &saveptr); size != NULL;
+	     size = strtok_r(NULL, ",", &saveptr)) {
+		char *endptr = NULL;
+		unsigned long result;
+
+		errno = 0;
+		result = strtoul(size, &endptr, 0);
+		if (errno || *endptr != '\0' || result == 0 ||
+		    result > NVRAM_BENCH_MAX_DATA_SIZE)
+			errorx(56, "invalid size \"%s\" (1 to %d bytes)", size,
+			       NVRAM_BENCH_MAX_DATA_SIZE);
+		if (bench->n_sizes == NVRAM_BENCH_MAX_SIZES)
+			errorx(56, "too many sizes");
+		bench->sizes[bench->n_sizes++] = result;
+	}
+	if (bench->n_sizes == 0)
+		errorx(56, "--bench-sizes requires at least one size");
+}
+
+/*
+ * max keeps nvram_bench_writes() from wrapping around, so an absurd
+ * --bench-nvram can't slip under --bench-max-writes.
+ */
+static unsigned long
+parse_bench_count(const char *option, const char *arg, unsigned long max)
+{
+	char *endptr = NULL;
+	unsigned long result;
+
+	errno = 0;
+	result = strtoul(arg, &endptr, 0);
+	if (errno || *endptr != '\0' || result == 0 || result > max)
+		errorx(56, "invalid --%s count \"%s\"", option, arg);
+	return result;
+}
+
 static void
 usage()
 {
 	printf("efibootmgr version %s\n", EFIBOOTMGR_VERSION);
 	printf("usage: efibootmgr [options]\n");
 	printf("\t-a | --active         Set bootnum active.\n");
+	printf("\t     --abbrev mode    Device path form: hd (default), file, full, or auto for the smallest the firmware resolves.\n");
 	printf("\t-A | --inactive       Set bootnum inactive.\n");
 	printf("\t-b | --bootnum XXXX   Modify BootXXXX (hex).\n");
+	printf("\t     --bench-nvram N  Time N writes and N reads of a scratch variable of each --bench-sizes size.\n");
+	printf("\t     --bench-sizes s1,s2,.. Scratch variable sizes in bytes (default 32,1024,8192).\n");
+	printf("\t     --bench-max-writes N Refuse to write to the store more than N times (default %d).\n",
+	       NVRAM_BENCH_DEFAULT_MAX_WRITES);
 	printf("\t-B | --delete-bootnum Delete bootnum.\n");
 	printf("\t-c | --create         Create new variable bootnum and add to bootorder at index (-I).\n");
 	printf("\t-C | --create-only    Create new variable bootnum and do not add to bootorder.\n");
+	printf("\t     --create-from file Create the entries listed in file (label, loader, args, disk, part, position; tab separated).\n");
 	printf("\t-d | --disk disk      Disk containing boot loader (defaults to /dev/sda).\n");
+	printf("\t     --diff A B       Show how the entries and order in store B differ from A (\"live\" or a --store spec).\n");
 	printf("\t-D | --remove-dups    Remove duplicate values from BootOrder.\n");
 	printf("\t-e | --edd [1|3]      Force boot entries to be created using EDD 1.0 or 3.0 info.\n");
 	printf("\t-E | --edd-device num     EDD 1.0 device number (defaults to 0x80).\n");
+	printf("\t     --esp-mirror dev Create an entry on each member of mirrored ESP dev (md device, mount point or \"auto\").\n");
+	printf("\t     --export file    Save the boot entries, orders, BootNext, Timeout and mirror settings to file.\n");
 	printf("\t     --full-dev-path  Use a full device path.\n");
 	printf("\t     --file-dev-path  Use an abbreviated File() device path.\n");
 	printf("\t-f | --reconnect      Re-connect devices after driver is loaded.\n");
 	printf("\t-F | --no-reconnect   Do not re-connect devices after driver is loaded.\n");
+	printf("\t     --fields f1,f2,.. Only show these entry fields: num,active,label,path,args,order-pos.\n");
+	printf("\t     --fingerprint    Print a hash of the order, Timeout and all entries instead of listing them.\n");
 	printf("\t-g | --gpt            Force disk with invalid PMBR to be treated as GPT.\n");
 	printf("\t-i | --iface name     Create a netboot entry for the named interface.\n");
+	printf("\t     --image file.fd  Use and change the variables in an edk2 image such as OVMF_VARS.fd.\n");
+	printf("\t     --image-glob pattern  List the entries in every matching image as NDJSON (with -j).\n");
+	printf("\t     --ipv6[=origin]  Use IPv6 for a netboot entry; origin is stateless (default), stateful or static.\n");
+	printf("\t     --local-ip addr[/prefix], --remote-ip addr, --gateway-ip addr\n");
+	printf("\t                      Addresses for --ipv6=static.\n");
+	printf("\t     --iscsi          Create an entry for the loader on iSCSI disk -d, reached through -i.\n");
+	printf("\t     --import file    Restore the variables saved by --export, writing only what differs.\n");
+	printf("\t     --prune          With --import, also delete boot variables the snapshot doesn't have.\n");
 	printf("\t-I | --index number   When creating an entry, insert it in bootorder at specified position (default: 0).\n");
+	printf("\t-j | --jobs N         Render the entry list with N worker threads.\n");
 	printf("\t-l | --loader name     (Defaults to \""DEFAULT_LOADER"\").\n");
 	printf("\t-L | --label label     Boot manager display label (defaults to \"Linux\").\n");
 	printf("\t-m | --mirror-below-4G t|f Mirror memory below 4GB.\n");
 	printf("\t-M | --mirror-above-4G X Percentage memory to mirror above 4GB.\n");
+	printf("\t     --no-cache       Probe the disk even if its device path is in "EFIBOOTMGR_CACHE_DIR".\n");
+	printf("\t     --no-loader-check Create the entry even if the loader isn't on the ESP.\n");
 	printf("\t-n | --bootnext XXXX   Set BootNext to XXXX (hex).\n");
 	printf("\t-N | --delete-bootnext Delete BootNext.\n");
+	printf("\t     --nvmeof         Create an entry for the loader on NVMe-oF namespace -d, reached through -i.\n");
 	printf("\t-o | --bootorder XXXX,YYYY,ZZZZ,...     Explicitly set BootOrder (hex).\n");
 	printf("\t-O | --delete-bootorder Delete BootOrder.\n");
 	printf("\t-p | --part part        Partition containing loader (defaults to 1 on partitioned devices).\n");
 	printf("\t-q | --quiet            Be quiet.\n");
 	printf("\t-r | --driver           Operate on Driver variables, not Boot Variables.\n");
+	printf("\t     --stats[=json]     Print the time spent in each phase, store calls and peak RSS to stderr.\n");
+	printf("\t     --store STORE      Use variables in a directory (efivarfs format), mem[:DIR] or snapshot:FILE, not the firmware's.\n");
 	printf("\t-t | --timeout seconds  Set boot manager timeout waiting for user input.\n");
 	printf("\t-T | --delete-timeout   Delete Timeout.\n");
 	printf("\t-u | --unicode | --UCS-2  Handle extra args as UCS-2 (default is ASCII).\n");
+	printf("\t     --uri url        Create an HTTP boot entry for url (with -i).\n");
 	printf("\t-v | --verbose          Print additional information.\n");
 	printf("\t-V | --version          Return version and exit.\n");
 	printf("\t-y | --sysprep          Operate on SysPrep variables, not Boot Variables.\n");
@@ -1501,7 +3556,9 @@ set_default_opts()
 	opts.loader          = DEFAULT_LOADER;
 	opts.label           = (unsigned char *)"Linux";
 	opts.disk            = "/dev/sda";
+	opts.store           = getenv(EFIBOOTMGR_STORE_ENV);
 	opts.part            = -1;
+	opts.bench_nvram.max_writes = NVRAM_BENCH_DEFAULT_MAX_WRITES;
 }
 
 static void
@@ -1530,13 +3587,39 @@ parse_opts(int argc, char **argv)
 			{"edd",              required_argument, 0, 'e'},
 			{"edd30",            required_argument, 0, 'e'},
 			{"edd-device",       required_argument, 0, 'E'},
+			{"abbrev",           required_argument, 0, 0},
 			{"full-dev-path",          no_argument, 0, 0},
 			{"file-dev-path",          no_argument, 0, 0},
+			{"create-from",      required_argument, 0, 0},
+			{"esp-mirror",       required_argument, 0, 0},
+			{"fields",           required_argument, 0, 0},
+			{"gateway-ip",       required_argument, 0, 0},
+			{"ipv6",             optional_argument, 0, 0},
+			{"iscsi",                  no_argument, 0, 0},
+			{"nvmeof",                 no_argument, 0, 0},
+			{"local-ip",         required_argument, 0, 0},
+			{"remote-ip",        required_argument, 0, 0},
+			{"uri",              required_argument, 0, 0},
+			{"fingerprint",      no_argument, 0, 0},
+			{"no-cache",         no_argument, 0, 0},
+			{"no-loader-check",  no_argument, 0, 0},
+			{"store",            required_argument, 0, 0},
+			{"image",            required_argument, 0, 0},
+			{"image-glob",       required_argument, 0, 0},
+			{"diff",             required_argument, 0, 0},
+			{"export",           required_argument, 0, 0},
+			{"import",           required_argument, 0, 0},
+			{"prune",            no_argument, 0, 0},
+			{"bench-nvram",      required_argument, 0, 0},
+			{"bench-sizes",      required_argument, 0, 0},
+			{"bench-max-writes", required_argument, 0, 0},
+			{"stats",            optional_argument, 0, 0},
 			{"reconnect",              no_argument, 0, 'f'},
 			{"no-reconnect",           no_argument, 0, 'F'},
 			{"gpt",                    no_argument, 0, 'g'},
 			{"iface",            required_argument, 0, 'i'},
 			{"index",            required_argument, 0, 'I'},
+			{"jobs",             required_argument, 0, 'j'},
 			{"keep",                   no_argument, 0, 'k'},
 			{"loader",           required_argument, 0, 'l'},
 			{"label",            required_argument, 0, 'L'},
@@ -1563,7 +3646,7 @@ parse_opts(int argc, char **argv)
 		};
 
 		c = getopt_long(argc, argv,
-				"aAb:BcCd:De:E:fFgi:I:kl:L:m:M:n:No:Op:qrst:Tuv::Vwy@:h",
+				"aAb:BcCd:De:E:fFgi:I:j:kl:L:m:M:n:No:Op:qrst:Tuv::Vwy@:h",
 				long_options, &option_index);
 		if (c == -1)
 			break;
@@ -1662,8 +3745,10 @@ parse_opts(int argc, char **argv)
 
 		case 'i':
 			opts.iface = optarg;
-			opts.ip_version = EFIBOOTMGR_IPV4;
-			opts.ip_addr_origin = EFIBOOTMGR_IPV4_ORIGIN_DHCP;
+			if (opts.ip_version != EFIBOOTMGR_IPV6) {
+				opts.ip_version = EFIBOOTMGR_IPV4;
+				opts.ip_addr_origin = EFIBOOTMGR_IPV4_ORIGIN_DHCP;
+			}
 			break;
 		case 'I':
 			if (!optarg) {
@@ -1677,6 +3762,13 @@ parse_opts(int argc, char **argv)
 			}
 			opts.index = (uint16_t)lindex;
 			break;
+		case 'j':
+			rc = sscanf(optarg, "%u", &num);
+			if (rc != 1 || num < 1 || num > EFIBOOTMGR_MAX_JOBS)
+				errorx(44, "invalid number of jobs %s\n",
+				       optarg);
+			opts.jobs = num;
+			break;
 		case 'k':
 			opts.keep_old_entries = 1;
 			break;
@@ -1824,6 +3916,91 @@ parse_opts(int argc, char **argv)
 				    opts.abbreviate_path != EFIBOOTMGR_PATH_ABBREV_FILE)
 					errx(41, "contradicting --full-dev-path/--file-dev-path/-e options");
 				opts.abbreviate_path = EFIBOOTMGR_PATH_ABBREV_FILE;
+			} else if (!strcmp(long_options[option_index].name, "abbrev")) {
+				if (!strcmp(optarg, "auto"))
+					snum = EFIBOOTMGR_PATH_ABBREV_AUTO;
+				else if (!strcmp(optarg, "hd"))
+					snum = EFIBOOTMGR_PATH_ABBREV_HD;
+				else if (!strcmp(optarg, "file"))
+					snum = EFIBOOTMGR_PATH_ABBREV_FILE;
+				else if (!strcmp(optarg, "full"))
+					snum = EFIBOOTMGR_PATH_ABBREV_NONE;
+				else
+					errorx(31, "invalid --abbrev mode \"%s\"", optarg);
+				if (opts.abbreviate_path != EFIBOOTMGR_PATH_ABBREV_UNSPECIFIED &&
+				    opts.abbreviate_path != snum)
+					errx(41, "contradicting --abbrev/--full-dev-path/--file-dev-path/-e options");
+				opts.abbreviate_path = snum;
+			} else if (!strcmp(long_options[option_index].name, "create-from")) {
+				opts.create_from = optarg;
+			} else if (!strcmp(long_options[option_index].name, "esp-mirror")) {
+				opts.esp_mirror = optarg;
+			} else if (!strcmp(long_options[option_index].name, "fields")) {
+				parse_fields(optarg);
+			} else if (!strcmp(long_options[option_index].name, "uri")) {
+				opts.uri = optarg;
+			} else if (!strcmp(long_options[option_index].name, "ipv6")) {
+				opts.ip_version = EFIBOOTMGR_IPV6;
+				if (!optarg || !strcmp(optarg, "stateless"))
+					opts.ip_addr_origin = EFIBOOTMGR_IPV6_ORIGIN_STATELESS;
+				else if (!strcmp(optarg, "stateful"))
+					opts.ip_addr_origin = EFIBOOTMGR_IPV6_ORIGIN_STATEFUL;
+				else if (!strcmp(optarg, "static"))
+					opts.ip_addr_origin = EFIBOOTMGR_IPV6_ORIGIN_STATIC;
+				else
+					errorx(48, "invalid IPv6 address origin \"%s\"", optarg);
+			} else if (!strcmp(long_options[option_index].name, "iscsi")) {
+				if (opts.fabric == EFIBOOTMGR_FABRIC_NVMEOF)
+					errorx(49, "--iscsi and --nvmeof may not be used together.");
+				opts.fabric = EFIBOOTMGR_FABRIC_ISCSI;
+			} else if (!strcmp(long_options[option_index].name, "nvmeof")) {
+				if (opts.fabric == EFIBOOTMGR_FABRIC_ISCSI)
+					errorx(49, "--iscsi and --nvmeof may not be used together.");
+				opts.fabric = EFIBOOTMGR_FABRIC_NVMEOF;
+			} else if (!strcmp(long_options[option_index].name, "local-ip")) {
+				opts.local_ip_addr = optarg;
+			} else if (!strcmp(long_options[option_index].name, "remote-ip")) {
+				opts.remote_ip_addr = optarg;
+			} else if (!strcmp(long_options[option_index].name, "gateway-ip")) {
+				opts.gateway_ip_addr = optarg;
+			} else if (!strcmp(long_options[option_index].name, "fingerprint")) {
+				opts.fingerprint = 1;
+			} else if (!strcmp(long_options[option_index].name, "no-cache")) {
+				opts.no_cache = 1;
+			} else if (!strcmp(long_options[option_index].name, "no-loader-check")) {
+				opts.no_loader_check = 1;
+			} else if (!strcmp(long_options[option_index].name, "store")) {
+				opts.store = optarg;
+			} else if (!strcmp(long_options[option_index].name, "image")) {
+				opts.image = optarg;
+			} else if (!strcmp(long_options[option_index].name, "image-glob")) {
+				opts.image_glob = optarg;
+			} else if (!strcmp(long_options[option_index].name, "diff")) {
+				opts.diff_from = optarg;
+			} else if (!strcmp(long_options[option_index].name, "export")) {
+				opts.export_file = optarg;
+			} else if (!strcmp(long_options[option_index].name, "import")) {
+				opts.import_file = optarg;
+			} else if (!strcmp(long_options[option_index].name, "prune")) {
+				opts.import_prune = 1;
+			} else if (!strcmp(long_options[option_index].name, "bench-nvram")) {
+				opts.bench_nvram.count =
+					parse_bench_count("bench-nvram", optarg,
+							  (ULONG_MAX - 1) / NVRAM_BENCH_MAX_SIZES);
+			} else if (!strcmp(long_options[option_index].name, "bench-sizes")) {
+				parse_bench_sizes(optarg);
+			} else if (!strcmp(long_options[option_index].name, "bench-max-writes")) {
+				opts.bench_nvram.max_writes =
+					parse_bench_count("bench-max-writes", optarg,
+							  ULONG_MAX);
+			} else if (!strcmp(long_options[option_index].name, "stats")) {
+				opts.stats = 1;
+				if (!optarg || !strcmp(optarg, "text"))
+					opts.stats_json = 0;
+				else if (!strcmp(optarg, "json"))
+					opts.stats_json = 1;
+				else
+					errorx(57, "invalid --stats format \"%s\"", optarg);
 			} else {
 				usage();
 				exit(1);
@@ -1831,6 +4008,13 @@ parse_opts(int argc, char **argv)
 		}
 	}
 
+	/* getopt moves the operands to the end, so B is the first one */
+	if (opts.diff_from) {
+		if (optind >= argc)
+			errorx(55, "--diff needs two stores to compare.");
+		opts.diff_to = argv[optind++];
+	}
+
 	if (optind < argc) {
 		opts.argc = argc;
 		opts.argv = argv;
@@ -1838,6 +4022,31 @@ parse_opts(int argc, char **argv)
 	}
 }
 
+/*
+ * Are we only listing?  If nothing is going to be changed we don't need
+ * the whole entry table, and can use stream_vars() instead.  -j needs
+ * the table to split it up, and --fingerprint hashes straight from it.
+ */
+static bool
+changes_nothing(void)
+{
+	return !opts.delete && opts.active < 0 && opts.reconnect < 0 &&
+	       !opts.create && !opts.create_from && !opts.esp_mirror &&
+	       !opts.index &&
+	       !opts.delete_order &&
+	       !opts.order && !opts.deduplicate && !opts.delete_bootnext &&
+	       !opts.delete_timeout && opts.bootnext < 0 &&
+	       !opts.set_timeout && !opts.set_mirror_lo &&
+	       !opts.set_mirror_hi && !opts.import_file;
+}
+
+static bool
+list_only(void)
+{
+	return changes_nothing() && !opts.fingerprint && opts.jobs <= 1 &&
+	       !opts.bench_nvram.count;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -1845,6 +4054,8 @@ main(int argc, char **argv)
 	var_entry_t *new_entry = NULL;
 	int num;
 	int ret = 0;
+	bool streaming;
+	var_name_set_t *name_set = NULL;
 	ebm_mode mode = boot;
 	char *prefices[] = {
 		"Boot",
@@ -1865,6 +4076,23 @@ main(int argc, char **argv)
 	}
 
 	verbose = opts.verbose;
+	if (opts.stats)
+		stats_start(opts.stats_json);
+
+	if (opts.diff_from) {
+		if (opts.image || opts.image_glob)
+			errorx(55, "--diff may not be used with --image or --image-glob.");
+	} else if (opts.image_glob) {
+		if (opts.image)
+			errorx(53, "--image and --image-glob may not be used together.");
+	} else if (opts.image) {
+		if (store_open_image(opts.image, !changes_nothing() ||
+					      opts.bench_nvram.count) < 0)
+			error(52, "Could not open variable store image \"%s\"",
+			      opts.image);
+	} else if (store_open(opts.store) < 0) {
+		error(52, "Could not open variable store \"%s\"", opts.store);
+	}
 
 	if (opts.list_supported_signature_types) {
 		int rc = list_supported_signature_types();
@@ -1892,16 +4120,136 @@ main(int argc, char **argv)
 			mode = driver;
 	}
 
+	if (opts.create_from) {
+		if (opts.create && !opts.no_order)
+			errorx(46, "--create-from and -c may not be used together.");
+		if (opts.iface)
+			errorx(46, "--create-from does not support network entries.");
+		if (opts.extra_opts_file || opts.argc)
+			errorx(46, "--create-from takes optional data from the manifest.");
+	}
+
+	if (opts.esp_mirror) {
+		if (opts.create_from)
+			errorx(47, "--esp-mirror and --create-from may not be used together.");
+		if (opts.create && !opts.no_order)
+			errorx(47, "--esp-mirror and -c may not be used together.");
+		if (opts.iface)
+			errorx(47, "--esp-mirror does not support network entries.");
+	}
+
+	if ((opts.uri || opts.ip_version == EFIBOOTMGR_IPV6) && !opts.iface)
+		errorx(48, "--uri and --ipv6 need a network interface (see the -i option)");
+	if ((opts.local_ip_addr || opts.remote_ip_addr ||
+	     opts.gateway_ip_addr) &&
+	    (opts.ip_version != EFIBOOTMGR_IPV6 ||
+	     opts.ip_addr_origin != EFIBOOTMGR_IPV6_ORIGIN_STATIC))
+		errorx(48, "IP addresses can only be given with --ipv6=static");
+	if (opts.ip_version == EFIBOOTMGR_IPV6 &&
+	    opts.ip_addr_origin == EFIBOOTMGR_IPV6_ORIGIN_STATIC &&
+	    !opts.local_ip_addr)
+		errorx(48, "--ipv6=static needs --local-ip");
+
+	if (opts.fabric) {
+		if (!opts.iface)
+			errorx(49, "--iscsi and --nvmeof need a network interface (see the -i option)");
+		if (opts.uri)
+			errorx(49, "--uri may not be used with --iscsi or --nvmeof.");
+	}
+
 	if (opts.reconnect > 0 && !opts.driver)
 		errorx(30, "--reconnect is supported only for driver entries.");
 
-	if (!efi_variables_supported())
+	if (opts.export_file && opts.import_file)
+		errorx(54, "--export and --import may not be used together.");
+	if (opts.import_prune && !opts.import_file)
+		errorx(54, "--prune needs --import.");
+
+	if (opts.bench_nvram.count) {
+		nvram_bench_t *bench = &opts.bench_nvram;
+
+		if (!changes_nothing() || opts.export_file || opts.diff_from ||
+		    opts.image_glob)
+			errorx(56, "--bench-nvram may not be used with other operations.");
+		if (bench->n_sizes == 0) {
+			bench->sizes[bench->n_sizes++] = 32;
+			bench->sizes[bench->n_sizes++] = 1024;
+			bench->sizes[bench->n_sizes++] = 8192;
+		}
+		if (nvram_bench_writes(bench) > bench->max_writes)
+			errorx(56, "--bench-nvram would write %lu times, more than --bench-max-writes allows (%lu).",
+			       nvram_bench_writes(bench), bench->max_writes);
+	}
+
+	if (opts.diff_from) {
+		if (!changes_nothing() || opts.export_file)
+			errorx(55, "--diff can only compare entries.");
+		return show_diff(prefices[mode], order_name[mode]);
+	}
+
+	if (opts.image_glob) {
+		if (!changes_nothing())
+			errorx(53, "--image-glob can only list entries.");
+		return show_images(opts.image_glob, prefices[mode],
+				   order_name[mode]) ? 53 : 0;
+	}
+
+	if (!store_variables_supported())
 		errorx(2, "EFI variables are not supported on this system.");
 
+	if (opts.bench_nvram.count) {
+		if (nvram_bench(&opts.bench_nvram) < 0)
+			error(56, "Could not benchmark variable store \"%s\"",
+			      store_name());
+		return 0;
+	}
+
+	if (opts.export_file) {
+		ssize_t n = snapshot_export(opts.export_file);
+
+		if (n < 0)
+			error(54, "Could not export variables to \"%s\"",
+			      opts.export_file);
+		if (opts.verbose >= 1)
+			printf("Exported %zd variables to %s\n", n,
+			       opts.export_file);
+	}
+
+	if (opts.import_file) {
+		snapshot_t *snap;
+		size_t written, deleted;
+
+		if (snapshot_open(opts.import_file, &snap) < 0)
+			error(54, "Could not open snapshot \"%s\"",
+			      opts.import_file);
+		ret = snapshot_import(snap, opts.import_prune, &written,
+				      &deleted);
+		snapshot_close(snap);
+		if (ret < 0)
+			error(54, "Could not import variables from \"%s\"",
+			      opts.import_file);
+		if (opts.verbose >= 1)
+			printf("Restored %zu variables and deleted %zu\n",
+			       written, deleted);
+	}
+
+	streaming = list_only();
+	stats_phase(STATS_ENUMERATE);
+	if (streaming) {
+		name_set = open_var_name_set(prefices[mode]);
+	} else {
+		read_var_names(prefices[mode], &names);
+		stats_phase(STATS_READ_VARS);
+		read_vars(names, &entry_list);
+		stats_phase(STATS_SET_VAR_NUMS);
+		set_var_nums(prefices[mode], &entry_list);
+		if (opts.abbreviate_path == EFIBOOTMGR_PATH_ABBREV_AUTO) {
+			stats_phase(STATS_RENDER);
+			check_file_paths(&entry_list);
+		}
+	}
 
-	read_var_names(prefices[mode], &names);
-	read_vars(names, &entry_list);
-	set_var_nums(prefices[mode], &entry_list);
+	stats_phase(STATS_MUTATE);
 
 	if (opts.delete) {
 		if (opts.num == -1 && opts.explicit_label == 0) {
@@ -1946,7 +4294,19 @@ main(int argc, char **argv)
 		}
 	}
 
-	if (opts.create) {
+	if (opts.create_from) {
+		ret = create_from_manifest(prefices[mode], order_name[mode],
+					   opts.create_from);
+		if (ret < 0)
+			error(5, "Could not create %s variables",
+			      prefices[mode]);
+	} else if (opts.esp_mirror) {
+		ret = create_esp_mirror(prefices[mode], order_name[mode],
+					opts.esp_mirror);
+		if (ret < 0)
+			error(5, "Could not create %s variables",
+			      prefices[mode]);
+	} else if (opts.create) {
 		warn_duplicate_name(&entry_list);
 		new_entry = make_var(prefices[mode], &entry_list);
 		if (!new_entry)
@@ -1966,7 +4326,7 @@ main(int argc, char **argv)
 	}
 
 	if (opts.delete_order) {
-		ret = efi_del_variable(EFI_GLOBAL_GUID, order_name[mode]);
+		ret = store_del_variable(EFI_GLOBAL_GUID, order_name[mode]);
 		if (ret < 0 && errno != ENOENT)
 			error(7, "Could not remove entry from %s",
 			      order_name[mode]);
@@ -1987,13 +4347,13 @@ main(int argc, char **argv)
 	}
 
 	if (opts.delete_bootnext) {
-		ret = efi_del_variable(EFI_GLOBAL_GUID, "BootNext");
+		ret = store_del_variable(EFI_GLOBAL_GUID, "BootNext");
 		if (ret < 0)
 			error(10, "Could not delete BootNext");
 	}
 
 	if (opts.delete_timeout) {
-		ret = efi_del_variable(EFI_GLOBAL_GUID, "Timeout");
+		ret = store_del_variable(EFI_GLOBAL_GUID, "Timeout");
 		if (ret < 0)
 			error(11, "Could not delete Timeout");
 	}
@@ -2017,7 +4377,10 @@ main(int argc, char **argv)
 		ret=set_mirror(opts.below4g, opts.above4g);
 	}
 
-	if (!opts.quiet && ret == 0) {
+	stats_phase(STATS_RENDER);
+	if (!opts.quiet && ret == 0 && opts.fingerprint) {
+		show_fingerprint(prefices[mode], order_name[mode]);
+	} else if (!opts.quiet && ret == 0) {
 		switch (mode) {
 		case boot:
 			num = read_u16("BootNext");
@@ -2036,18 +4399,29 @@ main(int argc, char **argv)
 			if (num >= 0)
 				printf("Timeout: %u seconds\n", num);
 			show_order(order_name[mode]);
-			show_vars(prefices[mode]);
+			if (streaming)
+				stream_vars(prefices[mode], name_set);
+			else
+				show_vars(prefices[mode]);
 			show_mirror();
 			break;
 		case driver:
 		case sysprep:
 			show_order(order_name[mode]);
-			show_vars(prefices[mode]);
+			if (streaming)
+				stream_vars(prefices[mode], name_set);
+			else
+				show_vars(prefices[mode]);
 			break;
 		}
 	}
 	free_vars(&entry_list);
 	free_array(names);
+	if (name_set) {
+		free_var_name_set(name_set);
+		free(name_set);
+	}
+	dp_text_cache_free(&dp_cache);
 	if (ret)
 		return 1;
 	return 0;
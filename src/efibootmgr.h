@@ -20,6 +20,8 @@
 
 #pragma once
 
+#include "nvram_bench.h"
+
 #define EFIBOOTMGR_IPV4 0
 #define EFIBOOTMGR_IPV6 1
 
@@ -29,11 +31,26 @@
 #define EFIBOOTMGR_IPV6_ORIGIN_STATELESS	1
 #define EFIBOOTMGR_IPV6_ORIGIN_STATEFUL		2
 
+#define EFIBOOTMGR_FABRIC_NONE		0
+#define EFIBOOTMGR_FABRIC_ISCSI		1
+#define EFIBOOTMGR_FABRIC_NVMEOF	2
+
 #define EFIBOOTMGR_PATH_ABBREV_UNSPECIFIED	0
 #define EFIBOOTMGR_PATH_ABBREV_EDD10		1
 #define EFIBOOTMGR_PATH_ABBREV_HD		2
 #define EFIBOOTMGR_PATH_ABBREV_NONE		3
 #define EFIBOOTMGR_PATH_ABBREV_FILE		4
+#define EFIBOOTMGR_PATH_ABBREV_AUTO		5
+
+#define EFIBOOTMGR_FIELD_NUM		0x01
+#define EFIBOOTMGR_FIELD_ACTIVE		0x02
+#define EFIBOOTMGR_FIELD_LABEL		0x04
+#define EFIBOOTMGR_FIELD_PATH		0x08
+#define EFIBOOTMGR_FIELD_ARGS		0x10
+#define EFIBOOTMGR_FIELD_ORDER_POS	0x20
+#define EFIBOOTMGR_MAX_FIELDS		16
+
+#define EFIBOOTMGR_MAX_JOBS		64
 
 typedef enum {
 	boot,
@@ -54,6 +71,8 @@ typedef struct {
 	char *remote_ip_addr;
 	char *gateway_ip_addr;
 	char *ip_netmask;
+	char *uri;
+	int fabric;
 	uint16_t ip_local_port;
 	uint16_t ip_remote_port;
 	uint16_t ip_protocol;
@@ -65,6 +84,15 @@ typedef struct {
 	int keep_old_entries;
 	char *testfile;
 	char *extra_opts_file;
+	char *create_from;
+	char *esp_mirror;
+	char *store;
+	char *image;
+	char *image_glob;
+	char *diff_from;
+	char *diff_to;
+	char *export_file;
+	char *import_file;
 	uint32_t part;
 	int abbreviate_path;
 	uint32_t edd10_devicenum;
@@ -93,8 +121,20 @@ typedef struct {
 	unsigned int sysprep:1;
 	unsigned int explicit_label:1;
 	unsigned int list_supported_signature_types:1;
+	unsigned int fingerprint:1;
+	unsigned int no_cache:1;
+	unsigned int file_paths_resolve:1;
+	unsigned int no_loader_check:1;
+	unsigned int stats:1;
+	unsigned int stats_json:1;
+	unsigned int import_prune:1;
 	short int timeout;
 	uint16_t index;
+	int fields[EFIBOOTMGR_MAX_FIELDS];
+	int n_fields;
+	int field_mask;
+	int jobs;
+	nvram_bench_t bench_nvram;
 } efibootmgr_opt_t;
 
 extern efibootmgr_opt_t opts;
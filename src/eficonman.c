@@ -21,6 +21,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "dp_render.h"
+
 #define  _(String) gettext (String)
 #define Q_(String) dgettext (NULL, String)
 #define C_(Context,String) dgettext (Context,String)
@@ -43,6 +45,8 @@
 static int
 do_list(void)
 {
+	dp_text_cache_t dp_cache = DP_TEXT_CACHE_INIT;
+
 	struct {
 		char *varname;
 		char *label;
@@ -76,8 +80,8 @@ do_list(void)
 		}
 		dp = whole_dp;
 		while (dp) {
-			ssize_t sz, ssz;
-			unsigned char *s = NULL;
+			ssize_t sz;
+			const char *s;
 
 			if (efidp_is_multiinstance(dp)) {
 				sz = efidp_instance_size(dp);
@@ -89,15 +93,9 @@ do_list(void)
 					err(1, "efidp_size()");
 			}
 
-			ssz = efidp_format_device_path(NULL, 0, dp, sz);
-			if (ssz < 0)
-				err(1, "efidp_format_device_path()");
-
-			s = alloca(ssz + 1);
-			ssz = efidp_format_device_path(s, ssz, dp, sz);
-			if (ssz < 0)
+			s = dp_render(&dp_cache, dp, sz);
+			if (!s)
 				err(1, "efidp_format_device_path()");
-			s[ssz] = '\0';
 			printf("\t%s\n", s);
 
 			if (!efidp_is_multiinstance(dp))
@@ -112,6 +110,7 @@ do_list(void)
 				break;
 		}
 	}
+	dp_text_cache_free(&dp_cache);
 	return 0;
 }
 
@@ -24,7 +24,7 @@ extern int verbose;
 
 static inline void
 __attribute__((__unused__))
-error_reporter(void)
+ferror_reporter(FILE *out)
 {
 	int rc = 1;
 	int saved_errno = errno;
@@ -44,12 +44,19 @@ error_reporter(void)
 		}
                 if (rc == 0)
                         break;
-                fprintf(stderr, " %s:%d %s(): %s: %s\n",
+                fprintf(out, " %s:%d %s(): %s: %s\n",
 			filename, line, function, message, strerror(error));
         }
 	errno = saved_errno;
 }
 
+static inline void
+__attribute__((__unused__))
+error_reporter(void)
+{
+	ferror_reporter(stderr);
+}
+
 static inline void
 __attribute__((__unused__))
 conditional_error_reporter(int show, int clear)
@@ -151,6 +158,27 @@ warning(const char *fmt, ...)
 	va_end(ap);
 }
 
+static inline void
+__attribute__((__unused__))
+fwarning(FILE *out, const char *fmt, ...)
+{
+	int saved_errno = errno;
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(out, fmt, ap);
+	errno = saved_errno;
+	fprintf(out, ": %m\n");
+	/* the trace goes with the message, so -j keeps them together */
+	if (verbose >= 1) {
+		fprintf(out, "error trace:\n");
+		ferror_reporter(out);
+	}
+	efi_error_clear();
+	errno = saved_errno;
+	va_end(ap);
+}
+
 static inline void
 __attribute__((__unused__))
 warningx(const char *fmt, ...)
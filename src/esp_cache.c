@@ -0,0 +1,287 @@
+/*
+ * esp_cache.c - remember ESP device paths between runs
+ *
+ * See "COPYING" for license terms.
+ */
+
+#include "fix_coverity.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <efivar.h>
+
+#include "esp_cache.h"
+#include "hash.h"
+#include "sysfs.h"
+
+#define ESP_CACHE_MAGIC		"EBMESPC1"
+#define ESP_CACHE_MAX_DP	4096
+#define ESP_CACHE_PATH_MAX	(sizeof(EFIBOOTMGR_CACHE_DIR) + 32)
+
+struct esp_cache_key {
+	uint64_t	rdev;
+	uint64_t	diskseq;
+	int64_t		mtime_sec;
+	int64_t		mtime_nsec;
+	uint32_t	part;
+	uint32_t	options;
+	uint32_t	edd10_devicenum;
+	char		partuuid[40];
+};
+
+struct esp_cache_header {
+	char		magic[8];
+	uint32_t	key_size;
+	uint32_t	dp_size;
+};
+
+static int
+find_partuuid(dev_t partdev, char *uuid, size_t size)
+{
+	DIR *dir;
+	struct dirent *de;
+	struct stat sb;
+	int rc = -1;
+
+	dir = opendir("/dev/disk/by-partuuid");
+	if (!dir)
+		return -1;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.' || strlen(de->d_name) >= size)
+			continue;
+		if (fstatat(dirfd(dir), de->d_name, &sb, 0) < 0 ||
+		    !S_ISBLK(sb.st_mode) || sb.st_rdev != partdev)
+			continue;
+		strcpy(uuid, de->d_name);
+		rc = 0;
+		break;
+	}
+	closedir(dir);
+	return rc;
+}
+
+static int
+make_key(const char *disk, int part, uint32_t options,
+	 uint32_t edd10_devicenum, struct esp_cache_key *key)
+{
+	struct stat sb;
+	char sysdir[SYSDIR_MAX];
+	char buf[64];
+	dev_t partdev;
+
+	if (!disk || part < 1)
+		return -1;
+	if (stat(disk, &sb) < 0 || !S_ISBLK(sb.st_mode))
+		return -1;
+
+	memset(key, 0, sizeof(*key));
+	key->rdev = sb.st_rdev;
+	key->part = part;
+	key->options = options;
+	key->edd10_devicenum = edd10_devicenum;
+
+	sysfs_block_dir(sb.st_rdev, sysdir);
+	if (stat(sysdir, &sb) < 0)
+		return -1;
+	key->mtime_sec = sb.st_mtim.tv_sec;
+	key->mtime_nsec = sb.st_mtim.tv_nsec;
+
+	/* not every kernel has this, but it changes on media change */
+	if (sysfs_read_line(buf, sizeof(buf), "%s/diskseq", sysdir) == 0)
+		key->diskseq = strtoull(buf, NULL, 10);
+
+	/* no PARTUUID means we can't tell if it was repartitioned */
+	if (sysfs_find_partition(sysdir, part, &partdev) < 0 ||
+	    find_partuuid(partdev, key->partuuid, sizeof(key->partuuid)) < 0)
+		return -1;
+	return 0;
+}
+
+static void
+cache_path(const struct esp_cache_key *key, char *path, size_t size)
+{
+	snprintf(path, size, "%s/esp-%016"PRIx64, EFIBOOTMGR_CACHE_DIR,
+		 fnv1a64(key, sizeof(*key), FNV1A64_INIT));
+}
+
+/*
+ * Returns the offset of the File() node that ends dp, or -1 if dp isn't
+ * a well formed path ending in File()/End.  With file_required false,
+ * dp must be entirely well formed nodes without an End, and its size is
+ * returned.
+ */
+static ssize_t
+find_file_node(const uint8_t *dp, ssize_t size, bool file_required)
+{
+	ssize_t off = 0, file = -1;
+
+	while (size - off >= (ssize_t)sizeof(efidp_header)) {
+		efidp_header hdr;
+
+		memcpy(&hdr, dp + off, sizeof(hdr));
+		if (hdr.length < sizeof(hdr) || hdr.length > size - off)
+			return -1;
+		if (hdr.type == EFIDP_END_TYPE) {
+			if (!file_required ||
+			    hdr.subtype != EFIDP_END_ENTIRE ||
+			    off + hdr.length != size)
+				return -1;
+			return file;
+		}
+		if (hdr.type == EFIDP_MEDIA_TYPE &&
+		    hdr.subtype == EFIDP_MEDIA_FILE)
+			file = off;
+		else
+			file = -1;
+		off += hdr.length;
+	}
+	if (file_required || off != size)
+		return -1;
+	return size;
+}
+
+ssize_t
+esp_dp_prefix_size(const_efidp dp, ssize_t size)
+{
+	return find_file_node((const uint8_t *)dp, size, true);
+}
+
+ssize_t
+esp_dp_add_file(const uint8_t *prefix, size_t prefix_size,
+		const char *loader, efidp *dp_out)
+{
+	char *filepath;
+	uint8_t *dp = NULL;
+	ssize_t file_size, size = -1;
+
+	/* the same thing efi_generate_file_device_path_from_esp() does */
+	filepath = strdup(loader);
+	if (!filepath)
+		return -1;
+	for (char *c = filepath; *c; c++)
+		if (*c == '/')
+			*c = '\\';
+
+	file_size = efidp_make_file(NULL, 0, filepath);
+	if (file_size < 0)
+		goto out;
+	dp = malloc(prefix_size + file_size + sizeof(efidp_header));
+	if (!dp)
+		goto out;
+	memcpy(dp, prefix, prefix_size);
+	if (efidp_make_file(dp + prefix_size, file_size, filepath) < 0 ||
+	    efidp_make_end_entire(dp + prefix_size + file_size,
+				  sizeof(efidp_header)) < 0) {
+		free(dp);
+		goto out;
+	}
+	*dp_out = (efidp)dp;
+	size = prefix_size + file_size + sizeof(efidp_header);
+out:
+	free(filepath);
+	return size;
+}
+
+static ssize_t
+read_all(int fd, void *buf, size_t size)
+{
+	size_t pos = 0;
+
+	while (pos < size) {
+		ssize_t rc = read(fd, (uint8_t *)buf + pos, size - pos);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			return -1;
+		pos += rc;
+	}
+	return pos;
+}
+
+ssize_t
+esp_cache_lookup(const char *disk, int part, const char *loader,
+		 uint32_t options, uint32_t edd10_devicenum, efidp *dp_out)
+{
+	struct esp_cache_key key, file_key;
+	struct esp_cache_header hdr;
+	char path[ESP_CACHE_PATH_MAX];
+	uint8_t *prefix = NULL;
+	ssize_t size = -1;
+	int fd;
+
+	if (make_key(disk, part, options, edd10_devicenum, &key) < 0)
+		return -1;
+	cache_path(&key, path, sizeof(path));
+
+	fd = open(path, O_RDONLY|O_CLOEXEC|O_NOFOLLOW);
+	if (fd < 0)
+		return -1;
+	if (read_all(fd, &hdr, sizeof(hdr)) < 0 ||
+	    memcmp(hdr.magic, ESP_CACHE_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.key_size != sizeof(key) || hdr.dp_size > ESP_CACHE_MAX_DP ||
+	    read_all(fd, &file_key, sizeof(file_key)) < 0 ||
+	    memcmp(&file_key, &key, sizeof(key)))
+		goto out;
+
+	prefix = malloc(hdr.dp_size ? hdr.dp_size : 1);
+	if (!prefix || read_all(fd, prefix, hdr.dp_size) < 0 ||
+	    find_file_node(prefix, hdr.dp_size, false) < 0)
+		goto out;
+
+	size = esp_dp_add_file(prefix, hdr.dp_size, loader, dp_out);
+out:
+	free(prefix);
+	close(fd);
+	return size;
+}
+
+void
+esp_cache_store(const char *disk, int part, uint32_t options,
+		uint32_t edd10_devicenum, const_efidp dp, ssize_t size)
+{
+	struct esp_cache_key key;
+	struct esp_cache_header hdr;
+	char path[ESP_CACHE_PATH_MAX];
+	char tmp[ESP_CACHE_PATH_MAX + 8];
+	ssize_t prefix_size;
+	int saved_errno = errno;
+	int fd, rc;
+
+	prefix_size = esp_dp_prefix_size(dp, size);
+	if (prefix_size < 0 || prefix_size > ESP_CACHE_MAX_DP)
+		goto out;
+	if (make_key(disk, part, options, edd10_devicenum, &key) < 0)
+		goto out;
+	cache_path(&key, path, sizeof(path));
+
+	if (mkdir(EFIBOOTMGR_CACHE_DIR, 0700) < 0 && errno != EEXIST)
+		goto out;
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto out;
+
+	memcpy(hdr.magic, ESP_CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.key_size = sizeof(key);
+	hdr.dp_size = prefix_size;
+	rc = write_all(fd, &hdr, sizeof(hdr));
+	if (rc == 0)
+		rc = write_all(fd, &key, sizeof(key));
+	if (rc == 0)
+		rc = write_all(fd, dp, prefix_size);
+	if (close(fd) < 0)
+		rc = -1;
+	if (rc < 0 || rename(tmp, path) < 0)
+		unlink(tmp);
+out:
+	errno = saved_errno;
+}
@@ -0,0 +1,53 @@
+/*
+ * esp_cache.h - remember ESP device paths between runs
+ *
+ * See "COPYING" for license terms.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <efivar.h>
+
+#ifndef EFIBOOTMGR_CACHE_DIR
+#define EFIBOOTMGR_CACHE_DIR "/run/efibootmgr"
+#endif
+
+/*
+ * Look up the device path efi_generate_file_device_path_from_esp() would
+ * give us for these arguments.  The cached part is everything before the
+ * File() node, so one entry serves any loader on that partition.
+ *
+ * Entries are keyed by the disk's dev_t, the partition's PARTUUID, the
+ * disk's diskseq and sysfs mtime, and the abbreviation options, so a
+ * repartitioned, replaced or re-enumerated disk misses.
+ *
+ * Returns the size of the path stored in *dp (which the caller frees), or
+ * -1 on a miss.
+ */
+extern ssize_t esp_cache_lookup(const char *disk, int part,
+				const char *loader, uint32_t options,
+				uint32_t edd10_devicenum, efidp *dp);
+
+/*
+ * Store a freshly generated path.  Failures are silently ignored; the
+ * cache is only ever an optimization.
+ */
+extern void esp_cache_store(const char *disk, int part, uint32_t options,
+			    uint32_t edd10_devicenum, const_efidp dp,
+			    ssize_t size);
+
+/*
+ * Returns the size of dp up to the File() node that ends it, or -1 if it
+ * doesn't end in File() and End.
+ */
+extern ssize_t esp_dp_prefix_size(const_efidp dp, ssize_t size);
+
+/*
+ * Build a path from the first prefix_size bytes of an ESP device path
+ * and a new loader.  Returns its size; the caller frees *dp.
+ */
+extern ssize_t esp_dp_add_file(const uint8_t *prefix, size_t prefix_size,
+			       const char *loader, efidp *dp);
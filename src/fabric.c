@@ -0,0 +1,365 @@
+/*
+ * fabric.c - iSCSI() and NVMe-oF device path nodes from sysfs
+ *
+ * See "COPYING" for license terms.
+ */
+
+#include "fix_coverity.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include <efivar.h>
+
+#include "efibootmgr.h"
+#include "fabric.h"
+#include "sysfs.h"
+
+#ifndef EFIDP_MSG_NVMEOF
+#define EFIDP_MSG_NVMEOF	0x22
+#endif
+
+/* iSCSI() node, UEFI Spec 2.10 section 10.3.5.21 */
+typedef struct {
+	efidp_header	header;
+	uint16_t	protocol;
+	uint16_t	options;
+	uint8_t		lun[8];
+	uint16_t	tpgt;
+	/* followed by the target name, not NUL terminated */
+} __attribute__((packed)) iscsi_node_t;
+
+#define ISCSI_HEADER_DIGEST_CRC32C	0x0002
+#define ISCSI_DATA_DIGEST_CRC32C	0x0008
+#define ISCSI_AUTH_NONE			0x0800
+#define ISCSI_CHAP_UNI			0x1000
+
+/* NVMe-oF namespace node, UEFI Spec 2.10 section 10.3.5.35 */
+typedef struct {
+	efidp_header	header;
+	uint8_t		nidt;
+	uint8_t		nid[16];
+	/* followed by the subsystem NQN, NUL terminated */
+} __attribute__((packed)) nvmeof_node_t;
+
+#define NVME_NIDT_EUI64		1
+#define NVME_NIDT_NGUID		2
+#define NVME_NIDT_UUID		3
+
+/* the sysfs directory for a block device node */
+static int
+disk_sysfs_path(const char *disk, char path[PATH_MAX])
+{
+	char link[SYSDIR_MAX];
+	struct stat sb;
+
+	if (stat(disk, &sb) < 0)
+		return -1;
+	if (!S_ISBLK(sb.st_mode)) {
+		errno = ENOTBLK;
+		return -1;
+	}
+	sysfs_block_dir(sb.st_rdev, link);
+	if (!realpath(link, path))
+		return -1;
+	return 0;
+}
+
+/*
+ * Pull hex digits out of s, skipping the dashes and spaces sysfs uses to
+ * make them readable.
+ */
+static int
+parse_hex_id(const char *s, uint8_t *id, size_t size)
+{
+	size_t n = 0;
+	int hi = -1;
+
+	for (; *s; s++) {
+		int v;
+
+		if (*s == '-' || *s == ' ')
+			continue;
+		if (!isxdigit((unsigned char)*s) || n == size)
+			return -1;
+		v = isdigit((unsigned char)*s) ? *s - '0'
+					       : tolower((unsigned char)*s) - 'a' + 10;
+		if (hi < 0) {
+			hi = v;
+		} else {
+			id[n++] = hi << 4 | v;
+			hi = -1;
+		}
+	}
+	return hi < 0 && n == size ? 0 : -1;
+}
+
+static void
+copy_addr(char addr[INET6_ADDRSTRLEN], const char *s)
+{
+	if (strlen(s) < INET6_ADDRSTRLEN)
+		strcpy(addr, s);
+}
+
+/*
+ * The portal the session first logged in to; the current address can be
+ * one the target redirected us to, which the firmware can't know about.
+ */
+static void
+read_iscsi_portal(const char *session, unsigned int host,
+		  fabric_portal_t *portal)
+{
+	char buf[64];
+
+	if (sysfs_read_line(buf, sizeof(buf),
+			    "/sys/class/iscsi_connection/connection%s:0/persistent_address",
+			    session + 7) == 0)
+		copy_addr(portal->remote_addr, buf);
+	if (sysfs_read_line(buf, sizeof(buf),
+			    "/sys/class/iscsi_connection/connection%s:0/persistent_port",
+			    session + 7) == 0)
+		portal->remote_port = strtoul(buf, NULL, 10);
+	if (sysfs_read_line(buf, sizeof(buf),
+			    "/sys/class/iscsi_host/host%u/ipaddress", host) == 0)
+		copy_addr(portal->local_addr, buf);
+}
+
+static ssize_t
+make_iscsi_node(const char *sysdir, uint8_t **node_out,
+		fabric_portal_t *portal)
+{
+	char devpath[PATH_MAX], session[32], buf[256];
+	char target[224];
+	unsigned int host, channel, id;
+	unsigned long long lun;
+	iscsi_node_t *node;
+	char *p, *last, *saveptr = NULL;
+	size_t name_len;
+	ssize_t size;
+
+	/* .../hostN/sessionM/targetN:0:0/N:0:0:LUN/block/sdX */
+	snprintf(buf, sizeof(buf), "%.200s/device", sysdir);
+	if (!realpath(buf, devpath))
+		return -1;
+	last = strrchr(devpath, '/');
+	if (!last || sscanf(last + 1, "%u:%u:%u:%llu", &host, &channel, &id,
+			    &lun) != 4)
+		goto not_iscsi;
+
+	session[0] = '\0';
+	for (p = strtok_r(devpath, "/", &saveptr); p;
+	     p = strtok_r(NULL, "/", &saveptr)) {
+		if (!strncmp(p, "session", 7) && isdigit((unsigned char)p[7]) &&
+		    strlen(p) < sizeof(session))
+			strcpy(session, p);
+	}
+	if (!session[0])
+		goto not_iscsi;
+
+	if (sysfs_read_line(target, sizeof(target),
+			    "/sys/class/iscsi_session/%s/targetname",
+			    session) < 0)
+		return -1;
+	name_len = strlen(target);
+	size = sizeof(*node) + name_len;
+
+	node = calloc(1, size);
+	if (!node)
+		return -1;
+	efidp_make_generic((uint8_t *)node, size, EFIDP_MESSAGE_TYPE,
+			   EFIDP_MSG_ISCSI, size);
+	memcpy((uint8_t *)node + sizeof(*node), target, name_len);
+
+	/* protocol 0 is TCP, which is all the spec defines */
+	node->protocol = 0;
+
+	if (sysfs_read_line(buf, sizeof(buf),
+			    "/sys/class/iscsi_session/%s/tpgt", session) == 0)
+		node->tpgt = strtoul(buf, NULL, 0);
+
+	/* SAM LUN: peripheral addressing below 256, flat above */
+	if (lun < 256) {
+		node->lun[1] = lun;
+	} else if (lun < 0x4000) {
+		node->lun[0] = 0x40 | (lun >> 8);
+		node->lun[1] = lun & 0xff;
+	} else {
+		free(node);
+		errno = ERANGE;
+		return -1;
+	}
+
+	if (sysfs_read_line(buf, sizeof(buf),
+			    "/sys/class/iscsi_session/%s/username",
+			    session) == 0 && buf[0] && strcmp(buf, "(null)"))
+		node->options |= ISCSI_CHAP_UNI;
+	else
+		node->options |= ISCSI_AUTH_NONE;
+
+	/* the digests are per connection; boot sessions only have one */
+	if (sysfs_read_line(buf, sizeof(buf),
+			    "/sys/class/iscsi_connection/connection%s:0/header_digest",
+			    session + 7) == 0 && !strcasecmp(buf, "CRC32C"))
+		node->options |= ISCSI_HEADER_DIGEST_CRC32C;
+	if (sysfs_read_line(buf, sizeof(buf),
+			    "/sys/class/iscsi_connection/connection%s:0/data_digest",
+			    session + 7) == 0 && !strcasecmp(buf, "CRC32C"))
+		node->options |= ISCSI_DATA_DIGEST_CRC32C;
+
+	read_iscsi_portal(session, host, portal);
+
+	*node_out = (uint8_t *)node;
+	return size;
+not_iscsi:
+	efi_error("%s is not attached over iSCSI", sysdir);
+	errno = ENODEV;
+	return -1;
+}
+
+/*
+ * A TCP or RDMA controller's address reads like
+ * "traddr=192.0.2.1,trsvcid=4420,src_addr=192.0.2.2".
+ */
+static int
+parse_nvmeof_address(char *buf, fabric_portal_t *portal)
+{
+	char *field;
+	int rc = -1;
+
+	while ((field = strsep(&buf, ",")) != NULL) {
+		if (!strncmp(field, "traddr=", 7)) {
+			copy_addr(portal->remote_addr, field + 7);
+			rc = 0;
+		} else if (!strncmp(field, "trsvcid=", 8)) {
+			portal->remote_port = strtoul(field + 8, NULL, 10);
+		} else if (!strncmp(field, "src_addr=", 9)) {
+			copy_addr(portal->local_addr, field + 9);
+		}
+	}
+	return rc;
+}
+
+/*
+ * The namespace's parent is its controller, or with native multipathing
+ * its subsystem, which links to each of its controllers; use the first
+ * one that has an address.
+ */
+static void
+read_nvmeof_portal(const char *sysdir, fabric_portal_t *portal)
+{
+	char subsys[PATH_MAX], buf[256];
+	struct dirent *de;
+	DIR *dir;
+
+	if (sysfs_read_line(buf, sizeof(buf), "%.200s/../address",
+			    sysdir) == 0 &&
+	    parse_nvmeof_address(buf, portal) == 0)
+		return;
+
+	snprintf(subsys, sizeof(subsys), "%.200s/..", sysdir);
+	dir = opendir(subsys);
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		if (strncmp(de->d_name, "nvme", 4) ||
+		    !isdigit((unsigned char)de->d_name[4]))
+			continue;
+		if (sysfs_read_line(buf, sizeof(buf), "%s/%.64s/address",
+				    subsys, de->d_name) == 0 &&
+		    parse_nvmeof_address(buf, portal) == 0)
+			break;
+	}
+	closedir(dir);
+}
+
+static ssize_t
+make_nvmeof_node(const char *sysdir, uint8_t **node_out,
+		 fabric_portal_t *portal)
+{
+	char buf[256], transport[32];
+	char nqn[224];
+	nvmeof_node_t *node;
+	size_t nqn_len;
+	ssize_t size;
+
+	/*
+	 * The namespace's parent is its controller, or with native
+	 * multipathing its subsystem; both have subsysnqn.
+	 */
+	if (sysfs_read_line(nqn, sizeof(nqn), "%.200s/../subsysnqn",
+			    sysdir) < 0) {
+		efi_error("%s is not an NVMe namespace", sysdir);
+		errno = ENODEV;
+		return -1;
+	}
+	if (sysfs_read_line(transport, sizeof(transport),
+			    "%.200s/device/transport", sysdir) == 0 &&
+	    !strcmp(transport, "pcie")) {
+		efi_error("%s is a local NVMe namespace", sysdir);
+		errno = ENODEV;
+		return -1;
+	}
+
+	nqn_len = strlen(nqn) + 1;
+	size = sizeof(*node) + nqn_len;
+	node = calloc(1, size);
+	if (!node)
+		return -1;
+	efidp_make_generic((uint8_t *)node, size, EFIDP_MESSAGE_TYPE,
+			   EFIDP_MSG_NVMEOF, size);
+	memcpy((uint8_t *)node + sizeof(*node), nqn, nqn_len);
+
+	if (sysfs_read_line(buf, sizeof(buf), "%.200s/uuid", sysdir) == 0 &&
+	    parse_hex_id(buf, node->nid, 16) == 0) {
+		node->nidt = NVME_NIDT_UUID;
+	} else if (sysfs_read_line(buf, sizeof(buf), "%.200s/nguid",
+				   sysdir) == 0 &&
+		   parse_hex_id(buf, node->nid, 16) == 0) {
+		node->nidt = NVME_NIDT_NGUID;
+	} else if (sysfs_read_line(buf, sizeof(buf), "%.200s/eui", sysdir) == 0 &&
+		   parse_hex_id(buf, node->nid, 8) == 0) {
+		node->nidt = NVME_NIDT_EUI64;
+	} else {
+		efi_error("%s has no namespace identifier", sysdir);
+		free(node);
+		errno = ENODEV;
+		return -1;
+	}
+
+	read_nvmeof_portal(sysdir, portal);
+
+	*node_out = (uint8_t *)node;
+	return size;
+}
+
+ssize_t
+make_fabric_node(int fabric, const char *disk, uint8_t **node,
+		 fabric_portal_t *portal)
+{
+	char sysdir[PATH_MAX];
+
+	memset(portal, 0, sizeof(*portal));
+
+	if (disk_sysfs_path(disk, sysdir) < 0) {
+		efi_error("could not find %s in sysfs", disk);
+		return -1;
+	}
+
+	switch (fabric) {
+	case EFIBOOTMGR_FABRIC_ISCSI:
+		return make_iscsi_node(sysdir, node, portal);
+	case EFIBOOTMGR_FABRIC_NVMEOF:
+		return make_nvmeof_node(sysdir, node, portal);
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
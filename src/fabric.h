@@ -0,0 +1,33 @@
+/*
+ * fabric.h - iSCSI() and NVMe-oF device path nodes from sysfs
+ *
+ * See "COPYING" for license terms.
+ */
+
+#pragma once
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Where the kernel's session to the target connects, as sysfs tells it.
+ * The addresses are text, IPv4 or IPv6, and empty if sysfs doesn't say.
+ */
+typedef struct {
+	char		local_addr[INET6_ADDRSTRLEN];
+	char		remote_addr[INET6_ADDRSTRLEN];
+	uint16_t	remote_port;
+} fabric_portal_t;
+
+/*
+ * Build the iSCSI() or NVMe-oF namespace node for disk, a block device
+ * the kernel has attached over a fabric, from its sysfs session data, and
+ * fill in *portal with the addresses the session uses.  fabric is
+ * EFIBOOTMGR_FABRIC_ISCSI or EFIBOOTMGR_FABRIC_NVMEOF.
+ *
+ * Returns the node's size and stores it in *node, which the caller frees,
+ * or -1 with errno set.
+ */
+extern ssize_t make_fabric_node(int fabric, const char *disk, uint8_t **node,
+				fabric_portal_t *portal);
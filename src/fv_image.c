@@ -0,0 +1,792 @@
+/*
+ * fv_image.c - EFI variables in an edk2 firmware volume image
+ *
+ * See "COPYING" for license terms.
+ */
+
+#include "fix_coverity.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <efivar.h>
+
+#include "fv_image.h"
+#include "hash.h"
+#include "parse_loader_data.h"
+#include "sysfs.h"
+
+/* PI Spec 1.8 vol 3 section 3.2.1 */
+typedef struct {
+	uint8_t		zero_vector[16];
+	efi_guid_t	fs_guid;
+	uint64_t	fv_length;
+	uint32_t	signature;
+	uint32_t	attributes;
+	uint16_t	header_length;
+	uint16_t	checksum;
+	uint16_t	ext_header_offset;
+	uint8_t		reserved;
+	uint8_t		revision;
+	/* followed by the block map */
+} __attribute__((packed)) fv_header_t;
+
+#define FV_SIGNATURE	0x4856465f	/* "_FVH" */
+
+#define EFI_SYSTEM_NV_DATA_FV_GUID \
+	EFI_GUID(0xfff12b8d, 0x7696, 0x4c8b, 0xa985, 0x27, 0x47, 0x07, 0x5b, 0x4f, 0x50)
+
+/* edk2 MdeModulePkg/Include/Guid/VariableFormat.h */
+typedef struct {
+	efi_guid_t	signature;
+	uint32_t	size;
+	uint8_t		format;
+	uint8_t		state;
+	uint16_t	reserved;
+	uint32_t	reserved1;
+} __attribute__((packed)) var_store_header_t;
+
+#define EFI_VARIABLE_GUID \
+	EFI_GUID(0xddcf3616, 0x3275, 0x4164, 0x98b6, 0xfe, 0x85, 0x70, 0x7f, 0xfe, 0x7d)
+#define EFI_AUTHENTICATED_VARIABLE_GUID \
+	EFI_GUID(0xaaf32c78, 0x947b, 0x439a, 0xa180, 0x2e, 0x14, 0x4e, 0xc3, 0x77, 0x92)
+
+#define VAR_STORE_FORMATTED	0x5a
+#define VAR_STORE_HEALTHY	0xfe
+
+typedef struct {
+	uint16_t	start_id;
+	uint8_t		state;
+	uint8_t		reserved;
+	uint32_t	attributes;
+	uint32_t	name_size;
+	uint32_t	data_size;
+	efi_guid_t	vendor_guid;
+} __attribute__((packed)) var_header_t;
+
+typedef struct {
+	uint16_t	start_id;
+	uint8_t		state;
+	uint8_t		reserved;
+	uint32_t	attributes;
+	uint64_t	monotonic_count;
+	uint8_t		timestamp[16];
+	uint32_t	pubkey_index;
+	uint32_t	name_size;
+	uint32_t	data_size;
+	efi_guid_t	vendor_guid;
+} __attribute__((packed)) auth_var_header_t;
+
+#define VAR_START_ID	0x55aa
+
+/*
+ * Flash can only clear bits, so a record's state only ever loses them:
+ * written, then added, then on its way out, then deleted.
+ */
+#define VAR_IN_DELETED_TRANSITION	0xfe
+#define VAR_DELETED			0xfd
+#define VAR_HEADER_VALID_ONLY		0x7f
+#define VAR_ADDED			0x3f
+
+#define VAR_ALIGN(x)	(((x) + 3) & ~(size_t)3)
+
+typedef struct {
+	efi_guid_t	guid;
+	char		*name;
+	uint64_t	hash;
+	size_t		offset;		/* of the record header */
+	size_t		data_offset;
+	size_t		data_size;
+	uint32_t	attributes;
+	bool		live;
+} fv_var_t;
+
+struct fv_image {
+	char		*path;
+	int		fd;
+	uint8_t		*map;
+	size_t		map_size;
+	bool		writable;
+	bool		auth;
+	size_t		hdr_size;	/* of one record header */
+	size_t		store_start;	/* first record */
+	size_t		store_used;	/* where the next record goes */
+	size_t		store_end;	/* end of the variable store */
+	bool		tail_erased;	/* all 0xff after store_used */
+
+	fv_var_t	*vars;
+	size_t		nvars;
+	size_t		vars_size;
+
+	/* open addressing, indices into vars plus one; 0 is empty */
+	size_t		*slots;
+	size_t		nslots;
+};
+
+static uint64_t
+var_hash(const efi_guid_t *guid, const char *name)
+{
+	return fnv1a64(name, strlen(name),
+		       fnv1a64(guid, sizeof(*guid), FNV1A64_INIT));
+}
+
+static size_t *
+find_slot(fv_image_t *img, uint64_t hash, const efi_guid_t *guid,
+	  const char *name)
+{
+	size_t mask = img->nslots - 1;
+
+	for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+		fv_var_t *var;
+
+		if (!img->slots[i])
+			return &img->slots[i];
+		var = &img->vars[img->slots[i] - 1];
+		if (var->hash == hash && !efi_guid_cmp(&var->guid, guid) &&
+		    !strcmp(var->name, name))
+			return &img->slots[i];
+	}
+}
+
+static int
+grow_slots(fv_image_t *img)
+{
+	size_t nslots = img->nslots ? img->nslots * 2 : 64;
+	size_t *slots, *old = img->slots;
+	size_t old_nslots = img->nslots;
+
+	slots = calloc(nslots, sizeof(*slots));
+	if (!slots)
+		return -1;
+	img->slots = slots;
+	img->nslots = nslots;
+	for (size_t i = 0; i < old_nslots; i++) {
+		fv_var_t *var;
+
+		if (!old[i])
+			continue;
+		var = &img->vars[old[i] - 1];
+		*find_slot(img, var->hash, &var->guid, var->name) = old[i];
+	}
+	free(old);
+	return 0;
+}
+
+/*
+ * Read the record header at off into a common form.  Returns false at
+ * the end of the records.
+ */
+static bool
+read_var_header(fv_image_t *img, size_t off, var_header_t *hdr)
+{
+	if (off + img->hdr_size > img->store_end)
+		return false;
+
+	if (img->auth) {
+		auth_var_header_t ahdr;
+
+		memcpy(&ahdr, img->map + off, sizeof(ahdr));
+		hdr->start_id = le16toh(ahdr.start_id);
+		hdr->state = ahdr.state;
+		hdr->attributes = le32toh(ahdr.attributes);
+		hdr->name_size = le32toh(ahdr.name_size);
+		hdr->data_size = le32toh(ahdr.data_size);
+		hdr->vendor_guid = ahdr.vendor_guid;
+	} else {
+		memcpy(hdr, img->map + off, sizeof(*hdr));
+		hdr->start_id = le16toh(hdr->start_id);
+		hdr->attributes = le32toh(hdr->attributes);
+		hdr->name_size = le32toh(hdr->name_size);
+		hdr->data_size = le32toh(hdr->data_size);
+	}
+	if (hdr->start_id != VAR_START_ID)
+		return false;
+	return (size_t)hdr->name_size + hdr->data_size <=
+	       img->store_end - off - img->hdr_size;
+}
+
+static int
+add_var(fv_image_t *img, size_t off, const var_header_t *hdr)
+{
+	fv_var_t *var;
+	size_t *slot;
+	char *name;
+	uint64_t hash;
+	efi_guid_t guid = hdr->vendor_guid;
+
+	/* Variable names are UCS-2; ours are UTF-8. */
+	name = ucs2_to_utf8((const uint16_t *)(img->map + off +
+					       img->hdr_size),
+			    hdr->name_size / 2);
+	if (!name)
+		return -1;
+	hash = var_hash(&guid, name);
+
+	if ((img->nvars + 1) * 4 > img->nslots * 3 && grow_slots(img) < 0)
+		goto err;
+	slot = find_slot(img, hash, &guid, name);
+	if (*slot) {
+		/*
+		 * A record on its way out is only good until the one
+		 * replacing it has been added.
+		 */
+		if (hdr->state != VAR_ADDED) {
+			free(name);
+			return 0;
+		}
+		var = &img->vars[*slot - 1];
+		free(var->name);
+	} else {
+		if (img->nvars == img->vars_size) {
+			size_t n = img->vars_size ? img->vars_size * 2 : 64;
+			fv_var_t *tmp = realloc(img->vars, n * sizeof(*tmp));
+
+			if (!tmp)
+				goto err;
+			img->vars = tmp;
+			img->vars_size = n;
+		}
+		var = &img->vars[img->nvars++];
+		*slot = img->nvars;
+	}
+
+	var->guid = guid;
+	var->name = name;
+	var->hash = hash;
+	var->offset = off;
+	var->data_offset = off + img->hdr_size + hdr->name_size;
+	var->data_size = hdr->data_size;
+	var->attributes = hdr->attributes;
+	var->live = true;
+	return 0;
+err:
+	free(name);
+	return -1;
+}
+
+static int
+parse_store(fv_image_t *img)
+{
+	fv_header_t fvh;
+	var_store_header_t vsh;
+	efi_guid_t guid;
+	uint16_t sum = 0;
+	size_t off;
+
+	if (img->map_size < sizeof(fvh))
+		goto inval;
+	memcpy(&fvh, img->map, sizeof(fvh));
+	guid = fvh.fs_guid;
+	if (le32toh(fvh.signature) != FV_SIGNATURE ||
+	    efi_guid_cmp(&guid, &EFI_SYSTEM_NV_DATA_FV_GUID) ||
+	    le64toh(fvh.fv_length) > img->map_size ||
+	    le16toh(fvh.header_length) < sizeof(fvh) ||
+	    le16toh(fvh.header_length) + sizeof(vsh) > le64toh(fvh.fv_length))
+		goto inval;
+
+	for (size_t i = 0; i < le16toh(fvh.header_length); i += 2) {
+		uint16_t w;
+
+		memcpy(&w, img->map + i, sizeof(w));
+		sum += le16toh(w);
+	}
+	if (sum) {
+		efi_error("firmware volume header checksum is wrong");
+		goto inval;
+	}
+
+	off = le16toh(fvh.header_length);
+	memcpy(&vsh, img->map + off, sizeof(vsh));
+	guid = vsh.signature;
+	if (!efi_guid_cmp(&guid, &EFI_AUTHENTICATED_VARIABLE_GUID))
+		img->auth = true;
+	else if (efi_guid_cmp(&guid, &EFI_VARIABLE_GUID))
+		goto inval;
+	if (vsh.format != VAR_STORE_FORMATTED ||
+	    vsh.state != VAR_STORE_HEALTHY ||
+	    le32toh(vsh.size) < sizeof(vsh) ||
+	    le32toh(vsh.size) > le64toh(fvh.fv_length) - off)
+		goto inval;
+
+	img->hdr_size = img->auth ? sizeof(auth_var_header_t)
+				  : sizeof(var_header_t);
+	img->store_start = VAR_ALIGN(off + sizeof(vsh));
+	img->store_end = off + le32toh(vsh.size);
+
+	for (off = img->store_start; ; ) {
+		var_header_t hdr;
+
+		if (!read_var_header(img, off, &hdr))
+			break;
+		if ((hdr.state == VAR_ADDED ||
+		     hdr.state == (VAR_ADDED & VAR_IN_DELETED_TRANSITION)) &&
+		    hdr.name_size >= 2 && add_var(img, off, &hdr) < 0)
+			return -1;
+		off = VAR_ALIGN(off + img->hdr_size + hdr.name_size +
+				hdr.data_size);
+	}
+	img->store_used = off < img->store_end ? off : img->store_end;
+
+	img->tail_erased = true;
+	for (off = img->store_used; off < img->store_end; off++) {
+		if (img->map[off] != 0xff) {
+			img->tail_erased = false;
+			break;
+		}
+	}
+	return 0;
+inval:
+	efi_error("not an edk2 variable store image");
+	errno = EINVAL;
+	return -1;
+}
+
+int
+fv_image_open(const char *path, bool writable, fv_image_t **imgp)
+{
+	fv_image_t *img;
+	struct stat sb;
+	int saved_errno;
+
+	img = calloc(1, sizeof(*img));
+	if (!img)
+		return -1;
+	img->fd = -1;
+	img->writable = writable;
+	img->path = strdup(path);
+	if (!img->path)
+		goto err;
+	img->fd = open(path, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+	if (img->fd < 0)
+		goto err;
+	if (fstat(img->fd, &sb) < 0)
+		goto err;
+	if (!S_ISREG(sb.st_mode) || sb.st_size == 0) {
+		errno = EINVAL;
+		goto err;
+	}
+	img->map_size = sb.st_size;
+	img->map = mmap(NULL, img->map_size,
+			PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED,
+			img->fd, 0);
+	if (img->map == MAP_FAILED) {
+		img->map = NULL;
+		goto err;
+	}
+	if (parse_store(img) < 0)
+		goto err;
+
+	*imgp = img;
+	return 0;
+err:
+	saved_errno = errno;
+	efi_error("could not open image %s", path);
+	fv_image_close(img);
+	errno = saved_errno;
+	return -1;
+}
+
+void
+fv_image_close(fv_image_t *img)
+{
+	if (!img)
+		return;
+	for (size_t i = 0; i < img->nvars; i++)
+		free(img->vars[i].name);
+	free(img->vars);
+	free(img->slots);
+	if (img->map)
+		munmap(img->map, img->map_size);
+	if (img->fd >= 0)
+		close(img->fd);
+	free(img->path);
+	free(img);
+}
+
+static fv_var_t *
+lookup(fv_image_t *img, const efi_guid_t *guid, const char *name)
+{
+	size_t *slot;
+
+	if (img->nslots) {
+		slot = find_slot(img, var_hash(guid, name), guid, name);
+		if (*slot && img->vars[*slot - 1].live)
+			return &img->vars[*slot - 1];
+	}
+	errno = ENOENT;
+	return NULL;
+}
+
+int
+fv_image_get(fv_image_t *img, const efi_guid_t *guid, const char *name,
+	     const uint8_t **data, size_t *data_size, uint32_t *attributes)
+{
+	fv_var_t *var = lookup(img, guid, name);
+
+	if (!var)
+		return -1;
+	if (data)
+		*data = img->map + var->data_offset;
+	if (data_size)
+		*data_size = var->data_size;
+	if (attributes)
+		*attributes = var->attributes;
+	return 0;
+}
+
+int
+fv_image_next(fv_image_t *img, size_t *iter, efi_guid_t **guid, char **name)
+{
+	while (*iter < img->nvars) {
+		fv_var_t *var = &img->vars[(*iter)++];
+
+		if (!var->live)
+			continue;
+		*guid = &var->guid;
+		*name = var->name;
+		return 1;
+	}
+	return 0;
+}
+
+static uint8_t *
+utf8_name_to_ucs2(const char *name, size_t *size)
+{
+	const unsigned char *p = (const unsigned char *)name;
+	size_t len = strlen(name);
+	uint8_t *ucs2;
+	size_t n = 0;
+
+	ucs2 = malloc((len + 1) * 2);
+	if (!ucs2)
+		return NULL;
+	while (*p) {
+		uint16_t c;
+
+		if (p[0] < 0x80) {
+			c = p[0];
+			p += 1;
+		} else if ((p[0] & 0xe0) == 0xc0 && (p[1] & 0xc0) == 0x80) {
+			c = (p[0] & 0x1f) << 6 | (p[1] & 0x3f);
+			p += 2;
+		} else if ((p[0] & 0xf0) == 0xe0 && (p[1] & 0xc0) == 0x80 &&
+			   (p[2] & 0xc0) == 0x80) {
+			c = (p[0] & 0x0f) << 12 | (p[1] & 0x3f) << 6 |
+			    (p[2] & 0x3f);
+			p += 3;
+		} else {
+			free(ucs2);
+			errno = EINVAL;
+			return NULL;
+		}
+		c = htole16(c);
+		memcpy(ucs2 + n, &c, sizeof(c));
+		n += 2;
+	}
+	memset(ucs2 + n, 0, 2);
+	*size = n + 2;
+	return ucs2;
+}
+
+/* the state byte is at the same place in both kinds of header */
+static void
+clear_state_bits(fv_image_t *img, size_t off, uint8_t mask)
+{
+	img->map[off + offsetof(var_header_t, state)] &= mask;
+}
+
+static void
+write_header(fv_image_t *img, uint8_t *dst, const fv_var_t *old,
+	     const efi_guid_t *guid, uint32_t attributes, size_t name_size,
+	     size_t data_size)
+{
+	if (img->auth) {
+		auth_var_header_t ahdr;
+
+		/* keep the timestamp and count of what we're replacing */
+		if (old)
+			memcpy(&ahdr, img->map + old->offset, sizeof(ahdr));
+		else
+			memset(&ahdr, 0, sizeof(ahdr));
+		ahdr.start_id = htole16(VAR_START_ID);
+		ahdr.state = VAR_HEADER_VALID_ONLY;
+		ahdr.reserved = 0;
+		ahdr.attributes = htole32(attributes);
+		ahdr.name_size = htole32(name_size);
+		ahdr.data_size = htole32(data_size);
+		ahdr.vendor_guid = *guid;
+		memcpy(dst, &ahdr, sizeof(ahdr));
+	} else {
+		var_header_t hdr = {
+			.start_id = htole16(VAR_START_ID),
+			.state = VAR_HEADER_VALID_ONLY,
+			.attributes = htole32(attributes),
+			.name_size = htole32(name_size),
+			.data_size = htole32(data_size),
+			.vendor_guid = *guid,
+		};
+
+		memcpy(dst, &hdr, sizeof(hdr));
+	}
+}
+
+/*
+ * Rewrite the store with only the live records in it.  This goes to a
+ * new file which is renamed over the old one, so an interrupted
+ * compaction leaves the image as it was.
+ */
+static int
+compact(fv_image_t *img)
+{
+	char tmp[PATH_MAX];
+	uint8_t *buf, *map;
+	size_t off = img->store_start;
+	struct stat sb;
+	int fd, saved_errno;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", img->path) >=
+	    (int)sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	buf = malloc(img->map_size);
+	if (!buf)
+		return -1;
+	memcpy(buf, img->map, img->map_size);
+	memset(buf + img->store_start, 0xff,
+	       img->store_end - img->store_start);
+	for (size_t i = 0; i < img->nvars; i++) {
+		fv_var_t *var = &img->vars[i];
+		size_t name_size = var->data_offset - var->offset -
+				   img->hdr_size;
+		size_t size = img->hdr_size + name_size + var->data_size;
+
+		if (!var->live)
+			continue;
+		memcpy(buf + off, img->map + var->offset, size);
+		buf[off + offsetof(var_header_t, state)] = VAR_ADDED;
+		var->data_offset = off + (var->data_offset - var->offset);
+		var->offset = off;
+		off = VAR_ALIGN(off + size);
+	}
+
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0)
+		goto err_free;
+	if (fstat(img->fd, &sb) < 0 || fchmod(fd, sb.st_mode & 07777) < 0 ||
+	    write_all(fd, buf, img->map_size) < 0 ||
+	    fsync(fd) < 0)
+		goto err_unlink;
+	/* only root can give the file away, so EPERM is fine */
+	if (fchown(fd, sb.st_uid, sb.st_gid) < 0 && errno != EPERM)
+		goto err_unlink;
+	map = mmap(NULL, img->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	if (map == MAP_FAILED)
+		goto err_unlink;
+	if (rename(tmp, img->path) < 0) {
+		saved_errno = errno;
+		munmap(map, img->map_size);
+		errno = saved_errno;
+		goto err_unlink;
+	}
+
+	free(buf);
+	munmap(img->map, img->map_size);
+	close(img->fd);
+	img->map = map;
+	img->fd = fd;
+	img->store_used = off;
+	img->tail_erased = true;
+	return 0;
+err_unlink:
+	saved_errno = errno;
+	close(fd);
+	unlink(tmp);
+	errno = saved_errno;
+err_free:
+	free(buf);
+	return -1;
+}
+
+/*
+ * Append a record for guid/name, and retire the one it replaces.  The
+ * states change in the order edk2 uses, so an image we're interrupted
+ * writing still reads back as either the old or the new value.
+ */
+static int
+append_record(fv_image_t *img, size_t *slot, const efi_guid_t *guid,
+	      const char *name, const uint8_t *data, size_t data_size,
+	      uint32_t attributes)
+{
+	fv_var_t *var = *slot ? &img->vars[*slot - 1] : NULL;
+	fv_var_t *old = var && var->live ? var : NULL;
+	uint8_t *ucs2;
+	size_t name_size, size, off;
+	char *dup = NULL;
+
+	ucs2 = utf8_name_to_ucs2(name, &name_size);
+	if (!ucs2)
+		return -1;
+	size = img->hdr_size + name_size + data_size;
+	if (!var) {
+		dup = strdup(name);
+		if (!dup)
+			goto err;
+	}
+
+	if (!img->tail_erased ||
+	    VAR_ALIGN(size) > img->store_end - img->store_used) {
+		if (compact(img) < 0)
+			goto err;
+		if (VAR_ALIGN(size) > img->store_end - img->store_used) {
+			efi_error("no room for %s in %s", name, img->path);
+			errno = ENOSPC;
+			goto err;
+		}
+	}
+	if (!var && img->nvars == img->vars_size) {
+		size_t n = img->vars_size ? img->vars_size * 2 : 64;
+		fv_var_t *tmp = realloc(img->vars, n * sizeof(*tmp));
+
+		if (!tmp)
+			goto err;
+		img->vars = tmp;
+		img->vars_size = n;
+	}
+
+	off = img->store_used;
+	if (old)
+		clear_state_bits(img, old->offset, VAR_IN_DELETED_TRANSITION);
+	write_header(img, img->map + off, old, guid, attributes, name_size,
+		     data_size);
+	memcpy(img->map + off + img->hdr_size, ucs2, name_size);
+	memcpy(img->map + off + img->hdr_size + name_size, data, data_size);
+	clear_state_bits(img, off, VAR_ADDED);
+	if (old)
+		clear_state_bits(img, old->offset, VAR_DELETED);
+	img->store_used = VAR_ALIGN(off + size);
+	free(ucs2);
+
+	if (!var) {
+		var = &img->vars[img->nvars++];
+		*slot = img->nvars;
+		var->guid = *guid;
+		var->name = dup;
+		var->hash = var_hash(guid, name);
+	}
+	var->offset = off;
+	var->data_offset = off + img->hdr_size + name_size;
+	var->data_size = data_size;
+	var->attributes = attributes;
+	var->live = true;
+	return 0;
+err:
+	free(dup);
+	free(ucs2);
+	return -1;
+}
+
+int
+fv_image_set(fv_image_t *img, const efi_guid_t *guid, const char *name,
+	     const uint8_t *data, size_t data_size, uint32_t attributes)
+{
+	uint8_t *joined = NULL;
+	fv_var_t *var;
+	size_t *slot;
+	int rc;
+
+	if (!img->writable) {
+		errno = EROFS;
+		return -1;
+	}
+	if (!name[0]) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((img->nvars + 1) * 4 > img->nslots * 3 && grow_slots(img) < 0)
+		return -1;
+	slot = find_slot(img, var_hash(guid, name), guid, name);
+	var = *slot && img->vars[*slot - 1].live ? &img->vars[*slot - 1]
+						 : NULL;
+
+	if (attributes & EFI_VARIABLE_APPEND_WRITE) {
+		attributes &= ~EFI_VARIABLE_APPEND_WRITE;
+		if (!data_size)
+			return 0;
+		if (var) {
+			joined = malloc(var->data_size + data_size);
+			if (!joined)
+				return -1;
+			memcpy(joined, img->map + var->data_offset,
+			       var->data_size);
+			memcpy(joined + var->data_size, data, data_size);
+			data = joined;
+			data_size += var->data_size;
+		}
+	} else if (!data_size) {
+		return fv_image_del(img, guid, name);
+	}
+
+	/* as with the firmware, attributes can't change under a variable */
+	if (var && var->attributes != attributes) {
+		free(joined);
+		errno = EINVAL;
+		return -1;
+	}
+	if (var && var->data_size == data_size &&
+	    !memcmp(img->map + var->data_offset, data, data_size)) {
+		free(joined);
+		return 0;
+	}
+
+	rc = append_record(img, slot, guid, name, data, data_size, attributes);
+	free(joined);
+	return rc;
+}
+
+int
+fv_image_del(fv_image_t *img, const efi_guid_t *guid, const char *name)
+{
+	fv_var_t *var;
+
+	if (!img->writable) {
+		errno = EROFS;
+		return -1;
+	}
+	var = lookup(img, guid, name);
+	if (!var)
+		return -1;
+	clear_state_bits(img, var->offset, VAR_DELETED);
+	var->live = false;
+	return 0;
+}
+
+size_t
+fv_image_space(const fv_image_t *img)
+{
+	size_t total = img->store_end - img->store_start, used = 0;
+
+	for (size_t i = 0; i < img->nvars; i++) {
+		const fv_var_t *var = &img->vars[i];
+
+		if (var->live)
+			used += VAR_ALIGN(var->data_offset - var->offset +
+					  var->data_size);
+	}
+	if (used + img->hdr_size >= total)
+		return 0;
+	return total - used - img->hdr_size;
+}
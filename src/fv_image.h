@@ -0,0 +1,63 @@
+/*
+ * fv_image.h - EFI variables in an edk2 firmware volume image
+ *
+ * See "COPYING" for license terms.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <efivar.h>
+
+typedef struct fv_image fv_image_t;
+
+/*
+ * Map an OVMF_VARS.fd style image: a firmware volume holding an edk2
+ * variable store, with either authenticated or plain variable headers.
+ * Every live record is indexed by GUID and name; nothing is copied.
+ * Unless writable is set, fv_image_set() and fv_image_del() fail with
+ * EROFS.
+ *
+ * Returns 0 and sets *imgp, or -1 with errno set (EINVAL if the file
+ * isn't a variable store we understand).
+ */
+extern int fv_image_open(const char *path, bool writable, fv_image_t **imgp);
+extern void fv_image_close(fv_image_t *img);
+
+/*
+ * Look up a variable.  *data points into the mapping and stays valid until
+ * fv_image_close().  Returns -1 with errno set to ENOENT if it isn't there.
+ */
+extern int fv_image_get(fv_image_t *img, const efi_guid_t *guid,
+			const char *name, const uint8_t **data,
+			size_t *data_size, uint32_t *attributes);
+
+/*
+ * Walk the variables in the order they were found.  Start with *iter at 0;
+ * returns 1 with *guid and *name set, then 0 at the end.  The names are
+ * UTF-8.
+ */
+extern int fv_image_next(fv_image_t *img, size_t *iter, efi_guid_t **guid,
+			 char **name);
+
+/*
+ * Change a variable the way edk2 does: append a new record and mark the
+ * one it replaces deleted.  When the store is full it's compacted into a
+ * new file which is renamed over the old one.  As with SetVariable(),
+ * EFI_VARIABLE_APPEND_WRITE appends to the data, and no data without it
+ * deletes the variable.  Changes go straight to the shared mapping.
+ */
+extern int fv_image_set(fv_image_t *img, const efi_guid_t *guid,
+			const char *name, const uint8_t *data,
+			size_t data_size, uint32_t attributes);
+extern int fv_image_del(fv_image_t *img, const efi_guid_t *guid,
+			const char *name);
+
+/*
+ * The most variable data one more record could hold, once the store is
+ * compacted.
+ */
+extern size_t fv_image_space(const fv_image_t *img);
@@ -0,0 +1,30 @@
+/*
+ * hash.h - small non-cryptographic hash helpers
+ *
+ * See "COPYING" for license terms.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 64-bit FNV-1a.  Pass FNV1A64_INIT as the seed to start a new hash, or a
+ * previous result to chain several buffers into one value.
+ */
+#define FNV1A64_INIT	0xcbf29ce484222325ULL
+#define FNV1A64_PRIME	0x00000100000001b3ULL
+
+static inline uint64_t
+__attribute__((__unused__))
+fnv1a64(const void *data, size_t size, uint64_t hash)
+{
+	const uint8_t *p = data;
+
+	for (size_t i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= FNV1A64_PRIME;
+	}
+	return hash;
+}
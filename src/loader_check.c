@@ -0,0 +1,499 @@
+/*
+ * loader_check.c - make sure a loader is on the ESP before pointing at it
+ *
+ * See "COPYING" for license terms.
+ */
+
+#include "fix_coverity.h"
+
+#include <dirent.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "loader_check.h"
+#include "sha256.h"
+#include "sysfs.h"
+
+#define PE_DOS_MAGIC		0x5a4d		/* "MZ" */
+#define PE_DOS_LFANEW		0x3c
+#define PE_OPT_CHECKSUM		64
+#define PE_OPT_SUBSYSTEM	68
+#define PE_OPT_SIZE_OF_HEADERS	60
+#define PE32_MAGIC		0x10b
+#define PE32PLUS_MAGIC		0x20b
+#define PE32_DATA_DIRS		96
+#define PE32PLUS_DATA_DIRS	112
+#define PE_DIR_SECURITY		4
+#define PE_SECTION_SIZE		40
+#define PE_SUBSYSTEM_EFI_APPLICATION		10
+#define PE_SUBSYSTEM_EFI_BOOT_SERVICE_DRIVER	11
+#define PE_SUBSYSTEM_EFI_RUNTIME_DRIVER		12
+
+/* the firmware's machine type, for each firmware word size */
+#if defined(__x86_64__) || defined(__i386__)
+#define PE_MACHINE_64	0x8664
+#define PE_MACHINE_32	0x014c
+#elif defined(__aarch64__) || defined(__arm__)
+#define PE_MACHINE_64	0xaa64
+#define PE_MACHINE_32	0x01c2
+#elif defined(__riscv) && __riscv_xlen == 64
+#define PE_MACHINE_64	0x5064
+#elif defined(__loongarch64)
+#define PE_MACHINE_64	0x6264
+#elif defined(__ia64__)
+#define PE_MACHINE_64	0x0200
+#endif
+
+struct mount_entry {
+	dev_t	dev;
+	char	*dir;
+};
+
+static struct mount_entry *mounts;
+static size_t n_mounts;
+static bool mounts_read;
+
+/* mountinfo escapes space, tab, newline and backslash as \ooo */
+static void
+unescape_octal(char *s)
+{
+	char *out = s;
+
+	while (*s) {
+		if (s[0] == '\\' && s[1] >= '0' && s[1] <= '3' &&
+		    s[2] >= '0' && s[2] <= '7' && s[3] >= '0' && s[3] <= '7') {
+			*out++ = (s[1] - '0') << 6 | (s[2] - '0') << 3 |
+				 (s[3] - '0');
+			s += 4;
+		} else {
+			*out++ = *s++;
+		}
+	}
+	*out = '\0';
+}
+
+static int
+read_mounts(void)
+{
+	FILE *f;
+	char *line = NULL;
+	size_t line_size = 0;
+
+	if (mounts_read)
+		return 0;
+
+	f = fopen("/proc/self/mountinfo", "r");
+	if (!f)
+		return -1;
+	while (getline(&line, &line_size, f) >= 0) {
+		struct mount_entry *new_mounts;
+		unsigned int maj, min;
+		char root[PATH_MAX], dir[PATH_MAX];
+
+		/* 36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 ... */
+		if (sscanf(line, "%*u %*u %u:%u %4095s %4095s", &maj, &min,
+			   root, dir) != 4)
+			continue;
+		/* a bind mount of a subdirectory isn't the ESP's root */
+		if (strcmp(root, "/"))
+			continue;
+
+		new_mounts = realloc(mounts, (n_mounts + 1) * sizeof(*mounts));
+		if (!new_mounts)
+			break;
+		mounts = new_mounts;
+		unescape_octal(dir);
+		mounts[n_mounts].dev = makedev(maj, min);
+		mounts[n_mounts].dir = strdup(dir);
+		if (!mounts[n_mounts].dir)
+			break;
+		n_mounts++;
+	}
+	free(line);
+	fclose(f);
+	mounts_read = true;
+	return 0;
+}
+
+static const char *
+find_mount(dev_t dev)
+{
+	for (size_t i = 0; i < n_mounts; i++)
+		if (mounts[i].dev == dev)
+			return mounts[i].dir;
+	return NULL;
+}
+
+/* where dev is mounted, or failing that, an md device built on it */
+static const char *
+find_esp_mount(dev_t dev)
+{
+	char sysdir[SYSDIR_MAX], holders[SYSDIR_MAX + 16], path[PATH_MAX];
+	struct dirent *de;
+	const char *dir = NULL;
+	DIR *d;
+	dev_t holder;
+
+	dir = find_mount(dev);
+	if (dir)
+		return dir;
+
+	sysfs_block_dir(dev, sysdir);
+	snprintf(holders, sizeof(holders), "%s/holders", sysdir);
+	d = opendir(holders);
+	if (!d)
+		return NULL;
+	while (!dir && (de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s/dev", holders, de->d_name);
+		if (sysfs_read_dev(path, &holder) == 0)
+			dir = find_mount(holder);
+	}
+	closedir(d);
+	return dir;
+}
+
+/* openat(), but matching each component of path case insensitively */
+static int
+open_nocase(const char *root, const char *path)
+{
+	char *copy, *component, *saveptr = NULL;
+	int fd, next;
+
+	fd = open(root, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	copy = strdup(path);
+	if (!copy) {
+		close(fd);
+		return -1;
+	}
+	for (char *c = copy; *c; c++)
+		if (*c == '\\')
+			*c = '/';
+
+	for (component = strtok_r(copy, "/", &saveptr); component;
+	     component = strtok_r(NULL, "/", &saveptr)) {
+		next = openat(fd, component, O_RDONLY|O_CLOEXEC);
+		if (next < 0 && errno == ENOENT) {
+			struct dirent *de;
+			DIR *dir;
+			int dfd = dup(fd);
+
+			dir = dfd < 0 ? NULL : fdopendir(dfd);
+			if (!dir) {
+				if (dfd >= 0)
+					close(dfd);
+				break;
+			}
+			while ((de = readdir(dir)) != NULL) {
+				if (!strcasecmp(de->d_name, component)) {
+					next = openat(fd, de->d_name,
+						      O_RDONLY|O_CLOEXEC);
+					break;
+				}
+			}
+			closedir(dir);
+			if (next < 0)
+				errno = ENOENT;
+		}
+		close(fd);
+		fd = next;
+		if (fd < 0)
+			break;
+	}
+	free(copy);
+	return fd;
+}
+
+#ifdef PE_MACHINE_64
+static uint16_t
+firmware_machine(void)
+{
+#ifdef PE_MACHINE_32
+	FILE *f;
+	int size = 64;
+
+	f = fopen("/sys/firmware/efi/fw_platform_size", "r");
+	if (f) {
+		if (fscanf(f, "%d", &size) != 1)
+			size = 64;
+		fclose(f);
+	}
+	if (size == 32)
+		return PE_MACHINE_32;
+#endif
+	return PE_MACHINE_64;
+}
+#endif
+
+static int
+check_pe(int fd, bool driver)
+{
+	uint8_t dos[64], pe[24];
+	uint16_t magic, machine, opt_size, subsystem;
+	uint32_t lfanew;
+
+	if (pread(fd, dos, sizeof(dos), 0) != sizeof(dos))
+		return LOADER_NOT_PE;
+	memcpy(&magic, dos, sizeof(magic));
+	if (le16toh(magic) != PE_DOS_MAGIC)
+		return LOADER_NOT_PE;
+	memcpy(&lfanew, dos + PE_DOS_LFANEW, sizeof(lfanew));
+	lfanew = le32toh(lfanew);
+
+	if (pread(fd, pe, sizeof(pe), lfanew) != sizeof(pe) ||
+	    memcmp(pe, "PE\0\0", 4))
+		return LOADER_NOT_PE;
+	memcpy(&machine, pe + 4, sizeof(machine));
+	memcpy(&opt_size, pe + 20, sizeof(opt_size));
+	if (le16toh(opt_size) < PE_OPT_SUBSYSTEM + sizeof(subsystem))
+		return LOADER_NOT_PE;
+	if (pread(fd, &subsystem, sizeof(subsystem),
+		  (off_t)lfanew + sizeof(pe) + PE_OPT_SUBSYSTEM) !=
+	    sizeof(subsystem))
+		return LOADER_NOT_PE;
+
+#ifdef PE_MACHINE_64
+	if (le16toh(machine) != firmware_machine())
+		return LOADER_WRONG_MACHINE;
+#else
+	(void)machine;
+#endif
+
+	subsystem = le16toh(subsystem);
+	if (driver ? subsystem != PE_SUBSYSTEM_EFI_BOOT_SERVICE_DRIVER &&
+		     subsystem != PE_SUBSYSTEM_EFI_RUNTIME_DRIVER
+		   : subsystem != PE_SUBSYSTEM_EFI_APPLICATION)
+		return LOADER_WRONG_SUBSYSTEM;
+	return LOADER_OK;
+}
+
+static inline uint16_t
+get16(const uint8_t *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le16toh(v);
+}
+
+static inline uint32_t
+get32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le32toh(v);
+}
+
+typedef struct {
+	uint32_t	offset;
+	uint32_t	size;
+} pe_section_t;
+
+static int
+cmp_sections(const void *p1, const void *p2)
+{
+	const pe_section_t *s1 = p1, *s2 = p2;
+
+	return s1->offset < s2->offset ? -1 : s1->offset > s2->offset;
+}
+
+/*
+ * The Authenticode SHA-256 of a PE image, as in the PE/COFF spec's
+ * "Calculating the PE Image Hash": the headers less the checksum and the
+ * certificate table entry, then the sections in file order, then anything
+ * after them except the certificates.  It's one digest over the image in
+ * order, so it's computed in one pass.
+ */
+static int
+authenticode_sha256(const uint8_t *img, size_t size,
+		    uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	const uint8_t *pe, *opt, *dirs, *sec;
+	uint32_t lfanew, headers, cert_size = 0, n_dirs;
+	uint16_t n_sections, opt_size;
+	size_t checksum, cert_dir, cert_dir_size, hashed;
+	pe_section_t *sections;
+	sha256_ctx_t ctx;
+
+	if (size < 64)
+		return LOADER_NOT_PE;
+	lfanew = get32(img + PE_DOS_LFANEW);
+	if (lfanew > size - 24)
+		return LOADER_NOT_PE;
+	pe = img + lfanew;
+	n_sections = get16(pe + 6);
+	opt_size = get16(pe + 20);
+	opt = pe + 24;
+	if (opt_size < 2 || (size_t)(opt - img) + opt_size > size)
+		return LOADER_NOT_PE;
+
+	/* the data directories start after NumberOfRvaAndSizes */
+	switch (get16(opt)) {
+	case PE32_MAGIC:
+		if (opt_size < PE32_DATA_DIRS)
+			return LOADER_NOT_PE;
+		dirs = opt + PE32_DATA_DIRS;
+		break;
+	case PE32PLUS_MAGIC:
+		if (opt_size < PE32PLUS_DATA_DIRS)
+			return LOADER_NOT_PE;
+		dirs = opt + PE32PLUS_DATA_DIRS;
+		break;
+	default:
+		return LOADER_NOT_PE;
+	}
+	checksum = opt + PE_OPT_CHECKSUM - img;
+	headers = get32(opt + PE_OPT_SIZE_OF_HEADERS);
+	if (headers > size || headers < checksum + 4)
+		return LOADER_NOT_PE;
+
+	/* without a certificate table entry, only the checksum is skipped */
+	n_dirs = get32(dirs - 4);
+	if (n_dirs > PE_DIR_SECURITY) {
+		if (dirs + (PE_DIR_SECURITY + 1) * 8 > opt + opt_size)
+			return LOADER_NOT_PE;
+		cert_dir = dirs + PE_DIR_SECURITY * 8 - img;
+		cert_dir_size = 8;
+		if (get32(img + cert_dir))
+			cert_size = get32(img + cert_dir + 4);
+		if (cert_size > size || headers < cert_dir + cert_dir_size)
+			return LOADER_NOT_PE;
+	} else {
+		cert_dir = headers;
+		cert_dir_size = 0;
+	}
+
+	sec = opt + opt_size;
+	if ((size_t)(sec - img) + (size_t)n_sections * PE_SECTION_SIZE > size)
+		return LOADER_NOT_PE;
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, img, checksum);
+	sha256_update(&ctx, img + checksum + 4, cert_dir - checksum - 4);
+	sha256_update(&ctx, img + cert_dir + cert_dir_size,
+		      headers - cert_dir - cert_dir_size);
+	hashed = headers;
+
+	sections = calloc(n_sections ? n_sections : 1, sizeof(*sections));
+	if (!sections)
+		return -1;
+	for (unsigned int i = 0; i < n_sections; i++) {
+		sections[i].size = get32(sec + i * PE_SECTION_SIZE + 16);
+		sections[i].offset = get32(sec + i * PE_SECTION_SIZE + 20);
+	}
+	qsort(sections, n_sections, sizeof(*sections), cmp_sections);
+	for (unsigned int i = 0; i < n_sections; i++) {
+		if (!sections[i].size)
+			continue;
+		if (sections[i].offset > size ||
+		    sections[i].size > size - sections[i].offset) {
+			free(sections);
+			return LOADER_NOT_PE;
+		}
+		sha256_update(&ctx, img + sections[i].offset,
+			      sections[i].size);
+		hashed += sections[i].size;
+	}
+	free(sections);
+
+	if (size - cert_size > hashed)
+		sha256_update(&ctx, img + hashed, size - cert_size - hashed);
+	sha256_final(&ctx, digest);
+	return LOADER_OK;
+}
+
+static int
+hash_image(int fd, size_t size, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	void *img;
+	int rc;
+
+	img = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (img == MAP_FAILED)
+		return -1;
+	rc = authenticode_sha256(img, size, digest);
+	munmap(img, size);
+	return rc;
+}
+
+int
+check_loader(const char *disk, int part, const char *loader, bool driver,
+	     uint8_t *digest)
+{
+	char sysdir[SYSDIR_MAX];
+	struct stat sb;
+	const char *dir;
+	dev_t dev;
+	int fd, rc;
+
+	if (read_mounts() < 0)
+		return -1;
+
+	if (stat(disk, &sb) < 0)
+		return -1;
+	if (!S_ISBLK(sb.st_mode)) {
+		errno = ENOTBLK;
+		return -1;
+	}
+	dev = sb.st_rdev;
+
+	/* like libefiboot, an unpartitioned disk is its own ESP */
+	sysfs_block_dir(sb.st_rdev, sysdir);
+	if (sysfs_find_partition(sysdir, part > 0 ? part : 1, &dev) < 0 &&
+	    part > 0)
+		return LOADER_NOT_MOUNTED;
+
+	dir = find_esp_mount(dev);
+	if (!dir)
+		return LOADER_NOT_MOUNTED;
+
+	fd = open_nocase(dir, loader);
+	if (fd < 0)
+		return errno == ENOENT || errno == ENOTDIR ? LOADER_MISSING : -1;
+	if (fstat(fd, &sb) < 0) {
+		close(fd);
+		return -1;
+	}
+	rc = S_ISREG(sb.st_mode) ? check_pe(fd, driver) : LOADER_MISSING;
+	if (rc == LOADER_OK && digest)
+		rc = hash_image(fd, sb.st_size, digest);
+	close(fd);
+	return rc;
+}
+
+const char *
+loader_check_str(int rc)
+{
+	switch (rc) {
+	case LOADER_OK:
+		return "ok";
+	case LOADER_NOT_MOUNTED:
+		return "the partition isn't mounted";
+	case LOADER_MISSING:
+		return "no such file on the ESP";
+	case LOADER_NOT_PE:
+		return "not a PE/COFF image";
+	case LOADER_WRONG_MACHINE:
+		return "built for a different machine type than this firmware";
+	case LOADER_WRONG_SUBSYSTEM:
+		return "not an EFI application or driver of the right kind";
+	default:
+		return "could not check";
+	}
+}
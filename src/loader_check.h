@@ -0,0 +1,35 @@
+/*
+ * loader_check.h - make sure a loader is on the ESP before pointing at it
+ *
+ * See "COPYING" for license terms.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LOADER_OK		0
+#define LOADER_NOT_MOUNTED	1
+#define LOADER_MISSING		2
+#define LOADER_NOT_PE		3
+#define LOADER_WRONG_MACHINE	4
+#define LOADER_WRONG_SUBSYSTEM	5
+
+/*
+ * Find where partition part of disk is mounted, either directly or
+ * through an md mirror built on it, and check that loader is there and is
+ * a PE/COFF image this firmware can run: an EFI application, or with
+ * driver set, an EFI driver.  FAT is case insensitive, so the path is
+ * looked up that way.  /proc/self/mountinfo is only read once.
+ *
+ * If digest isn't NULL and the loader checks out, its Authenticode
+ * SHA-256 is stored there.
+ *
+ * Returns one of the LOADER_ values above, or -1 with errno set if we
+ * couldn't tell.
+ */
+extern int check_loader(const char *disk, int part, const char *loader,
+			bool driver, uint8_t *digest);
+
+extern const char *loader_check_str(int rc);
@@ -0,0 +1,437 @@
+/*
+ * microbench.c - time the text and binary codecs efibootmgr and
+ * efibootdump use
+ *
+ * Each case runs one codec, the way its callers do, over a small corpus
+ * of what real load options hold, for a fixed time.  It reports the cost
+ * per call and per input byte, and how many allocations each call makes
+ * when bench/malloc-count.so is preloaded; libefivar's allocations are
+ * counted as well.
+ *
+ * usage: microbench [-t MILLISECONDS] [CASE...]
+ *
+ * See "COPYING" for license terms.
+ */
+
+#include "fix_coverity.h"
+
+#include <err.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uchar.h>
+#include <unistd.h>
+
+#include <efivar.h>
+
+#include "clock.h"
+#include "dp_render.h"
+#include "efi.h"
+#include "efibootmgr.h"
+#include "parse_loader_data.h"
+#include "stats.h"
+
+efibootmgr_opt_t opts;
+int verbose;
+
+typedef struct {
+	const char	*name;
+	const void	*input;
+	size_t		size;
+	int		(*run)(const void *input, size_t size);
+} bench_case_t;
+
+#define MAX_CASES	32
+
+static bench_case_t cases[MAX_CASES];
+static size_t n_cases;
+
+static void
+add_case(const char *name, const void *input, size_t size,
+	 int (*run)(const void *input, size_t size))
+{
+	if (n_cases == MAX_CASES)
+		errx(1, "too many cases");
+	cases[n_cases++] = (bench_case_t){ name, input, size, run };
+}
+
+/*
+ * The corpora
+ */
+static const char linux_args[] =
+	"initrd=\\initramfs-6.8.9-300.fc40.x86_64.img "
+	"root=UUID=4b0a1d66-5e21-4c0f-9a3e-0d5f1ad0c2b7 ro rhgb quiet";
+
+static uint8_t windows_data[8 + 128] = "WINDOWS";
+
+static const efi_guid_t guid_data = EFI_GLOBAL_GUID;
+
+static const char16_t shim_second_stage[] = u"\\grubx64.efi";
+
+static const char16_t long_ascii_ucs2[] =
+	u"initrd=\\initramfs-6.8.9-300.fc40.x86_64.img "
+	u"root=UUID=4b0a1d66-5e21-4c0f-9a3e-0d5f1ad0c2b7 ro rhgb quiet";
+
+static const char16_t non_ascii_ucs2[] =
+	u"Gestionnaire de démarrage Windows — Диспетчер загрузки — 起動マネージャー";
+
+static char *order_text[3];
+
+static char *extra_argv[] = {
+	"root=UUID=4b0a1d66-5e21-4c0f-9a3e-0d5f1ad0c2b7", "ro", "rhgb",
+	"quiet", "crashkernel=auto", "console=ttyS0,115200n8",
+};
+#define N_EXTRA_ARGS (sizeof(extra_argv) / sizeof(extra_argv[0]))
+
+typedef struct {
+	uint8_t		data[512];
+	size_t		size;
+} dp_buf_t;
+
+static dp_buf_t dp_hd_file, dp_nvme, dp_pxe;
+
+static void
+dp_put(dp_buf_t *dp, const void *data, size_t size)
+{
+	if (dp->size + size > sizeof(dp->data))
+		errx(1, "device path corpus is too big");
+	memcpy(dp->data + dp->size, data, size);
+	dp->size += size;
+}
+
+static void
+dp_node(dp_buf_t *dp, uint8_t type, uint8_t subtype, const void *data,
+	uint16_t size)
+{
+	uint16_t length = size + 4;
+
+	dp_put(dp, &type, 1);
+	dp_put(dp, &subtype, 1);
+	dp_put(dp, &length, 2);
+	dp_put(dp, data, size);
+}
+
+static void
+dp_hd(dp_buf_t *dp, uint32_t part)
+{
+	uint8_t hd[38] = { 0 };
+	uint64_t start = 2048, size = 1228800;
+
+	memcpy(hd, &part, 4);
+	memcpy(hd + 4, &start, 8);
+	memcpy(hd + 12, &size, 8);
+	for (int i = 0; i < 16; i++)
+		hd[20 + i] = 0x11 * i;
+	hd[36] = 2;		/* GPT */
+	hd[37] = 2;		/* GUID signature */
+	dp_node(dp, EFIDP_MEDIA_TYPE, EFIDP_MEDIA_HD, hd, sizeof(hd));
+}
+
+static void
+dp_file(dp_buf_t *dp, const char16_t *path)
+{
+	size_t len = 0;
+
+	while (path[len++])
+		;
+	dp_node(dp, EFIDP_MEDIA_TYPE, EFIDP_MEDIA_FILE, path, len * 2);
+}
+
+static void
+dp_end(dp_buf_t *dp)
+{
+	dp_node(dp, EFIDP_END_TYPE, EFIDP_END_ENTIRE, NULL, 0);
+}
+
+static void
+make_corpora(void)
+{
+	uint32_t pciroot[2] = { 0x0a0341d0, 0 };
+	uint8_t pci[2] = { 0, 0x1d };
+	uint8_t nvme[12] = { 1, 0, 0, 0, 0x00, 0x25, 0x38, 0xb5,
+			     0x71, 0xb0, 0x4c, 0x11 };
+	uint8_t mac[33] = { 0x3c, 0xec, 0xef, 0x12, 0x34, 0x56 };
+	uint8_t ipv4[23] = { 0 };
+	static const size_t order_sizes[] = { 10, 100, 1000 };
+
+	for (size_t i = 8; i < sizeof(windows_data); i++)
+		windows_data[i] = i * 37;
+
+	dp_hd(&dp_hd_file, 1);
+	dp_file(&dp_hd_file, u"\\EFI\\fedora\\shimx64.efi");
+	dp_end(&dp_hd_file);
+
+	dp_node(&dp_nvme, EFIDP_ACPI_TYPE, EFIDP_ACPI_HID, pciroot,
+		sizeof(pciroot));
+	dp_node(&dp_nvme, EFIDP_HARDWARE_TYPE, EFIDP_HW_PCI, pci, sizeof(pci));
+	dp_node(&dp_nvme, EFIDP_MESSAGE_TYPE, EFIDP_MSG_NVME, nvme,
+		sizeof(nvme));
+	dp_hd(&dp_nvme, 2);
+	dp_file(&dp_nvme, u"\\EFI\\Microsoft\\Boot\\bootmgfw.efi");
+	dp_end(&dp_nvme);
+
+	mac[32] = 1;		/* Ethernet */
+	dp_node(&dp_pxe, EFIDP_MESSAGE_TYPE, EFIDP_MSG_MAC_ADDR, mac,
+		sizeof(mac));
+	dp_node(&dp_pxe, EFIDP_MESSAGE_TYPE, EFIDP_MSG_IPv4, ipv4,
+		sizeof(ipv4));
+	dp_end(&dp_pxe);
+
+	for (size_t i = 0; i < 3; i++) {
+		size_t n = order_sizes[i];
+		char *s = calloc(n, 5);
+
+		if (!s)
+			err(1, "calloc");
+		order_text[i] = s;
+		for (size_t j = 0; j < n; j++)
+			s += sprintf(s, j ? ",%04zX" : "%04zX", j);
+	}
+}
+
+/*
+ * The cases.  Each does what the code that calls the codec does with
+ * the result, and frees it.
+ */
+typedef ssize_t (*parser_t)(char *buffer, size_t buffer_size,
+			    uint8_t *p, uint64_t length);
+
+static int
+run_parser(parser_t parser, const void *input, size_t size)
+{
+	ssize_t needed;
+	char *text;
+
+	needed = parser(NULL, 0, (uint8_t *)input, size);
+	if (needed < 0)
+		return -1;
+	text = calloc(1, needed + 1);
+	if (!text)
+		return -1;
+	needed = parser(text, needed + 1, (uint8_t *)input, size);
+	free(text);
+	return needed < 0 ? -1 : 0;
+}
+
+static int
+run_raw_text(const void *input, size_t size)
+{
+	return run_parser(parse_raw_text, input, size);
+}
+
+static int
+run_efi_guid(const void *input, size_t size)
+{
+	return run_parser(parse_efi_guid, input, size);
+}
+
+static int
+run_ucs2_to_utf8(const void *input, size_t size)
+{
+	char *text;
+
+	text = ucs2_to_utf8(input, size / 2);
+	if (!text)
+		return -1;
+	free(text);
+	return 0;
+}
+
+static int
+run_parse_order(const void *input, size_t size __attribute__((__unused__)))
+{
+	uint16_t *order;
+	size_t offset;
+	int rc;
+
+	rc = parse_order_text(input, NULL, &order, &offset);
+	if (rc < 0)
+		return -1;
+	free(order);
+	return 0;
+}
+
+static int
+run_extra_args(const void *input __attribute__((__unused__)),
+	       size_t size __attribute__((__unused__)))
+{
+	uint8_t *data;
+	ssize_t rc;
+
+	rc = get_extra_args(&data);
+	if (rc < 0)
+		return -1;
+	free(data);
+	return 0;
+}
+
+static int
+run_extra_args_utf8(const void *input, size_t size)
+{
+	opts.unicode = 0;
+	return run_extra_args(input, size);
+}
+
+static int
+run_extra_args_ucs2(const void *input, size_t size)
+{
+	opts.unicode = 1;
+	return run_extra_args(input, size);
+}
+
+static dp_text_cache_t dp_cache = DP_TEXT_CACHE_INIT;
+
+static int
+run_dp_render_miss(const void *input, size_t size)
+{
+	const char *text;
+
+	text = dp_render(&dp_cache, input, size);
+	dp_text_cache_clear(&dp_cache);
+	return text ? 0 : -1;
+}
+
+static int
+run_dp_render_hit(const void *input, size_t size)
+{
+	return dp_render(&dp_cache, input, size) ? 0 : -1;
+}
+
+static int
+run_dp_is_shim(const void *input, size_t size)
+{
+	dp_is_shim(input, size);
+	return 0;
+}
+
+static bool
+wanted(const char *name, int argc, char *argv[])
+{
+	if (argc == 0)
+		return true;
+	for (int i = 0; i < argc; i++)
+		if (strstr(name, argv[i]))
+			return true;
+	return false;
+}
+
+static void
+run_case(const bench_case_t *c, uint64_t budget)
+{
+	uint64_t calls = 0, batch = 1, start, elapsed;
+	long allocs;
+
+	/* once first, so caches are warm and failures show up */
+	if (c->run(c->input, c->size) < 0) {
+		warn("%s", c->name);
+		return;
+	}
+
+	allocs = stats_allocations();
+	start = now_ns();
+	do {
+		for (uint64_t i = 0; i < batch; i++)
+			c->run(c->input, c->size);
+		calls += batch;
+		batch *= 2;
+		elapsed = now_ns() - start;
+	} while (elapsed < budget);
+
+	printf("%-22s %7zu %10" PRIu64 " %10.1f %9.2f", c->name, c->size,
+	       calls, (double)elapsed / calls,
+	       (double)elapsed / calls / (c->size ? c->size : 1));
+	if (allocs >= 0)
+		printf(" %8.2f\n",
+		       (double)(stats_allocations() - allocs) / calls);
+	else
+		printf(" %8s\n", "-");
+}
+
+static void
+usage(FILE *out, int status)
+{
+	fprintf(out,
+		"usage: microbench [-t MILLISECONDS] [CASE...]\n"
+		"Run each case (or those whose names contain a CASE) for\n"
+		"MILLISECONDS (default 200) and report ns/call, ns/byte and\n"
+		"allocations per call, which are counted when\n"
+		"bench/malloc-count.so is preloaded.\n");
+	exit(status);
+}
+
+int
+main(int argc, char *argv[])
+{
+	uint64_t budget = 200;
+	size_t extra_size = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "t:h")) != -1) {
+		switch (c) {
+		case 't':
+			budget = strtoull(optarg, NULL, 0);
+			if (budget == 0)
+				errx(1, "MILLISECONDS must be more than 0");
+			break;
+		case 'h':
+			usage(stdout, 0);
+			break;
+		default:
+			usage(stderr, 1);
+		}
+	}
+
+	make_corpora();
+	opts.argv = extra_argv;
+	opts.argc = N_EXTRA_ARGS;
+	opts.optind = 0;
+	for (size_t i = 0; i < N_EXTRA_ARGS; i++)
+		extra_size += strlen(extra_argv[i]) + 1;
+
+	add_case("raw-text/ascii", linux_args, strlen(linux_args),
+		 run_raw_text);
+	add_case("raw-text/binary", windows_data, sizeof(windows_data),
+		 run_raw_text);
+	add_case("efi-guid", &guid_data, sizeof(guid_data), run_efi_guid);
+	add_case("ucs2-to-utf8/short", shim_second_stage,
+		 sizeof(shim_second_stage), run_ucs2_to_utf8);
+	add_case("ucs2-to-utf8/ascii", long_ascii_ucs2,
+		 sizeof(long_ascii_ucs2), run_ucs2_to_utf8);
+	add_case("ucs2-to-utf8/bmp", non_ascii_ucs2, sizeof(non_ascii_ucs2),
+		 run_ucs2_to_utf8);
+	add_case("parse-order/10", order_text[0], strlen(order_text[0]),
+		 run_parse_order);
+	add_case("parse-order/100", order_text[1], strlen(order_text[1]),
+		 run_parse_order);
+	add_case("parse-order/1000", order_text[2], strlen(order_text[2]),
+		 run_parse_order);
+	add_case("extra-args/utf8", NULL, extra_size, run_extra_args_utf8);
+	add_case("extra-args/ucs2", NULL, extra_size, run_extra_args_ucs2);
+	add_case("dp-render/hd-file", dp_hd_file.data, dp_hd_file.size,
+		 run_dp_render_miss);
+	add_case("dp-render/nvme", dp_nvme.data, dp_nvme.size,
+		 run_dp_render_miss);
+	add_case("dp-render/pxe", dp_pxe.data, dp_pxe.size,
+		 run_dp_render_miss);
+	add_case("dp-render/cached", dp_nvme.data, dp_nvme.size,
+		 run_dp_render_hit);
+	add_case("dp-is-shim", dp_hd_file.data, dp_hd_file.size,
+		 run_dp_is_shim);
+
+	if (stats_allocations() < 0)
+		fprintf(stderr, "microbench: allocations aren't counted without bench/malloc-count.so preloaded\n");
+	printf("%-22s %7s %10s %10s %9s %8s\n", "case", "bytes", "calls",
+	       "ns/call", "ns/byte", "allocs");
+	for (size_t i = 0; i < n_cases; i++) {
+		if (wanted(cases[i].name, argc - optind, argv + optind))
+			run_case(&cases[i], budget * 1000000);
+	}
+
+	dp_text_cache_free(&dp_cache);
+	for (size_t i = 0; i < 3; i++)
+		free(order_text[i]);
+	return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * nvram_bench.c - measure how long the variable store takes to answer
+ *
+ * See "COPYING" for license terms.
+ */
+
+#include "fix_coverity.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <efivar.h>
+
+#include "clock.h"
+#include "efi.h"
+#include "nvram_bench.h"
+#include "store.h"
+
+/* a vendor GUID of our own, so the scratch variable can't collide */
+#define NVRAM_BENCH_GUID \
+EFI_GUID( 0x3b7a6a4e, 0x1d3f, 0x4f52, 0x9a0c, 0x5e, 0x2d, 0x71, 0x8b, 0x40, 0xc6)
+#define NVRAM_BENCH_NAME	"EfibootmgrBench"
+
+/* bucket n holds latencies from 2^n up to 2^(n+1) microseconds */
+#define N_BUCKETS	26
+#define BAR_WIDTH	40
+
+typedef struct {
+	uint64_t	*samples;	/* nanoseconds */
+	unsigned long	n_samples;
+	uint64_t	total;
+} timings_t;
+
+static void
+record(timings_t *t, uint64_t start)
+{
+	uint64_t ns = now_ns() - start;
+
+	t->samples[t->n_samples++] = ns;
+	t->total += ns;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static unsigned int
+bucket_of(uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	unsigned int n = 0;
+
+	while (us > 1 && n < N_BUCKETS - 1) {
+		us >>= 1;
+		n++;
+	}
+	return n;
+}
+
+static uint64_t
+percentile(const timings_t *t, unsigned int p)
+{
+	unsigned long i = (t->n_samples * p + 99) / 100;
+
+	return t->samples[i ? i - 1 : 0];
+}
+
+static void
+show_timings(const char *what, size_t size, timings_t *t)
+{
+	unsigned long buckets[N_BUCKETS] = { 0 };
+	unsigned long most = 0;
+	unsigned int first = N_BUCKETS, last = 0;
+	double secs = t->total / 1e9;
+
+	qsort(t->samples, t->n_samples, sizeof(*t->samples), cmp_u64);
+	for (unsigned long i = 0; i < t->n_samples; i++) {
+		unsigned int b = bucket_of(t->samples[i]);
+
+		if (++buckets[b] > most)
+			most = buckets[b];
+		if (b < first)
+			first = b;
+		if (b > last)
+			last = b;
+	}
+
+	printf("%s %zu bytes: %lu in %.2f ms, %.0f calls/s, %.2f KiB/s\n",
+	       what, size, t->n_samples, secs * 1e3,
+	       secs > 0 ? t->n_samples / secs : 0,
+	       secs > 0 ? t->n_samples * size / secs / 1024 : 0);
+	printf("  min %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+	       t->samples[0] / 1e3, percentile(t, 50) / 1e3,
+	       percentile(t, 99) / 1e3,
+	       t->samples[t->n_samples - 1] / 1e3);
+	for (unsigned int b = first; b <= last; b++) {
+		int width = (buckets[b] * BAR_WIDTH + most - 1) / most;
+
+		printf("  %9" PRIu64 " us |%-*.*s %lu\n",
+		       b ? UINT64_C(1) << b : 0, BAR_WIDTH, width,
+		       "########################################", buckets[b]);
+	}
+}
+
+unsigned long
+nvram_bench_writes(const nvram_bench_t *bench)
+{
+	return bench->count * bench->n_sizes + 1;
+}
+
+static int
+bench_size(const nvram_bench_t *bench, size_t size, timings_t *writes,
+	   timings_t *reads)
+{
+	efi_guid_t guid = NVRAM_BENCH_GUID;
+	uint32_t attributes = EFI_VARIABLE_NON_VOLATILE |
+			      EFI_VARIABLE_BOOTSERVICE_ACCESS |
+			      EFI_VARIABLE_RUNTIME_ACCESS;
+	uint8_t *data;
+	int rc = 0;
+
+	data = malloc(size);
+	if (!data)
+		return -1;
+	for (size_t i = 0; i < size; i++)
+		data[i] = i * 31;
+
+	writes->n_samples = writes->total = 0;
+	for (unsigned long i = 0; i < bench->count; i++) {
+		uint64_t start;
+
+		/* never write the same thing twice in a row */
+		memcpy(data, &i, size < sizeof(i) ? size : sizeof(i));
+		start = now_ns();
+		rc = store_set_variable(guid, NVRAM_BENCH_NAME, data, size,
+					attributes, 0600);
+		record(writes, start);
+		if (rc < 0) {
+			efi_error("could not write %s", NVRAM_BENCH_NAME);
+			goto out;
+		}
+	}
+
+	reads->n_samples = reads->total = 0;
+	for (unsigned long i = 0; i < bench->count; i++) {
+		uint8_t *read_data = NULL;
+		size_t read_size = 0;
+		uint32_t read_attributes;
+		uint64_t start;
+
+		start = now_ns();
+		rc = store_get_variable(guid, NVRAM_BENCH_NAME, &read_data,
+					&read_size, &read_attributes);
+		record(reads, start);
+		free(read_data);
+		if (rc < 0) {
+			efi_error("could not read %s", NVRAM_BENCH_NAME);
+			goto out;
+		}
+		if (read_size != size) {
+			efi_error("read %zu bytes of %s, but wrote %zu",
+				  read_size, NVRAM_BENCH_NAME, size);
+			errno = EIO;
+			rc = -1;
+			goto out;
+		}
+	}
+out:
+	free(data);
+	return rc;
+}
+
+int
+nvram_bench(const nvram_bench_t *bench)
+{
+	efi_guid_t guid = NVRAM_BENCH_GUID;
+	timings_t writes = { 0 }, reads = { 0 };
+	int rc = 0, saved_errno;
+
+	if (nvram_bench_writes(bench) > bench->max_writes) {
+		errno = E2BIG;
+		return -1;
+	}
+
+	writes.samples = calloc(bench->count, sizeof(*writes.samples));
+	reads.samples = calloc(bench->count, sizeof(*reads.samples));
+	if (!writes.samples || !reads.samples) {
+		rc = -1;
+		goto out;
+	}
+
+	for (size_t i = 0; i < bench->n_sizes; i++) {
+		rc = bench_size(bench, bench->sizes[i], &writes, &reads);
+		if (rc < 0)
+			goto out;
+		show_timings("write", bench->sizes[i], &writes);
+		show_timings("read", bench->sizes[i], &reads);
+	}
+out:
+	saved_errno = errno;
+	if (store_del_variable(guid, NVRAM_BENCH_NAME) < 0 &&
+	    errno != ENOENT && rc == 0) {
+		efi_error("could not delete %s", NVRAM_BENCH_NAME);
+		saved_errno = errno;
+		rc = -1;
+	}
+	free(writes.samples);
+	free(reads.samples);
+	errno = saved_errno;
+	return rc;
+}
@@ -0,0 +1,35 @@
+/*
+ * nvram_bench.h - measure how long the variable store takes to answer
+ *
+ * See "COPYING" for license terms.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#define NVRAM_BENCH_MAX_SIZES		8
+#define NVRAM_BENCH_MAX_DATA_SIZE	65536
+#define NVRAM_BENCH_DEFAULT_MAX_WRITES	1000
+
+typedef struct {
+	unsigned long	count;		/* writes and reads of each size */
+	size_t		sizes[NVRAM_BENCH_MAX_SIZES];
+	size_t		n_sizes;
+	unsigned long	max_writes;	/* refuse to run if we'd do more */
+} nvram_bench_t;
+
+/*
+ * The number of times bench will write to the store, deleting the
+ * scratch variable included.
+ */
+extern unsigned long nvram_bench_writes(const nvram_bench_t *bench);
+
+/*
+ * Write and then read a scratch variable in our own vendor GUID
+ * bench->count times for each size, timing every call, and print a
+ * latency histogram and the throughput for each.  The variable is
+ * deleted afterwards, even if a call fails.  Returns 0, or -1 with errno
+ * set (E2BIG if it would take more than bench->max_writes writes).
+ */
+extern int nvram_bench(const nvram_bench_t *bench);
@@ -80,3 +80,39 @@ parse_raw_text(char *buf, size_t buf_size, uint8_t *p, uint64_t length)
 	}
 	return buf_offset;
 }
+
+#define ev_bits(val, mask, shift) \
+	(((val) & ((mask) << (shift))) >> (shift))
+
+char *
+ucs2_to_utf8(const uint16_t * const chars, ssize_t limit)
+{
+	ssize_t i, j;
+	char *ret;
+
+	/*
+	 * Every UCS-2 character fits in three bytes.  This runs on names
+	 * straight out of --image files, so it's on the heap, not the stack.
+	 */
+	if (limit < 0)
+		for (limit = 0; chars[limit]; limit++)
+			;
+	ret = malloc(limit * 3 + 1);
+	if (!ret)
+		return NULL;
+
+	for (i=0, j=0; i < limit && chars[i]; i++,j++) {
+		if (chars[i] <= 0x7f) {
+			ret[j] = chars[i];
+		} else if (chars[i] > 0x7f && chars[i] <= 0x7ff) {
+			ret[j++] = 0xc0 | ev_bits(chars[i], 0x1f, 6);
+			ret[j]   = 0x80 | ev_bits(chars[i], 0x3f, 0);
+		} else if (chars[i] > 0x7ff) {
+			ret[j++] = 0xe0 | ev_bits(chars[i], 0xf, 12);
+			ret[j++] = 0x80 | ev_bits(chars[i], 0x3f, 6);
+			ret[j]   = 0x80| ev_bits(chars[i], 0x3f, 0);
+		}
+	}
+	ret[j] = '\0';
+	return ret;
+}
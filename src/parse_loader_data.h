@@ -26,3 +26,9 @@ ssize_t parse_efi_guid(char *buffer, size_t buffer_size,
 		       uint8_t *p, uint64_t length);
 ssize_t parse_raw_text(char *buffer, size_t buffer_size,
 		       uint8_t *p, uint64_t length);
+
+/*
+ * Convert at most limit UCS-2 characters (or up to the NUL, if limit is
+ * negative) to UTF-8 in a string we allocate.
+ */
+char *ucs2_to_utf8(const uint16_t * const chars, ssize_t limit);
@@ -0,0 +1,242 @@
+/*
+ * sha256.c - SHA-256, using the SHA extensions where the CPU has them
+ *
+ * See "COPYING" for license terms.
+ */
+
+#include "fix_coverity.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_SHA_NI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include "sha256.h"
+
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n)	((x) >> (n) | (x) << (32 - (n)))
+
+static void
+sha256_blocks_generic(uint32_t state[8], const uint8_t *data, size_t n)
+{
+	uint32_t w[64];
+
+	for (; n; n--, data += 64) {
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+		uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+		for (int i = 0; i < 16; i++)
+			w[i] = (uint32_t)data[i * 4] << 24 |
+			       (uint32_t)data[i * 4 + 1] << 16 |
+			       (uint32_t)data[i * 4 + 2] << 8 |
+			       (uint32_t)data[i * 4 + 3];
+		for (int i = 16; i < 64; i++) {
+			uint32_t s0 = ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^
+				      (w[i-15] >> 3);
+			uint32_t s1 = ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^
+				      (w[i-2] >> 10);
+			w[i] = w[i-16] + s0 + w[i-7] + s1;
+		}
+
+		for (int i = 0; i < 64; i++) {
+			uint32_t t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) +
+				      ((e & f) ^ (~e & g)) + K[i] + w[i];
+			uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) +
+				      ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+#ifdef HAVE_SHA_NI
+/*
+ * Four rounds per sha256rnds2 pair.  The message schedule runs three
+ * groups ahead in msg[], which is why sha256msg1 stops at group 12 and
+ * sha256msg2 at group 14.
+ */
+static void __attribute__((target("sha,sse4.1")))
+sha256_blocks_shani(uint32_t state[8], const uint8_t *data, size_t n)
+{
+	const __m128i shuf = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					    0x0405060700010203ULL);
+	__m128i state0, state1, msg[4], m, tmp, abef, cdgh;
+
+	/* the instructions want ABEF and CDGH, not ABCD and EFGH */
+	tmp = _mm_loadu_si128((const __m128i *)&state[0]);
+	state1 = _mm_loadu_si128((const __m128i *)&state[4]);
+	tmp = _mm_shuffle_epi32(tmp, 0xb1);
+	state1 = _mm_shuffle_epi32(state1, 0x1b);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+	for (; n; n--, data += 64) {
+		abef = state0;
+		cdgh = state1;
+
+		for (int i = 0; i < 16; i++) {
+			__m128i *cur = &msg[i % 4];
+
+			if (i < 4)
+				*cur = _mm_shuffle_epi8(_mm_loadu_si128(
+					(const __m128i *)(data + i * 16)), shuf);
+			m = _mm_add_epi32(*cur, _mm_loadu_si128(
+						(const __m128i *)&K[i * 4]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+			if (i >= 3 && i < 15) {
+				__m128i *next = &msg[(i + 1) % 4];
+
+				tmp = _mm_alignr_epi8(*cur, msg[(i + 3) % 4], 4);
+				*next = _mm_add_epi32(*next, tmp);
+				*next = _mm_sha256msg2_epu32(*next, *cur);
+			}
+			m = _mm_shuffle_epi32(m, 0x0e);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, m);
+			if (i >= 1 && i < 13)
+				msg[(i + 3) % 4] = _mm_sha256msg1_epu32(
+						msg[(i + 3) % 4], *cur);
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+	_mm_storeu_si128((__m128i *)&state[0], state0);
+	_mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+static bool
+have_sha_ni(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+	    !(ecx & bit_SSE4_1) || !(ecx & bit_SSSE3))
+		return false;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return false;
+	return ebx & bit_SHA;
+}
+#endif
+
+static void
+sha256_blocks(uint32_t state[8], const uint8_t *data, size_t n)
+{
+#ifdef HAVE_SHA_NI
+	static int use_sha_ni = -1;
+
+	if (use_sha_ni < 0)
+		use_sha_ni = have_sha_ni();
+	if (use_sha_ni) {
+		sha256_blocks_shani(state, data, n);
+		return;
+	}
+#endif
+	sha256_blocks_generic(state, data, n);
+}
+
+void
+sha256_init(sha256_ctx_t *ctx)
+{
+	static const uint32_t iv[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	memcpy(ctx->state, iv, sizeof(iv));
+	ctx->length = 0;
+	ctx->buf_len = 0;
+}
+
+void
+sha256_update(sha256_ctx_t *ctx, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+
+	ctx->length += size;
+	if (ctx->buf_len) {
+		size_t n = sizeof(ctx->buf) - ctx->buf_len;
+
+		if (n > size)
+			n = size;
+		memcpy(ctx->buf + ctx->buf_len, p, n);
+		ctx->buf_len += n;
+		p += n;
+		size -= n;
+		if (ctx->buf_len < sizeof(ctx->buf))
+			return;
+		sha256_blocks(ctx->state, ctx->buf, 1);
+		ctx->buf_len = 0;
+	}
+
+	/* whole blocks straight from the caller's buffer */
+	if (size >= 64) {
+		sha256_blocks(ctx->state, p, size / 64);
+		p += size & ~(size_t)63;
+		size &= 63;
+	}
+	memcpy(ctx->buf, p, size);
+	ctx->buf_len = size;
+}
+
+void
+sha256_final(sha256_ctx_t *ctx, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	uint64_t bits = ctx->length * 8;
+	uint8_t pad[72] = { 0x80, };
+	size_t pad_len;
+
+	pad_len = (ctx->buf_len < 56 ? 56 : 120) - ctx->buf_len;
+	for (int i = 0; i < 8; i++)
+		pad[pad_len + i] = bits >> (56 - i * 8);
+	sha256_update(ctx, pad, pad_len + 8);
+
+	for (int i = 0; i < 8; i++) {
+		digest[i * 4] = ctx->state[i] >> 24;
+		digest[i * 4 + 1] = ctx->state[i] >> 16;
+		digest[i * 4 + 2] = ctx->state[i] >> 8;
+		digest[i * 4 + 3] = ctx->state[i];
+	}
+}
@@ -0,0 +1,24 @@
+/*
+ * sha256.h - SHA-256, using the SHA extensions where the CPU has them
+ *
+ * See "COPYING" for license terms.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE	32
+
+typedef struct {
+	uint32_t	state[8];
+	uint64_t	length;
+	uint8_t		buf[64];
+	size_t		buf_len;
+} sha256_ctx_t;
+
+extern void sha256_init(sha256_ctx_t *ctx);
+extern void sha256_update(sha256_ctx_t *ctx, const void *data, size_t size);
+extern void sha256_final(sha256_ctx_t *ctx,
+			 uint8_t digest[SHA256_DIGEST_SIZE]);
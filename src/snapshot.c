@@ -0,0 +1,624 @@
+/*
+ * snapshot.c - archives of the boot configuration variables
+ *
+ * See "COPYING" for license terms.
+ */
+
+#include "fix_coverity.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <efivar.h>
+
+#include "efi.h"
+#include "hash.h"
+#include "snapshot.h"
+#include "store.h"
+
+/*
+ * An archive is little-endian throughout, and laid out as:
+ *
+ *   the header
+ *   the index, one snap_index_t per variable, sorted by GUID then name
+ *   the names, as NUL-terminated UTF-8
+ *   the data of each variable, starting on an 8-byte boundary
+ *
+ * The checksum covers everything after the header.
+ */
+#define SNAP_MAGIC	"EBMSNAP"
+#define SNAP_VERSION	1
+#define SNAP_ALIGN(x)	(((x) + 7) & ~(size_t)7)
+
+/*
+ * Apple firmware sets the high bit of the attributes, which the kernel
+ * won't take back, so like read_order() we never keep it.
+ */
+#define SNAP_ATTRIBUTES(a)	((a) & ~(UINT32_C(1) << 31))
+
+typedef struct {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	count;
+	uint64_t	size;		/* of the whole archive */
+	uint64_t	checksum;
+} snap_header_t;
+
+typedef struct {
+	efi_guid_t	guid;
+	uint32_t	attributes;
+	uint32_t	name_offset;
+	uint32_t	name_size;	/* including the NUL */
+	uint32_t	data_size;
+	uint64_t	data_offset;
+} snap_index_t;
+
+struct snapshot {
+	uint8_t		*map;
+	size_t		map_size;
+	snap_index_t	*index;
+	size_t		count;
+};
+
+static bool
+is_load_option(const efi_guid_t *guid, const char *name)
+{
+	static const char * const prefixes[] = { "Boot", "Driver", "SysPrep" };
+
+	if (efi_guid_cmp(guid, &efi_guid_global))
+		return false;
+	for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+		size_t len = strlen(prefixes[i]);
+
+		if (!strncmp(name, prefixes[i], len) &&
+		    strlen(name + len) == 4 &&
+		    strspn(name + len, "0123456789ABCDEFabcdef") == 4)
+			return true;
+	}
+	return false;
+}
+
+bool
+snapshot_wants(const efi_guid_t *guid, const char *name)
+{
+	static const char * const globals[] = {
+		"BootOrder", "DriverOrder", "SysPrepOrder",
+		"BootNext", "Timeout",
+	};
+
+	if (is_load_option(guid, name))
+		return true;
+	if (!efi_guid_cmp(guid, &efi_guid_global)) {
+		for (size_t i = 0; i < sizeof(globals) / sizeof(globals[0]); i++)
+			if (!strcmp(name, globals[i]))
+				return true;
+		return false;
+	}
+	return !efi_guid_cmp(guid, &ADDRESS_RANGE_MIRROR_VARIABLE_GUID) &&
+	       (!strcmp(name, ADDRESS_RANGE_MIRROR_VARIABLE_REQUEST) ||
+		!strcmp(name, ADDRESS_RANGE_MIRROR_VARIABLE_CURRENT));
+}
+
+/* The firmware sets MirrorCurrent to say what it did with the request. */
+static bool
+restorable(const efi_guid_t *guid, const char *name)
+{
+	return snapshot_wants(guid, name) &&
+	       (efi_guid_cmp(guid, &ADDRESS_RANGE_MIRROR_VARIABLE_GUID) ||
+		strcmp(name, ADDRESS_RANGE_MIRROR_VARIABLE_CURRENT));
+}
+
+/* the order of the index; the bytes of the GUID, so every host agrees */
+static int
+cmp_key(const efi_guid_t *guid1, const char *name1,
+	const efi_guid_t *guid2, const char *name2)
+{
+	int rc = memcmp(guid1, guid2, sizeof(*guid1));
+
+	return rc ? rc : strcmp(name1, name2);
+}
+
+typedef struct {
+	efi_guid_t	guid;
+	char		*name;
+	uint8_t		*data;
+	size_t		data_size;
+	uint32_t	attributes;
+} snap_var_t;
+
+static int
+cmp_snap_vars(const void *p1, const void *p2)
+{
+	const snap_var_t *v1 = p1;
+	const snap_var_t *v2 = p2;
+
+	return cmp_key(&v1->guid, v1->name, &v2->guid, v2->name);
+}
+
+static void
+free_snap_vars(snap_var_t *vars, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		free(vars[i].name);
+		free(vars[i].data);
+	}
+	free(vars);
+}
+
+/*
+ * Take the names in one pass over the store, then read each one.  The
+ * walk has to run to the end even when we give up, or the next one
+ * would start partway through.
+ */
+static int
+read_snap_vars(snap_var_t **varsp, size_t *np)
+{
+	snap_var_t *vars = NULL;
+	size_t n = 0, size = 0, kept = 0;
+	efi_guid_t *guid;
+	char *name;
+	int rc, saved_errno;
+
+	while ((rc = store_get_next_variable_name(&guid, &name)) > 0) {
+		if (!snapshot_wants(guid, name))
+			continue;
+		if (n == size) {
+			size_t new_size = size ? size * 2 : 64;
+			snap_var_t *tmp;
+
+			tmp = realloc(vars, new_size * sizeof(*tmp));
+			if (!tmp)
+				goto err_drain;
+			vars = tmp;
+			size = new_size;
+		}
+		memset(&vars[n], 0, sizeof(vars[n]));
+		vars[n].guid = *guid;
+		vars[n].name = strdup(name);
+		if (!vars[n].name)
+			goto err_drain;
+		n++;
+	}
+	if (rc < 0)
+		goto err;
+
+	for (size_t i = 0; i < n; i++) {
+		snap_var_t *var = &vars[i];
+
+		rc = store_get_variable(var->guid, var->name, &var->data,
+					&var->data_size, &var->attributes);
+		if (rc < 0 && errno != ENOENT)
+			goto err;
+		/* it went away since we saw its name */
+		if (rc < 0) {
+			free(var->name);
+			var->name = NULL;
+		}
+		var->attributes = SNAP_ATTRIBUTES(var->attributes);
+	}
+	for (size_t i = 0; i < n; i++)
+		if (vars[i].name)
+			vars[kept++] = vars[i];
+
+	qsort(vars, kept, sizeof(*vars), cmp_snap_vars);
+	*varsp = vars;
+	*np = kept;
+	return 0;
+err_drain:
+	saved_errno = errno;
+	while (store_get_next_variable_name(&guid, &name) > 0)
+		;
+	errno = saved_errno;
+err:
+	saved_errno = errno;
+	free_snap_vars(vars, n);
+	errno = saved_errno;
+	return -1;
+}
+
+static uint8_t *
+build_archive(snap_var_t *vars, size_t n, size_t *sizep)
+{
+	size_t names_off = sizeof(snap_header_t) + n * sizeof(snap_index_t);
+	size_t off = names_off, data_off;
+	snap_header_t hdr;
+	uint8_t *buf;
+
+	for (size_t i = 0; i < n; i++) {
+		if (vars[i].data_size > UINT32_MAX)
+			goto toobig;
+		off += strlen(vars[i].name) + 1;
+	}
+	if (off > UINT32_MAX)
+		goto toobig;
+	data_off = off = SNAP_ALIGN(off);
+	for (size_t i = 0; i < n; i++)
+		off = SNAP_ALIGN(off + vars[i].data_size);
+
+	buf = calloc(1, off);
+	if (!buf)
+		return NULL;
+
+	for (size_t i = 0; i < n; i++) {
+		size_t name_size = strlen(vars[i].name) + 1;
+		snap_index_t idx = {
+			.guid = vars[i].guid,
+			.attributes = htole32(vars[i].attributes),
+			.name_offset = htole32(names_off),
+			.name_size = htole32(name_size),
+			.data_size = htole32(vars[i].data_size),
+			.data_offset = htole64(data_off),
+		};
+
+		memcpy(buf + sizeof(hdr) + i * sizeof(idx), &idx, sizeof(idx));
+		memcpy(buf + names_off, vars[i].name, name_size);
+		memcpy(buf + data_off, vars[i].data, vars[i].data_size);
+		names_off += name_size;
+		data_off = SNAP_ALIGN(data_off + vars[i].data_size);
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAP_MAGIC, sizeof(SNAP_MAGIC));
+	hdr.version = htole32(SNAP_VERSION);
+	hdr.count = htole32(n);
+	hdr.size = htole64(off);
+	hdr.checksum = htole64(fnv1a64(buf + sizeof(hdr), off - sizeof(hdr),
+				       FNV1A64_INIT));
+	memcpy(buf, &hdr, sizeof(hdr));
+	*sizep = off;
+	return buf;
+toobig:
+	errno = EFBIG;
+	return NULL;
+}
+
+/* Write to a new file and rename it, so there's never half an archive. */
+static int
+write_archive(const char *path, const uint8_t *buf, size_t size)
+{
+	char tmp[PATH_MAX];
+	int fd, rc, saved_errno;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >=
+	    (int)sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	for (size_t off = 0; off < size; ) {
+		ssize_t n = write(fd, buf + off, size - off);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			goto err;
+		off += n;
+	}
+	if (fsync(fd) < 0)
+		goto err;
+	rc = close(fd);
+	fd = -1;
+	if (rc < 0 || rename(tmp, path) < 0)
+		goto err;
+	return 0;
+err:
+	saved_errno = errno;
+	if (fd >= 0)
+		close(fd);
+	unlink(tmp);
+	errno = saved_errno;
+	return -1;
+}
+
+ssize_t
+snapshot_export(const char *path)
+{
+	snap_var_t *vars;
+	uint8_t *buf;
+	size_t n, size;
+	int rc, saved_errno;
+
+	if (read_snap_vars(&vars, &n) < 0) {
+		efi_error("could not read the boot variables");
+		return -1;
+	}
+	buf = build_archive(vars, n, &size);
+	saved_errno = errno;
+	free_snap_vars(vars, n);
+	if (!buf) {
+		errno = saved_errno;
+		return -1;
+	}
+	rc = write_archive(path, buf, size);
+	saved_errno = errno;
+	free(buf);
+	if (rc < 0) {
+		efi_error("could not write %s", path);
+		errno = saved_errno;
+		return -1;
+	}
+	return n;
+}
+
+static int
+check_archive(snapshot_t *snap)
+{
+	snap_header_t hdr;
+	size_t count;
+
+	if (snap->map_size < sizeof(hdr))
+		goto inval;
+	memcpy(&hdr, snap->map, sizeof(hdr));
+	count = le32toh(hdr.count);
+	if (memcmp(hdr.magic, SNAP_MAGIC, sizeof(SNAP_MAGIC)) ||
+	    le32toh(hdr.version) != SNAP_VERSION ||
+	    le64toh(hdr.size) != snap->map_size ||
+	    count > (snap->map_size - sizeof(hdr)) / sizeof(snap_index_t))
+		goto inval;
+	if (le64toh(hdr.checksum) !=
+	    fnv1a64(snap->map + sizeof(hdr), snap->map_size - sizeof(hdr),
+		    FNV1A64_INIT)) {
+		efi_error("snapshot checksum is wrong");
+		goto inval;
+	}
+
+	snap->index = (snap_index_t *)(snap->map + sizeof(hdr));
+	snap->count = count;
+	for (size_t i = 0; i < count; i++) {
+		const snap_index_t *idx = &snap->index[i];
+		size_t name_off = le32toh(idx->name_offset);
+		size_t name_size = le32toh(idx->name_size);
+		uint64_t data_off = le64toh(idx->data_offset);
+		const char *name = (const char *)snap->map + name_off;
+
+		if (name_size < 2 || name_off > snap->map_size ||
+		    name_size > snap->map_size - name_off ||
+		    strnlen(name, name_size) != name_size - 1 ||
+		    data_off % 8 || data_off > snap->map_size ||
+		    le32toh(idx->data_size) > snap->map_size - data_off)
+			goto inval;
+		/* sorted, or lookups won't find things */
+		if (i && cmp_key(&idx[-1].guid,
+				 (const char *)snap->map +
+				 le32toh(idx[-1].name_offset),
+				 &idx->guid, name) >= 0)
+			goto inval;
+	}
+	return 0;
+inval:
+	efi_error("not a boot variable snapshot");
+	errno = EINVAL;
+	return -1;
+}
+
+int
+snapshot_open(const char *path, snapshot_t **snapp)
+{
+	snapshot_t *snap;
+	struct stat sb;
+	int fd, saved_errno;
+
+	snap = calloc(1, sizeof(*snap));
+	if (!snap)
+		return -1;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		goto err;
+	if (fstat(fd, &sb) < 0)
+		goto err;
+	if (!S_ISREG(sb.st_mode) || sb.st_size == 0) {
+		errno = EINVAL;
+		goto err;
+	}
+	snap->map_size = sb.st_size;
+	snap->map = mmap(NULL, snap->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (snap->map == MAP_FAILED) {
+		snap->map = NULL;
+		goto err;
+	}
+	close(fd);
+	fd = -1;
+	if (check_archive(snap) < 0)
+		goto err;
+
+	*snapp = snap;
+	return 0;
+err:
+	saved_errno = errno;
+	efi_error("could not open snapshot %s", path);
+	if (fd >= 0)
+		close(fd);
+	snapshot_close(snap);
+	errno = saved_errno;
+	return -1;
+}
+
+void
+snapshot_close(snapshot_t *snap)
+{
+	if (!snap)
+		return;
+	if (snap->map)
+		munmap(snap->map, snap->map_size);
+	free(snap);
+}
+
+static const char *
+index_name(snapshot_t *snap, const snap_index_t *idx)
+{
+	return (const char *)snap->map + le32toh(idx->name_offset);
+}
+
+int
+snapshot_get(snapshot_t *snap, const efi_guid_t *guid, const char *name,
+	     const uint8_t **data, size_t *data_size, uint32_t *attributes)
+{
+	size_t lo = 0, hi = snap->count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const snap_index_t *idx = &snap->index[mid];
+		int rc = cmp_key(guid, name, &idx->guid, index_name(snap, idx));
+
+		if (rc < 0) {
+			hi = mid;
+		} else if (rc > 0) {
+			lo = mid + 1;
+		} else {
+			if (data)
+				*data = snap->map + le64toh(idx->data_offset);
+			if (data_size)
+				*data_size = le32toh(idx->data_size);
+			if (attributes)
+				*attributes = le32toh(idx->attributes);
+			return 0;
+		}
+	}
+	errno = ENOENT;
+	return -1;
+}
+
+int
+snapshot_next(snapshot_t *snap, size_t *iter, efi_guid_t **guid, char **name)
+{
+	snap_index_t *idx;
+
+	if (*iter >= snap->count)
+		return 0;
+	idx = &snap->index[(*iter)++];
+	*guid = &idx->guid;
+	*name = (char *)index_name(snap, idx);
+	return 1;
+}
+
+static int
+restore_var(snapshot_t *snap, const snap_index_t *idx, size_t *written)
+{
+	efi_guid_t guid = idx->guid;
+	const char *name = index_name(snap, idx);
+	const uint8_t *data = snap->map + le64toh(idx->data_offset);
+	size_t data_size = le32toh(idx->data_size);
+	uint32_t attributes = SNAP_ATTRIBUTES(le32toh(idx->attributes));
+	uint8_t *cur = NULL;
+	size_t cur_size = 0;
+	uint32_t cur_attributes = 0;
+	int rc;
+
+	rc = store_get_variable(guid, name, &cur, &cur_size, &cur_attributes);
+	if (rc < 0 && errno != ENOENT)
+		return -1;
+	if (rc == 0) {
+		bool same;
+
+		cur_attributes = SNAP_ATTRIBUTES(cur_attributes);
+		same = cur_attributes == attributes &&
+			    cur_size == data_size &&
+			    !memcmp(cur, data, data_size);
+
+		free(cur);
+		if (same) {
+			store_skipped_write();
+			return 0;
+		}
+		/* the attributes can't be changed without deleting it */
+		if (cur_attributes != attributes &&
+		    store_del_variable(guid, name) < 0)
+			return -1;
+	}
+	if (store_set_variable(guid, name, data, data_size, attributes,
+			       0644) < 0) {
+		efi_error("could not restore %s", name);
+		return -1;
+	}
+	(*written)++;
+	return 0;
+}
+
+int
+snapshot_import(snapshot_t *snap, bool prune, size_t *written,
+		size_t *deleted)
+{
+	snap_var_t *extra = NULL;
+	size_t n_extra = 0;
+	efi_guid_t *guid;
+	char *name;
+	int rc, saved_errno;
+
+	*written = *deleted = 0;
+
+	/*
+	 * The entries go first, so the Order variables never point at
+	 * something that isn't there yet.
+	 */
+	for (int pass = 0; pass < 2; pass++) {
+		for (size_t i = 0; i < snap->count; i++) {
+			const snap_index_t *idx = &snap->index[i];
+			efi_guid_t idx_guid = idx->guid;
+			const char *idx_name = index_name(snap, idx);
+
+			if (!restorable(&idx_guid, idx_name) ||
+			    is_load_option(&idx_guid, idx_name) != !pass)
+				continue;
+			if (restore_var(snap, idx, written) < 0)
+				return -1;
+		}
+	}
+
+	if (!prune)
+		return 0;
+
+	/* Then whatever the snapshot doesn't have goes. */
+	while ((rc = store_get_next_variable_name(&guid, &name)) > 0) {
+		snap_var_t *tmp;
+
+		if (!restorable(guid, name) ||
+		    snapshot_get(snap, guid, name, NULL, NULL, NULL) == 0)
+			continue;
+		tmp = realloc(extra, (n_extra + 1) * sizeof(*tmp));
+		if (!tmp)
+			goto err_drain;
+		extra = tmp;
+		memset(&extra[n_extra], 0, sizeof(extra[n_extra]));
+		extra[n_extra].guid = *guid;
+		extra[n_extra].name = strdup(name);
+		if (!extra[n_extra].name)
+			goto err_drain;
+		n_extra++;
+	}
+	if (rc < 0)
+		goto err;
+
+	for (size_t i = 0; i < n_extra; i++) {
+		rc = store_del_variable(extra[i].guid, extra[i].name);
+		if (rc < 0 && errno != ENOENT) {
+			efi_error("could not delete %s", extra[i].name);
+			goto err;
+		}
+		if (rc == 0)
+			(*deleted)++;
+	}
+	free_snap_vars(extra, n_extra);
+	return 0;
+err_drain:
+	saved_errno = errno;
+	while (store_get_next_variable_name(&guid, &name) > 0)
+		;
+	errno = saved_errno;
+err:
+	saved_errno = errno;
+	free_snap_vars(extra, n_extra);
+	errno = saved_errno;
+	return -1;
+}
@@ -0,0 +1,62 @@
+/*
+ * snapshot.h - archives of the boot configuration variables
+ *
+ * See "COPYING" for license terms.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <efivar.h>
+
+typedef struct snapshot snapshot_t;
+
+/*
+ * Whether guid/name is part of the boot configuration a snapshot holds:
+ * the Boot####, Driver#### and SysPrep#### entries, their Order
+ * variables, BootNext, Timeout, and the address range mirror variables.
+ */
+extern bool snapshot_wants(const efi_guid_t *guid, const char *name);
+
+/*
+ * Save every such variable in the current store to a new archive at path,
+ * which replaces any file already there.  Returns the number of variables
+ * saved, or -1 with errno set.
+ */
+extern ssize_t snapshot_export(const char *path);
+
+/*
+ * Map an archive written by snapshot_export().  It's checked for damage
+ * and then used in place.  Returns 0 and sets *snapp, or -1 with errno set
+ * (EINVAL if it isn't an archive we understand).
+ */
+extern int snapshot_open(const char *path, snapshot_t **snapp);
+extern void snapshot_close(snapshot_t *snap);
+
+/*
+ * Look up a variable.  *data points into the mapping and stays valid until
+ * snapshot_close().  Returns -1 with errno set to ENOENT if it isn't there.
+ */
+extern int snapshot_get(snapshot_t *snap, const efi_guid_t *guid,
+			const char *name, const uint8_t **data,
+			size_t *data_size, uint32_t *attributes);
+
+/*
+ * Walk the variables in (GUID, name) order.  Start with *iter at 0;
+ * returns 1 with *guid and *name set, then 0 at the end.
+ */
+extern int snapshot_next(snapshot_t *snap, size_t *iter, efi_guid_t **guid,
+			 char **name);
+
+/*
+ * Make the current store's boot configuration match snap.  Only the
+ * variables whose data or attributes differ are written.  With prune set,
+ * the ones snap doesn't have are deleted; otherwise they're left alone.
+ * *written and *deleted count what was done, even when it fails partway.
+ */
+extern int snapshot_import(snapshot_t *snap, bool prune, size_t *written,
+			   size_t *deleted);
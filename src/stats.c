@@ -0,0 +1,152 @@
+/*
+ * stats.c - where a run's time goes, for --stats
+ *
+ * See "COPYING" for license terms.
+ */
+
+#include "fix_coverity.h"
+
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "clock.h"
+#include "stats.h"
+#include "store.h"
+
+static const char * const phase_names[STATS_N_PHASES] = {
+	[STATS_SETUP] = "setup",
+	[STATS_ENUMERATE] = "enumerate",
+	[STATS_READ_VARS] = "read_vars",
+	[STATS_SET_VAR_NUMS] = "set_var_nums",
+	[STATS_MUTATE] = "mutations",
+	[STATS_RENDER] = "render",
+};
+
+static bool running;
+static bool as_json;
+static stats_phase_t current;
+static uint64_t phase_wall, phase_cpu;
+static uint64_t wall_ns[STATS_N_PHASES], cpu_ns[STATS_N_PHASES];
+
+/*
+ * Allocations are counted by bench/malloc-count.so, if it's preloaded,
+ * rather than by a malloc() of our own that would be in the way of
+ * static builds and sanitizers.
+ */
+long
+stats_allocations(void)
+{
+	static unsigned long (*count)(void);
+	static bool looked;
+
+	if (!looked) {
+		count = (unsigned long (*)(void))dlsym(RTLD_DEFAULT,
+							 "malloc_count");
+		looked = true;
+	}
+	return count ? (long)count() : -1;
+}
+
+void
+stats_phase(stats_phase_t phase)
+{
+	uint64_t wall, cpu;
+
+	if (!running)
+		return;
+
+	wall = clock_ns(CLOCK_MONOTONIC);
+	cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+	wall_ns[current] += wall - phase_wall;
+	cpu_ns[current] += cpu - phase_cpu;
+	current = phase;
+	phase_wall = wall;
+	phase_cpu = cpu;
+}
+
+static void
+show_text(const store_stats_t *st, long allocs, long max_rss)
+{
+	uint64_t wall = 0, cpu = 0;
+
+	fprintf(stderr, "%-14s %10s %10s\n", "phase", "wall ms", "cpu ms");
+	for (int i = 0; i < STATS_N_PHASES; i++) {
+		fprintf(stderr, "%-14s %10.3f %10.3f\n", phase_names[i],
+			wall_ns[i] / 1e6, cpu_ns[i] / 1e6);
+		wall += wall_ns[i];
+		cpu += cpu_ns[i];
+	}
+	fprintf(stderr, "%-14s %10.3f %10.3f\n", "total", wall / 1e6,
+		cpu / 1e6);
+	fprintf(stderr, "store %s: %.3f ms in %lu reads, %lu writes, "
+			"%lu deletes, %lu name lookups and %lu stats\n",
+		store_name(), st->ns / 1e6, st->gets, st->sets, st->dels,
+		st->names, st->stats);
+	fprintf(stderr, "bytes read %" PRIu64 ", written %" PRIu64
+			", writes skipped as no-ops %lu\n",
+		st->bytes_read, st->bytes_written, st->skipped_writes);
+	if (allocs >= 0)
+		fprintf(stderr, "allocations %ld\n", allocs);
+	fprintf(stderr, "peak RSS %ld KiB\n", max_rss);
+}
+
+static void
+show_json(const store_stats_t *st, long allocs, long max_rss)
+{
+	fprintf(stderr, "{\"phases\":{");
+	for (int i = 0; i < STATS_N_PHASES; i++)
+		fprintf(stderr, "%s\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f}",
+			i ? "," : "", phase_names[i], wall_ns[i] / 1e6,
+			cpu_ns[i] / 1e6);
+	fprintf(stderr, "},\"store\":{\"name\":\"%s\",\"ms\":%.3f,"
+			"\"reads\":%lu,\"writes\":%lu,\"deletes\":%lu,"
+			"\"names\":%lu,\"stats\":%lu,\"bytes_read\":%" PRIu64
+			",\"bytes_written\":%" PRIu64 ",\"skipped_writes\":%lu}",
+		store_name(), st->ns / 1e6, st->gets, st->sets, st->dels,
+		st->names, st->stats, st->bytes_read, st->bytes_written,
+		st->skipped_writes);
+	if (allocs >= 0)
+		fprintf(stderr, ",\"allocations\":%ld", allocs);
+	else
+		fprintf(stderr, ",\"allocations\":null");
+	fprintf(stderr, ",\"peak_rss_kib\":%ld}\n", max_rss);
+}
+
+static void
+show_stats(void)
+{
+	store_stats_t st;
+	struct rusage ru;
+	long allocs;
+
+	stats_phase(current);
+	running = false;
+
+	allocs = stats_allocations();
+	store_get_stats(&st);
+	if (getrusage(RUSAGE_SELF, &ru) < 0)
+		ru.ru_maxrss = -1;
+
+	fflush(stdout);
+	if (as_json)
+		show_json(&st, allocs, ru.ru_maxrss);
+	else
+		show_text(&st, allocs, ru.ru_maxrss);
+}
+
+void
+stats_start(bool json)
+{
+	as_json = json;
+	current = STATS_SETUP;
+	phase_wall = clock_ns(CLOCK_MONOTONIC);
+	phase_cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+	running = true;
+	atexit(show_stats);
+}
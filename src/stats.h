@@ -0,0 +1,37 @@
+/*
+ * stats.h - where a run's time goes, for --stats
+ *
+ * See "COPYING" for license terms.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+typedef enum {
+	STATS_SETUP,		/* opening the store, --export, --import */
+	STATS_ENUMERATE,	/* finding the entries' names */
+	STATS_READ_VARS,
+	STATS_SET_VAR_NUMS,
+	STATS_MUTATE,		/* every change we were asked to make */
+	STATS_RENDER,		/* listing what's there */
+	STATS_N_PHASES
+} stats_phase_t;
+
+/*
+ * Start timing in the setup phase, and print what was collected to
+ * stderr when the program exits, however it exits.
+ */
+extern void stats_start(bool json);
+
+/*
+ * Charge the time from here on to phase.  A phase can be entered more
+ * than once; its times add up.
+ */
+extern void stats_phase(stats_phase_t phase);
+
+/*
+ * How many allocations bench/malloc-count.so has counted so far, or -1
+ * if it isn't preloaded.
+ */
+extern long stats_allocations(void);
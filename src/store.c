@@ -0,0 +1,938 @@
+/*
+ * store.c - where EFI variables are read from and written to
+ *
+ * See "COPYING" for license terms.
+ */
+
+#include "fix_coverity.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/magic.h>
+
+#include <efivar.h>
+
+#include "clock.h"
+#include "fv_image.h"
+#include "snapshot.h"
+#include "store.h"
+#include "sysfs.h"
+
+#define EFIVARFS_PATH	"/sys/firmware/efi/efivars"
+
+/* "Name-8be4df61-93ca-11d2-aa0d-00e098032b8c" */
+#define GUID_STR_LEN	36
+
+/*
+ * libefivar
+ */
+static int
+efivar_stat(efi_guid_t guid, const char *name, size_t *data_size,
+	    uint32_t *attributes)
+{
+	if (data_size && efi_get_variable_size(guid, name, data_size) < 0)
+		return -1;
+	if (attributes && efi_get_variable_attributes(guid, name, attributes) < 0)
+		return -1;
+	return 0;
+}
+
+/* efivarfs reports what's left of the firmware's store through statfs() */
+static int
+efivar_space(size_t *avail)
+{
+	struct statfs sfs;
+
+	if (statfs(EFIVARFS_PATH, &sfs) < 0)
+		return -1;
+	if ((unsigned long)sfs.f_type != EFIVARFS_MAGIC) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	*avail = (uint64_t)sfs.f_bavail * sfs.f_bsize;
+	return 0;
+}
+
+static const store_ops_t efivar_store = {
+	.name = "efivarfs",
+	.supported = efi_variables_supported,
+	.get = efi_get_variable,
+	.set = efi_set_variable,
+	.del = efi_del_variable,
+	.next_name = efi_get_next_variable_name,
+	.stat = efivar_stat,
+	.space = efivar_space,
+};
+
+/*
+ * A directory in efivarfs format
+ */
+static char *dir_path;
+
+enum {
+	LAT_GET,
+	LAT_SET,
+	LAT_DEL,
+	LAT_NEXT,
+	LAT_STAT,
+	LAT_MAX
+};
+
+static const char * const latency_names[LAT_MAX] = {
+	"get", "set", "del", "next", "stat",
+};
+
+static unsigned long latency_us[LAT_MAX];
+
+static int
+parse_latency(const char *s)
+{
+	char *end;
+	unsigned long us;
+	int i;
+
+	us = strtoul(s, &end, 10);
+	if (end != s && *end == '\0') {
+		for (i = 0; i < LAT_MAX; i++)
+			latency_us[i] = us;
+		return 0;
+	}
+
+	while (*s) {
+		size_t len = strcspn(s, "=");
+
+		for (i = 0; i < LAT_MAX; i++) {
+			if (strlen(latency_names[i]) == len &&
+			    !strncmp(s, latency_names[i], len))
+				break;
+		}
+		if (i == LAT_MAX || s[len] != '=')
+			goto inval;
+		s += len + 1;
+		latency_us[i] = strtoul(s, &end, 10);
+		if (end == s || (*end && *end != ','))
+			goto inval;
+		s = *end ? end + 1 : end;
+	}
+	return 0;
+inval:
+	efi_error("invalid %s \"%s\"", EFIBOOTMGR_STORE_LATENCY_ENV, s);
+	errno = EINVAL;
+	return -1;
+}
+
+static void
+inject_latency(int call)
+{
+	struct timespec ts;
+
+	if (!latency_us[call])
+		return;
+	ts.tv_sec = latency_us[call] / 1000000;
+	ts.tv_nsec = (latency_us[call] % 1000000) * 1000;
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+static int
+dir_var_path(char *path, size_t size, efi_guid_t guid, const char *name)
+{
+	char *guidstr = NULL;
+	int rc;
+
+	if (!name[0] || strchr(name, '/')) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (efi_guid_to_str(&guid, &guidstr) < 0)
+		return -1;
+	rc = snprintf(path, size, "%s/%s-%s", dir_path, name, guidstr);
+	free(guidstr);
+	if (rc < 0 || (size_t)rc >= size) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return 0;
+}
+
+static int
+dir_supported(void)
+{
+	struct stat sb;
+
+	return stat(dir_path, &sb) == 0 && S_ISDIR(sb.st_mode);
+}
+
+static int
+read_var_file(const char *path, uint8_t **data, size_t *data_size,
+	      uint32_t *attributes)
+{
+	uint8_t *buf = NULL;
+	size_t size = 0, alloc = 0;
+	uint32_t attrs;
+	ssize_t n;
+	int fd, saved_errno;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	do {
+		if (size == alloc) {
+			uint8_t *tmp;
+
+			alloc = alloc ? alloc * 2 : 4096;
+			tmp = realloc(buf, alloc);
+			if (!tmp)
+				goto err;
+			buf = tmp;
+		}
+		n = read(fd, buf + size, alloc - size);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			goto err;
+		}
+		size += n;
+	} while (n > 0);
+	close(fd);
+
+	if (size < sizeof(attrs)) {
+		free(buf);
+		efi_error("%s is too short", path);
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(&attrs, buf, sizeof(attrs));
+	size -= sizeof(attrs);
+	memmove(buf, buf + sizeof(attrs), size);
+
+	*data = buf;
+	*data_size = size;
+	*attributes = attrs;
+	return 0;
+err:
+	saved_errno = errno;
+	free(buf);
+	close(fd);
+	errno = saved_errno;
+	return -1;
+}
+
+static int
+dir_get(efi_guid_t guid, const char *name, uint8_t **data, size_t *data_size,
+	uint32_t *attributes)
+{
+	char path[PATH_MAX];
+
+	inject_latency(LAT_GET);
+	if (dir_var_path(path, sizeof(path), guid, name) < 0)
+		return -1;
+	return read_var_file(path, data, data_size, attributes);
+}
+
+/*
+ * Whole writes go to a temporary file which is renamed over the variable,
+ * so a reader never sees half of one, the same as with real firmware.
+ */
+static int
+dir_set(efi_guid_t guid, const char *name, const uint8_t *data,
+	size_t data_size, uint32_t attributes, mode_t mode)
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 8];
+	int fd, saved_errno;
+
+	inject_latency(LAT_SET);
+	if (dir_var_path(path, sizeof(path), guid, name) < 0)
+		return -1;
+
+	if (attributes & EFI_VARIABLE_APPEND_WRITE) {
+		fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+		if (fd < 0)
+			return -1;
+		if (write_all(fd, data, data_size) < 0)
+			goto err;
+		return close(fd);
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fchmod(fd, mode) < 0 ||
+	    write_all(fd, &attributes, sizeof(attributes)) < 0 ||
+	    write_all(fd, data, data_size) < 0) {
+		saved_errno = errno;
+		close(fd);
+		unlink(tmp);
+		errno = saved_errno;
+		return -1;
+	}
+	if (close(fd) < 0 || rename(tmp, path) < 0) {
+		saved_errno = errno;
+		unlink(tmp);
+		errno = saved_errno;
+		return -1;
+	}
+	return 0;
+err:
+	saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+	return -1;
+}
+
+static int
+dir_del(efi_guid_t guid, const char *name)
+{
+	char path[PATH_MAX];
+
+	inject_latency(LAT_DEL);
+	if (dir_var_path(path, sizeof(path), guid, name) < 0)
+		return -1;
+	return unlink(path);
+}
+
+/* split "Name-GUID" the way efivarfs names its files */
+static bool
+parse_var_file_name(const char *file, char *name, size_t size,
+		    efi_guid_t *guid)
+{
+	size_t len = strlen(file);
+
+	if (len < GUID_STR_LEN + 2 || file[len - GUID_STR_LEN - 1] != '-')
+		return false;
+	len -= GUID_STR_LEN + 1;
+	if (len >= size)
+		return false;
+	if (efi_str_to_guid(file + len + 1, guid) < 0)
+		return false;
+	memcpy(name, file, len);
+	name[len] = '\0';
+	return true;
+}
+
+static int
+dir_next_name(efi_guid_t **guid, char **name)
+{
+	static DIR *dir;
+	static efi_guid_t cur_guid;
+	static char cur_name[NAME_MAX + 1];
+	struct dirent *de;
+	int saved_errno;
+
+	inject_latency(LAT_NEXT);
+	if (!dir) {
+		dir = opendir(dir_path);
+		if (!dir) {
+			efi_error("could not open %s", dir_path);
+			return -1;
+		}
+	}
+
+	errno = 0;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.' ||
+		    !parse_var_file_name(de->d_name, cur_name,
+					 sizeof(cur_name), &cur_guid))
+			continue;
+		*guid = &cur_guid;
+		*name = cur_name;
+		return 1;
+	}
+	saved_errno = errno;
+	closedir(dir);
+	dir = NULL;
+	errno = saved_errno;
+	return errno ? -1 : 0;
+}
+
+static int
+dir_stat(efi_guid_t guid, const char *name, size_t *data_size,
+	 uint32_t *attributes)
+{
+	char path[PATH_MAX];
+	uint32_t attrs;
+	struct stat sb;
+	int fd;
+
+	inject_latency(LAT_STAT);
+	if (dir_var_path(path, sizeof(path), guid, name) < 0)
+		return -1;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &sb) < 0 ||
+	    read(fd, &attrs, sizeof(attrs)) != sizeof(attrs)) {
+		close(fd);
+		efi_error("could not read %s", path);
+		errno = EINVAL;
+		return -1;
+	}
+	close(fd);
+	if (data_size)
+		*data_size = sb.st_size - sizeof(attrs);
+	if (attributes)
+		*attributes = attrs;
+	return 0;
+}
+
+static const store_ops_t dir_store = {
+	.name = "directory",
+	.supported = dir_supported,
+	.get = dir_get,
+	.set = dir_set,
+	.del = dir_del,
+	.next_name = dir_next_name,
+	.stat = dir_stat,
+};
+
+/*
+ * In memory
+ */
+typedef struct {
+	efi_guid_t guid;
+	char *name;
+	uint8_t *data;
+	size_t data_size;
+	uint32_t attributes;
+} mem_var_t;
+
+static mem_var_t *mem_vars;
+static size_t n_mem_vars;
+
+static mem_var_t *
+mem_find(efi_guid_t guid, const char *name)
+{
+	for (size_t i = 0; i < n_mem_vars; i++) {
+		if (!efi_guid_cmp(&mem_vars[i].guid, &guid) &&
+		    !strcmp(mem_vars[i].name, name))
+			return &mem_vars[i];
+	}
+	errno = ENOENT;
+	return NULL;
+}
+
+static int
+mem_supported(void)
+{
+	return 1;
+}
+
+static int
+mem_get(efi_guid_t guid, const char *name, uint8_t **data, size_t *data_size,
+	uint32_t *attributes)
+{
+	mem_var_t *var = mem_find(guid, name);
+	uint8_t *buf;
+
+	if (!var)
+		return -1;
+	buf = malloc(var->data_size ? var->data_size : 1);
+	if (!buf)
+		return -1;
+	memcpy(buf, var->data, var->data_size);
+	*data = buf;
+	*data_size = var->data_size;
+	*attributes = var->attributes;
+	return 0;
+}
+
+static int
+mem_set(efi_guid_t guid, const char *name, const uint8_t *data,
+	size_t data_size, uint32_t attributes, mode_t mode)
+{
+	mem_var_t *var = mem_find(guid, name);
+	size_t offset = 0;
+	uint8_t *buf;
+
+	(void)mode;
+
+	if (!var) {
+		mem_var_t *tmp;
+
+		if (attributes & EFI_VARIABLE_APPEND_WRITE)
+			return -1;
+		tmp = realloc(mem_vars, (n_mem_vars + 1) * sizeof(*mem_vars));
+		if (!tmp)
+			return -1;
+		mem_vars = tmp;
+		var = &mem_vars[n_mem_vars];
+		memset(var, 0, sizeof(*var));
+		var->guid = guid;
+		var->name = strdup(name);
+		if (!var->name)
+			return -1;
+		n_mem_vars++;
+	}
+
+	if (attributes & EFI_VARIABLE_APPEND_WRITE) {
+		offset = var->data_size;
+		attributes = var->attributes;
+	}
+	buf = realloc(var->data, (offset + data_size) ? offset + data_size : 1);
+	if (!buf)
+		return -1;
+	memcpy(buf + offset, data, data_size);
+	var->data = buf;
+	var->data_size = offset + data_size;
+	var->attributes = attributes;
+	return 0;
+}
+
+static int
+mem_del(efi_guid_t guid, const char *name)
+{
+	mem_var_t *var = mem_find(guid, name);
+
+	if (!var)
+		return -1;
+	free(var->name);
+	free(var->data);
+	memmove(var, var + 1,
+		(n_mem_vars - (var - mem_vars) - 1) * sizeof(*var));
+	n_mem_vars--;
+	return 0;
+}
+
+static int
+mem_next_name(efi_guid_t **guid, char **name)
+{
+	static size_t next;
+
+	if (next >= n_mem_vars) {
+		next = 0;
+		return 0;
+	}
+	*guid = &mem_vars[next].guid;
+	*name = mem_vars[next].name;
+	next++;
+	return 1;
+}
+
+static int
+mem_stat(efi_guid_t guid, const char *name, size_t *data_size,
+	 uint32_t *attributes)
+{
+	mem_var_t *var = mem_find(guid, name);
+
+	if (!var)
+		return -1;
+	if (data_size)
+		*data_size = var->data_size;
+	if (attributes)
+		*attributes = var->attributes;
+	return 0;
+}
+
+static const store_ops_t mem_store = {
+	.name = "memory",
+	.supported = mem_supported,
+	.get = mem_get,
+	.set = mem_set,
+	.del = mem_del,
+	.next_name = mem_next_name,
+	.stat = mem_stat,
+};
+
+/* forget whatever an earlier store_open() left in memory */
+static void
+mem_clear(void)
+{
+	for (size_t i = 0; i < n_mem_vars; i++) {
+		free(mem_vars[i].name);
+		free(mem_vars[i].data);
+	}
+	free(mem_vars);
+	mem_vars = NULL;
+	n_mem_vars = 0;
+}
+
+/* copy every variable in the directory store into memory */
+static int
+mem_load(void)
+{
+	efi_guid_t *guid;
+	char *name;
+	int rc;
+
+	mem_clear();
+	while ((rc = dir_next_name(&guid, &name)) > 0) {
+		uint8_t *data = NULL;
+		size_t data_size = 0;
+		uint32_t attributes = 0;
+
+		if (dir_get(*guid, name, &data, &data_size, &attributes) < 0 ||
+		    mem_set(*guid, name, data, data_size, attributes, 0) < 0) {
+			free(data);
+			/* finish the walk so it starts over next time */
+			while (dir_next_name(&guid, &name) > 0)
+				;
+			return -1;
+		}
+		free(data);
+	}
+	return rc;
+}
+
+static const store_ops_t *store = &efivar_store;
+
+/*
+ * An edk2 firmware volume image
+ */
+static fv_image_t *image;
+
+static int
+image_supported(void)
+{
+	return image != NULL;
+}
+
+static int
+image_get(efi_guid_t guid, const char *name, uint8_t **data,
+	  size_t *data_size, uint32_t *attributes)
+{
+	const uint8_t *p;
+	size_t size;
+	uint8_t *buf;
+
+	if (fv_image_get(image, &guid, name, &p, &size, attributes) < 0)
+		return -1;
+	buf = malloc(size ? size : 1);
+	if (!buf)
+		return -1;
+	memcpy(buf, p, size);
+	*data = buf;
+	*data_size = size;
+	return 0;
+}
+
+static int
+image_set(efi_guid_t guid, const char *name, const uint8_t *data,
+	  size_t data_size, uint32_t attributes, mode_t mode)
+{
+	(void)mode;
+
+	return fv_image_set(image, &guid, name, data, data_size, attributes);
+}
+
+static int
+image_del(efi_guid_t guid, const char *name)
+{
+	return fv_image_del(image, &guid, name);
+}
+
+static int
+image_next_name(efi_guid_t **guid, char **name)
+{
+	static size_t iter;
+	int rc;
+
+	rc = fv_image_next(image, &iter, guid, name);
+	if (rc == 0)
+		iter = 0;
+	return rc;
+}
+
+static int
+image_stat(efi_guid_t guid, const char *name, size_t *data_size,
+	   uint32_t *attributes)
+{
+	return fv_image_get(image, &guid, name, NULL, data_size, attributes);
+}
+
+static int
+image_space(size_t *avail)
+{
+	*avail = fv_image_space(image);
+	return 0;
+}
+
+static const store_ops_t image_store = {
+	.name = "image",
+	.supported = image_supported,
+	.get = image_get,
+	.set = image_set,
+	.del = image_del,
+	.next_name = image_next_name,
+	.stat = image_stat,
+	.space = image_space,
+};
+
+int
+store_open_image(const char *path, bool writable)
+{
+	fv_image_t *img;
+
+	if (fv_image_open(path, writable, &img) < 0)
+		return -1;
+	fv_image_close(image);
+	image = img;
+	store = &image_store;
+	return 0;
+}
+
+/*
+ * A snapshot written by --export, which can only be read
+ */
+static snapshot_t *snap;
+
+static int
+snap_supported(void)
+{
+	return snap != NULL;
+}
+
+static int
+snap_get(efi_guid_t guid, const char *name, uint8_t **data,
+	 size_t *data_size, uint32_t *attributes)
+{
+	const uint8_t *p;
+	size_t size;
+	uint8_t *buf;
+
+	if (snapshot_get(snap, &guid, name, &p, &size, attributes) < 0)
+		return -1;
+	buf = malloc(size ? size : 1);
+	if (!buf)
+		return -1;
+	memcpy(buf, p, size);
+	*data = buf;
+	*data_size = size;
+	return 0;
+}
+
+static int
+snap_set(efi_guid_t guid, const char *name, const uint8_t *data,
+	 size_t data_size, uint32_t attributes, mode_t mode)
+{
+	(void)guid;
+	(void)name;
+	(void)data;
+	(void)data_size;
+	(void)attributes;
+	(void)mode;
+
+	errno = EROFS;
+	return -1;
+}
+
+static int
+snap_del(efi_guid_t guid, const char *name)
+{
+	(void)guid;
+	(void)name;
+
+	errno = EROFS;
+	return -1;
+}
+
+static int
+snap_next_name(efi_guid_t **guid, char **name)
+{
+	static size_t iter;
+	int rc;
+
+	rc = snapshot_next(snap, &iter, guid, name);
+	if (rc == 0)
+		iter = 0;
+	return rc;
+}
+
+static int
+snap_stat(efi_guid_t guid, const char *name, size_t *data_size,
+	  uint32_t *attributes)
+{
+	return snapshot_get(snap, &guid, name, NULL, data_size, attributes);
+}
+
+static const store_ops_t snap_store = {
+	.name = "snapshot",
+	.supported = snap_supported,
+	.get = snap_get,
+	.set = snap_set,
+	.del = snap_del,
+	.next_name = snap_next_name,
+	.stat = snap_stat,
+};
+
+int
+store_open_snapshot(const char *path)
+{
+	snapshot_t *s;
+
+	if (snapshot_open(path, &s) < 0)
+		return -1;
+	snapshot_close(snap);
+	snap = s;
+	store = &snap_store;
+	return 0;
+}
+
+int
+store_open(const char *spec)
+{
+	const char *latency;
+	const char *dir = NULL;
+	struct stat sb;
+
+	if (!spec || !strcmp(spec, "efivarfs")) {
+		store = &efivar_store;
+		return 0;
+	}
+
+	if (!strncmp(spec, "image:", 6))
+		return store_open_image(spec + 6, true);
+	if (!strncmp(spec, "snapshot:", 9))
+		return store_open_snapshot(spec + 9);
+
+	if (!strcmp(spec, "mem")) {
+		mem_clear();
+		store = &mem_store;
+		return 0;
+	}
+	if (!strncmp(spec, "mem:", 4))
+		dir = spec + 4;
+	else
+		dir = spec;
+
+	free(dir_path);
+	dir_path = strdup(dir);
+	if (!dir_path)
+		return -1;
+	if (stat(dir, &sb) < 0)
+		return -1;
+	if (!S_ISDIR(sb.st_mode)) {
+		errno = ENOTDIR;
+		return -1;
+	}
+
+	if (dir != spec) {
+		/* loading it shouldn't be slow */
+		if (mem_load() < 0)
+			return -1;
+		store = &mem_store;
+		return 0;
+	}
+
+	latency = getenv(EFIBOOTMGR_STORE_LATENCY_ENV);
+	if (latency && parse_latency(latency) < 0)
+		return -1;
+	store = &dir_store;
+	return 0;
+}
+
+static store_stats_t stats;
+
+static void
+count(unsigned long *calls, uint64_t start)
+{
+	(*calls)++;
+	stats.ns += now_ns() - start;
+}
+
+void
+store_get_stats(store_stats_t *statsp)
+{
+	*statsp = stats;
+}
+
+void
+store_skipped_write(void)
+{
+	stats.skipped_writes++;
+}
+
+const char *
+store_name(void)
+{
+	return store->name;
+}
+
+int
+store_variables_supported(void)
+{
+	return store->supported();
+}
+
+int
+store_get_variable(efi_guid_t guid, const char *name, uint8_t **data,
+		   size_t *data_size, uint32_t *attributes)
+{
+	uint64_t start = now_ns();
+	int rc;
+
+	rc = store->get(guid, name, data, data_size, attributes);
+	count(&stats.gets, start);
+	if (rc == 0)
+		stats.bytes_read += *data_size;
+	return rc;
+}
+
+int
+store_set_variable(efi_guid_t guid, const char *name, const uint8_t *data,
+		   size_t data_size, uint32_t attributes, mode_t mode)
+{
+	uint64_t start = now_ns();
+	int rc;
+
+	rc = store->set(guid, name, data, data_size, attributes, mode);
+	count(&stats.sets, start);
+	if (rc == 0)
+		stats.bytes_written += data_size;
+	return rc;
+}
+
+int
+store_del_variable(efi_guid_t guid, const char *name)
+{
+	uint64_t start = now_ns();
+	int rc;
+
+	rc = store->del(guid, name);
+	count(&stats.dels, start);
+	return rc;
+}
+
+int
+store_get_next_variable_name(efi_guid_t **guid, char **name)
+{
+	uint64_t start = now_ns();
+	int rc;
+
+	rc = store->next_name(guid, name);
+	count(&stats.names, start);
+	return rc;
+}
+
+int
+store_stat_variable(efi_guid_t guid, const char *name, size_t *data_size,
+		    uint32_t *attributes)
+{
+	uint64_t start = now_ns();
+	int rc;
+
+	rc = store->stat(guid, name, data_size, attributes);
+	count(&stats.stats, start);
+	return rc;
+}
+
+int
+store_space(size_t *avail)
+{
+	if (!store->space) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	return store->space(avail);
+}
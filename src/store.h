@@ -0,0 +1,117 @@
+/*
+ * store.h - where EFI variables are read from and written to
+ *
+ * See "COPYING" for license terms.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <efivar.h>
+
+/*
+ * A variable store.  The calls have the same contract as their libefivar
+ * counterparts: -1 with errno set on failure (ENOENT for a variable that
+ * isn't there), and next_name returns 1 with *guid and *name pointing at
+ * storage owned by the store, then 0 once every variable has been seen.
+ */
+typedef struct {
+	const char *name;
+	int (*supported)(void);
+	int (*get)(efi_guid_t guid, const char *name, uint8_t **data,
+		   size_t *data_size, uint32_t *attributes);
+	int (*set)(efi_guid_t guid, const char *name, const uint8_t *data,
+		   size_t data_size, uint32_t attributes, mode_t mode);
+	int (*del)(efi_guid_t guid, const char *name);
+	int (*next_name)(efi_guid_t **guid, char **name);
+	int (*stat)(efi_guid_t guid, const char *name, size_t *data_size,
+		    uint32_t *attributes);
+	int (*space)(size_t *avail);		/* optional */
+} store_ops_t;
+
+#define EFIBOOTMGR_STORE_ENV		"EFIBOOTMGR_STORE"
+#define EFIBOOTMGR_STORE_LATENCY_ENV	"EFIBOOTMGR_STORE_LATENCY"
+
+/*
+ * Pick the store all the calls below go to.  spec is one of:
+ *
+ *   NULL or "efivarfs"	the firmware, through libefivar
+ *   DIR		a directory laid out like efivarfs: one Name-GUID file
+ *			per variable, holding the 32-bit attributes and then
+ *			the data
+ *   "mem" or "mem:DIR"	an in-memory store, empty or loaded from DIR;
+ *			nothing is written back
+ *   "image:FILE"	an edk2 variable store image such as OVMF_VARS.fd,
+ *			see store_open_image()
+ *   "snapshot:FILE"	an archive written by --export, see
+ *			store_open_snapshot()
+ *
+ * The directory store sleeps before each call if EFIBOOTMGR_STORE_LATENCY
+ * is set, either to a number of microseconds for every call, or to a list
+ * like "get=200,set=50000,del=20000,next=10,stat=100".
+ *
+ * Returns 0, or -1 with errno set if spec can't be used.
+ */
+extern int store_open(const char *spec);
+
+/*
+ * Use the variable store in the edk2 firmware volume image at path, as
+ * found in OVMF_VARS.fd.  Changes are written to the image in place
+ * unless writable is false.
+ */
+extern int store_open_image(const char *path, bool writable);
+
+/*
+ * Read the variables in a snapshot archive written by snapshot_export().
+ * Nothing can be changed; setting or deleting fails with EROFS.
+ */
+extern int store_open_snapshot(const char *path);
+
+extern const char *store_name(void);
+
+extern int store_variables_supported(void);
+extern int store_get_variable(efi_guid_t guid, const char *name,
+			      uint8_t **data, size_t *data_size,
+			      uint32_t *attributes);
+extern int store_set_variable(efi_guid_t guid, const char *name,
+			      const uint8_t *data, size_t data_size,
+			      uint32_t attributes, mode_t mode);
+extern int store_del_variable(efi_guid_t guid, const char *name);
+extern int store_get_next_variable_name(efi_guid_t **guid, char **name);
+extern int store_stat_variable(efi_guid_t guid, const char *name,
+			       size_t *data_size, uint32_t *attributes);
+
+/*
+ * How many bytes of variable data the store still has room for.  Returns
+ * 0, or -1 with errno set to ENOTSUP if the store can't tell.
+ */
+extern int store_space(size_t *avail);
+
+/*
+ * What the calls above have cost so far: how many of each were made, the
+ * bytes they moved, and the time spent in them.  Like the rest of the
+ * store, the counting isn't thread safe.
+ */
+typedef struct {
+	unsigned long	gets;
+	unsigned long	sets;
+	unsigned long	dels;
+	unsigned long	names;
+	unsigned long	stats;
+	unsigned long	skipped_writes;
+	uint64_t	bytes_read;
+	uint64_t	bytes_written;
+	uint64_t	ns;
+} store_stats_t;
+
+extern void store_get_stats(store_stats_t *stats);
+
+/*
+ * Callers that find a write would leave a variable as it is, and so
+ * don't make it, count it here.
+ */
+extern void store_skipped_write(void);
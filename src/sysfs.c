@@ -0,0 +1,116 @@
+/*
+ * sysfs.c - small helpers for reading block device data from sysfs, and
+ * for writing files
+ *
+ * See "COPYING" for license terms.
+ */
+
+#include "fix_coverity.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "sysfs.h"
+
+int
+sysfs_read_line(char *buf, size_t size, const char *fmt, ...)
+{
+	char path[PATH_MAX];
+	va_list ap;
+	FILE *f;
+	size_t len;
+
+	va_start(ap, fmt);
+	vsnprintf(path, sizeof(path), fmt, ap);
+	va_end(ap);
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	if (!fgets(buf, size, f)) {
+		fclose(f);
+		errno = ENOENT;
+		return -1;
+	}
+	fclose(f);
+	len = strlen(buf);
+	while (len > 0 && isspace((unsigned char)buf[len-1]))
+		buf[--len] = '\0';
+	return 0;
+}
+
+int
+sysfs_read_dev(const char *path, dev_t *dev)
+{
+	unsigned int maj, min;
+	char buf[32];
+
+	if (sysfs_read_line(buf, sizeof(buf), "%s", path) < 0)
+		return -1;
+	if (sscanf(buf, "%u:%u", &maj, &min) != 2) {
+		errno = EINVAL;
+		return -1;
+	}
+	*dev = makedev(maj, min);
+	return 0;
+}
+
+void
+sysfs_block_dir(dev_t dev, char sysdir[SYSDIR_MAX])
+{
+	snprintf(sysdir, SYSDIR_MAX, "/sys/dev/block/%u:%u", major(dev),
+		 minor(dev));
+}
+
+int
+sysfs_find_partition(const char *sysdir, int part, dev_t *partdev)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	char buf[32];
+	DIR *dir;
+	int rc = -1;
+
+	dir = opendir(sysdir);
+	if (!dir)
+		return -1;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		if (sysfs_read_line(buf, sizeof(buf), "%s/%s/partition",
+				    sysdir, de->d_name) < 0 ||
+		    atoi(buf) != part)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s/dev", sysdir, de->d_name);
+		rc = sysfs_read_dev(path, partdev);
+		break;
+	}
+	closedir(dir);
+	return rc;
+}
+
+int
+write_all(int fd, const void *buf, size_t size)
+{
+	size_t pos = 0;
+
+	while (pos < size) {
+		ssize_t rc = write(fd, (const uint8_t *)buf + pos, size - pos);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0)
+			return -1;
+		pos += rc;
+	}
+	return 0;
+}
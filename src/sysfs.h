@@ -0,0 +1,39 @@
+/*
+ * sysfs.h - small helpers for reading block device data from sysfs, and
+ * for writing files
+ *
+ * See "COPYING" for license terms.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* big enough for "/sys/dev/block/MAJ:MIN" */
+#define SYSDIR_MAX	64
+
+/*
+ * Read the first line of the file named by fmt into buf, with any
+ * trailing whitespace removed.  Returns 0, or -1 with errno set.
+ */
+extern int sysfs_read_line(char *buf, size_t size, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+/* Read a "MAJ:MIN" file such as .../dev.  Returns 0 or -1. */
+extern int sysfs_read_dev(const char *path, dev_t *dev);
+
+/* The /sys/dev/block directory of block device dev. */
+extern void sysfs_block_dir(dev_t dev, char sysdir[SYSDIR_MAX]);
+
+/*
+ * Find the dev_t of partition part of the disk whose sysfs directory is
+ * sysdir.  Returns 0, or -1 if there's no such partition.
+ */
+extern int sysfs_find_partition(const char *sysdir, int part, dev_t *partdev);
+
+/*
+ * Write all of buf to fd, going around again after short writes and
+ * EINTR.  Returns 0, or -1 with errno set.
+ */
+extern int write_all(int fd, const void *buf, size_t size);